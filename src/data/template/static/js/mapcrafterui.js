@@ -182,7 +182,11 @@ MapcrafterUI.prototype.setMapRotation = function(rotation) {
 };
 
 MapcrafterUI.prototype.createTileLayer = function(name, config, rotation) {
-	var layer = new MCTileLayer(name + "/" + ["tl", "tr", "br", "bl"][rotation], {
+	var url = name + "/" + ["tl", "tr", "br", "bl"][rotation];
+	// tiles of tile archives are served by the bundled reader
+	if(config.tileArchive)
+		url = "tiles.cgi/" + url;
+	var layer = new MCTileLayer(url, {
 		maxZoom: config.maxZoom,
 		tileSize: config.tileSize,
 		noWrap: true,
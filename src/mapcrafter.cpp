@@ -63,7 +63,9 @@ int main(int argc, char** argv) {
 		("render-force,f", po::value<std::vector<std::string>>(&opts.render_force)->multitoken(),
 			"renders the specified map(s) completely")
 		("jobs,j", po::value<int>(&opts.jobs)->default_value(1),
-			"the count of jobs to use when rendering the map");
+			"the count of jobs to use when rendering the map")
+		("fsync", "syncs the written tiles to the disk (in batches), slower but "
+			"the tiles survive a system crash");
 
 	po::options_description all("Allowed options");
 	all.add(general).add(logging).add(renderer);
@@ -151,6 +153,7 @@ int main(int argc, char** argv) {
 	opts.config = config;
 	opts.skip_all = vm.count("render-reset");
 	opts.batch = vm.count("batch");
+	opts.sync_tiles = vm.count("fsync");
 	if (!vm.count("logging-config"))
 		opts.logging_config = util::findLoggingConfigFile();
 
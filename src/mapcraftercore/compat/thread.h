@@ -28,6 +28,7 @@ namespace thread_ns = boost;
 #else
 #  include <condition_variable>
 #  include <mutex>
+#  include <thread>
 namespace thread_ns = std;
 #endif
 
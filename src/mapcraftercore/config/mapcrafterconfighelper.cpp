@@ -60,6 +60,8 @@ std::string MapcrafterConfigHelper::generateTemplateJavascript() const {
 		js += "\ttileSize: " + util::str(32 * it->getTextureSize()) + ",\n";
 		js += "\tmaxZoom: " + util::str(getMapZoomlevel(it->getShortName())) + ",\n";
 		js += "\timageFormat: \"" + it->getImageFormatSuffix() + "\",\n";
+		if (it->useTileArchive())
+			js += "\ttileArchive: true,\n";
 
 		js += "\trotations: [";
 		auto rotations = it->getRotations();
@@ -77,6 +77,10 @@ void MapSection::dump(std::ostream& out) const {
 	out << "  render_leaves_transparent = " << render_leaves_transparent << std::endl;
 	out << "  render_biomes = " << render_biomes << std::endl;
 	out << "  use_image_timestamps = " << use_image_mtimes << std::endl;
+	out << "  use_chunk_hashes = " << use_chunk_hashes << std::endl;
+	out << "  use_tile_archive = " << use_tile_archive << std::endl;
+	out << "  deduplicate_tiles = " << deduplicate_tiles << std::endl;
+	out << "  write_tile_manifest = " << write_tile_manifest << std::endl;
 }
 
 void MapSection::setConfigDir(const fs::path& config_dir) {
@@ -149,6 +153,23 @@ bool MapSection::useImageModificationTimes() const {
 	return use_image_mtimes.getValue();
 }
 
+bool MapSection::useChunkHashes() const {
+	return use_chunk_hashes.getValue();
+}
+
+bool MapSection::useTileArchive() const {
+	return use_tile_archive.getValue();
+}
+
+bool MapSection::deduplicateTiles() const {
+	// tiles in a tile archive are not deduplicated
+	return deduplicate_tiles.getValue() && !use_tile_archive.getValue();
+}
+
+bool MapSection::writeTileManifest() const {
+	return write_tile_manifest.getValue();
+}
+
 void MapSection::preParse(const INIConfigSection& section,
 		ValidationList& validation) {
 	name_short = getSectionName();
@@ -173,6 +194,10 @@ void MapSection::preParse(const INIConfigSection& section,
 	render_leaves_transparent.setDefault(true);
 	render_biomes.setDefault(true);
 	use_image_mtimes.setDefault(true);
+	use_chunk_hashes.setDefault(false);
+	use_tile_archive.setDefault(false);
+	deduplicate_tiles.setDefault(false);
+	write_tile_manifest.setDefault(false);
 }
 
 bool MapSection::parseField(const std::string key, const std::string value,
@@ -218,6 +243,14 @@ bool MapSection::parseField(const std::string key, const std::string value,
 		render_biomes.load(key, value, validation);
 	} else if (key == "use_image_mtimes") {
 		use_image_mtimes.load(key, value, validation);
+	} else if (key == "use_chunk_hashes") {
+		use_chunk_hashes.load(key, value, validation);
+	} else if (key == "use_tile_archive") {
+		use_tile_archive.load(key, value, validation);
+	} else if (key == "deduplicate_tiles") {
+		deduplicate_tiles.load(key, value, validation);
+	} else if (key == "write_tile_manifest") {
+		write_tile_manifest.load(key, value, validation);
 	} else
 		return false;
 	return true;
@@ -239,6 +272,10 @@ void MapSection::postParse(const INIConfigSection& section,
 			validation.error("Invalid rotation '" + elem + "'!");
 	}
 
+	if (deduplicate_tiles.getValue() && use_tile_archive.getValue())
+		validation.warning("Tiles in a tile archive are not deduplicated "
+				"('deduplicate_tiles' is ignored)!");
+
 	// check if required options were specified
 	if (!isGlobal()) {
 		world.require(validation, "You have to specify a world ('world')!");
@@ -72,6 +72,10 @@ public:
 	bool renderLeavesTransparent() const;
 	bool renderBiomes() const;
 	bool useImageModificationTimes() const;
+	bool useChunkHashes() const;
+	bool useTileArchive() const;
+	bool deduplicateTiles() const;
+	bool writeTileManifest() const;
 
 protected:
 	virtual void preParse(const INIConfigSection& section,
@@ -100,6 +104,7 @@ private:
 	Field<double> lighting_intensity;
 	Field<bool> cave_high_contrast;
 	Field<bool> render_unknown_blocks, render_leaves_transparent, render_biomes, use_image_mtimes;
+	Field<bool> use_chunk_hashes, use_tile_archive, deduplicate_tiles, write_tile_manifest;
 };
 
 } /* namespace config */
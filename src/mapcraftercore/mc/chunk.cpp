@@ -20,22 +20,14 @@
 #include "chunk.h"
 
 #include <cmath>
+#include <cstring>
 #include <iostream>
 
 namespace mapcrafter {
 namespace mc {
 
-const uint8_t* ChunkSection::getArray(int i) const {
-	if (i == 0)
-		return data;
-	else if (i == 1)
-		return block_light;
-	else
-		return sky_light;
-}
-
 Chunk::Chunk()
-	: chunkpos(42, 42), rotation(0), terrain_populated(false) {
+	: chunkpos(42, 42), rotation(0), terrain_populated(false), fields(GET_ALL) {
 	clear();
 }
 
@@ -50,6 +42,10 @@ void Chunk::setWorldCrop(const WorldCrop& world_crop) {
 	this->world_crop = world_crop;
 }
 
+void Chunk::setFields(int fields) {
+	this->fields = fields;
+}
+
 bool Chunk::readNBT(const char* data, size_t len, nbt::Compression compression) {
 	clear();
 
@@ -83,7 +79,9 @@ bool Chunk::readNBT(const char* data, size_t len, nbt::Compression compression)
 	else
 		LOG(ERROR) << "Corrupt chunk " << chunkpos << ": No terrain populated tag found!";
 
-	if (level.hasArray<nbt::TagByteArray>("Biomes", 256)) {
+	if (!(fields & GET_BIOME))
+		std::fill(&biomes[0], &biomes[256], 0);
+	else if (level.hasArray<nbt::TagByteArray>("Biomes", 256)) {
 		const nbt::TagByteArray& biomes_tag = level.findTag<nbt::TagByteArray>("Biomes");
 		std::copy(biomes_tag.payload.begin(), biomes_tag.payload.end(), biomes);
 	} else
@@ -99,26 +97,25 @@ bool Chunk::readNBT(const char* data, size_t len, nbt::Compression compression)
 	if (sections_tag.tag_type != nbt::TagCompound::TAG_TYPE)
 		return true;
 
+	bool read_data = fields & GET_DATA;
+	bool read_light = fields & GET_LIGHT;
+
 	// go through all sections
 	for (auto it = sections_tag.payload.begin(); it != sections_tag.payload.end(); ++it) {
 		const nbt::TagCompound& section_tag = (*it)->cast<nbt::TagCompound>();
 		
-		// make sure section is valid
+		// make sure section is valid (only the arrays we need)
 		if (!section_tag.hasTag<nbt::TagByte>("Y")
 				|| !section_tag.hasArray<nbt::TagByteArray>("Blocks", 4096)
-				|| !section_tag.hasArray<nbt::TagByteArray>("Data", 2048)
-				|| !section_tag.hasArray<nbt::TagByteArray>("BlockLight", 2048)
-				|| !section_tag.hasArray<nbt::TagByteArray>("SkyLight", 2048))
+				|| (read_data && !section_tag.hasArray<nbt::TagByteArray>("Data", 2048))
+				|| (read_light && (!section_tag.hasArray<nbt::TagByteArray>("BlockLight", 2048)
+						|| !section_tag.hasArray<nbt::TagByteArray>("SkyLight", 2048))))
 			continue;
 		
 		const nbt::TagByte& y = section_tag.findTag<nbt::TagByte>("Y");
 		if (y.payload >= CHUNK_HEIGHT)
 			continue;
 		const nbt::TagByteArray& blocks = section_tag.findTag<nbt::TagByteArray>("Blocks");
-		const nbt::TagByteArray& data = section_tag.findTag<nbt::TagByteArray>("Data");
-
-		const nbt::TagByteArray& block_light = section_tag.findTag<nbt::TagByteArray>("BlockLight");
-		const nbt::TagByteArray& sky_light = section_tag.findTag<nbt::TagByteArray>("SkyLight");
 
 		// create a ChunkSection-object
 		ChunkSection section;
@@ -130,9 +127,22 @@ bool Chunk::readNBT(const char* data, size_t len, nbt::Compression compression)
 			const nbt::TagByteArray& add = section_tag.findTag<nbt::TagByteArray>("Add");
 			std::copy(add.payload.begin(), add.payload.end(), section.add);
 		}
-		std::copy(data.payload.begin(), data.payload.end(), section.data);
-		std::copy(block_light.payload.begin(), block_light.payload.end(), section.block_light);
-		std::copy(sky_light.payload.begin(), sky_light.payload.end(), section.sky_light);
+		if (!read_data)
+			std::fill(&section.data[0], &section.data[2048], 0);
+		else {
+			const nbt::TagByteArray& data = section_tag.findTag<nbt::TagByteArray>("Data");
+			std::copy(data.payload.begin(), data.payload.end(), section.data);
+		}
+
+		if (read_light) {
+			const nbt::TagByteArray& block_light = section_tag.findTag<nbt::TagByteArray>("BlockLight");
+			const nbt::TagByteArray& sky_light = section_tag.findTag<nbt::TagByteArray>("SkyLight");
+
+			ChunkSectionLight light;
+			std::copy(block_light.payload.begin(), block_light.payload.end(), light.block_light);
+			std::copy(sky_light.payload.begin(), sky_light.payload.end(), light.sky_light);
+			section_lights.push_back(light);
+		}
 
 		// add this section to the section list
 		section_offsets[section.y] = sections.size();
@@ -144,6 +154,7 @@ bool Chunk::readNBT(const char* data, size_t len, nbt::Compression compression)
 
 void Chunk::clear() {
 	sections.clear();
+	section_lights.clear();
 	for (int i = 0; i < CHUNK_HEIGHT; i++)
 		section_offsets[i] = -1;
 }
@@ -237,14 +248,26 @@ uint8_t Chunk::getData(const LocalBlockPos& pos, int array, bool force) const {
 	if (!checkBlockWorldCrop(x, z, pos.y))
 		return array == 2 ? 15 : 0;
 
+	// get the array with the requested data
+	const uint8_t* values;
+	if (array == 0)
+		values = sections[section_offsets[section]].data;
+	else if (section_lights.empty())
+		// the lighting data was not read, handle it like a not existing section
+		return array == 2 ? 15 : 0;
+	else if (array == 1)
+		values = section_lights[section_offsets[section]].block_light;
+	else
+		values = section_lights[section_offsets[section]].sky_light;
+
 	uint8_t data = 0;
 	// calculate the offset and get the block data
 	int offset = ((pos.y % 16) * 16 + z) * 16 + x;
 	// handle bottom/top nibble
 	if ((offset % 2) == 0)
-		data = sections[section_offsets[section]].getArray(array)[offset / 2] & 0xf;
+		data = values[offset / 2] & 0xf;
 	else
-		data = (sections[section_offsets[section]].getArray(array)[offset / 2] >> 4) & 0x0f;
+		data = (values[offset / 2] >> 4) & 0x0f;
 	if (!force && world_crop.hasBlockMask()) {
 		const BlockMask* mask = world_crop.getBlockMask();
 		if (mask->isHidden(getBlockID(pos, true), data))
@@ -278,5 +301,41 @@ const ChunkPos& Chunk::getPos() const {
 	return chunkpos;
 }
 
+/**
+ * Adds data to a 64 bit FNV-1a like hash, eight bytes at once. The shift mixes the high
+ * bits back into the low bits, otherwise the last byte of every eight bytes would only
+ * change the highest bits of the hash.
+ */
+uint64_t hashSectionData(uint64_t hash, const uint8_t* data, size_t size) {
+	for (size_t i = 0; i + 8 <= size; i += 8) {
+		uint64_t value;
+		std::memcpy(&value, data + i, 8);
+		hash ^= value;
+		hash *= 0x100000001b3ULL;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+uint64_t Chunk::getSectionHash(int section) const {
+	if (!hasSection(section))
+		return 0;
+	int index = section_offsets[section];
+	const ChunkSection& data = sections[index];
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = hashSectionData(hash, data.blocks, sizeof(data.blocks));
+	hash = hashSectionData(hash, data.add, sizeof(data.add));
+	hash = hashSectionData(hash, data.data, sizeof(data.data));
+	if (!section_lights.empty()) {
+		hash = hashSectionData(hash, section_lights[index].block_light,
+				sizeof(section_lights[index].block_light));
+		hash = hashSectionData(hash, section_lights[index].sky_light,
+				sizeof(section_lights[index].sky_light));
+	}
+	hash = hashSectionData(hash, biomes, sizeof(biomes));
+	// 0 is reserved for not existing sections
+	return hash != 0 ? hash : 1;
+}
+
 }
 }
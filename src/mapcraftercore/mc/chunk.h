@@ -32,6 +32,16 @@ namespace mc {
 // chunk height in sections, 16 per default
 const int CHUNK_HEIGHT = 16;
 
+// flags for the data of a chunk/block, used to specify which chunk data should be read
+// from the NBT data and which block data should be returned by the world cache
+const int GET_ID = 1;
+const int GET_DATA = 2;
+const int GET_BIOME = 4;
+const int GET_BLOCK_LIGHT = 8;
+const int GET_SKY_LIGHT = 16;
+const int GET_LIGHT = GET_BLOCK_LIGHT | GET_SKY_LIGHT;
+const int GET_ALL = GET_ID | GET_DATA | GET_BIOME | GET_LIGHT;
+
 /**
  * A 16x16x16 section of a chunk.
  */
@@ -40,13 +50,15 @@ struct ChunkSection {
 	uint8_t blocks[16 * 16 * 16];
 	uint8_t add[16 * 16 * 8];
 	uint8_t data[16 * 16 * 8];
+};
+
+/**
+ * The lighting data of a chunk section. It is stored separately from the sections
+ * because it is not needed by every map.
+ */
+struct ChunkSectionLight {
 	uint8_t block_light[16 * 16 * 8];
 	uint8_t sky_light[16 * 16 * 8];
-
-	/**
-	 * Returns one of the data arrays (1: block data, 2: block light, 3: sky light).
-	 */
-	const uint8_t* getArray(int i) const;
 };
 
 /**
@@ -70,6 +82,14 @@ public:
 	 */
 	void setWorldCrop(const WorldCrop& world_crop);
 
+	/**
+	 * Sets which data of the chunk (GET_* flags) is read from the NBT data, per default
+	 * all data. The block IDs are always read. Not read block data is returned as
+	 * zero, not read lighting data like the lighting data of not existing sections.
+	 * You have to call this before loading the NBT data.
+	 */
+	void setFields(int fields);
+
 	/**
 	 * Reads the NBT data of the chunk from a buffer. You need to specify a compression
 	 * type of the raw data.
@@ -118,6 +138,13 @@ public:
 	 */
 	const ChunkPos& getPos() const;
 
+	/**
+	 * Returns a hash of the read data of a section (blocks, block data, lighting data)
+	 * and the biomes of the chunk, so it changes when the rendered section changes.
+	 * Returns 0 if the section does not exist.
+	 */
+	uint64_t getSectionHash(int section) const;
+
 private:
 	// internal original chunk position and public chunk position (which may be rotated)
 	ChunkPos chunkpos, chunkpos_original;
@@ -137,6 +164,12 @@ private:
 	int section_offsets[CHUNK_HEIGHT];
 	// the array with the sections, see indexes above
 	std::vector<ChunkSection> sections;
+	// the lighting data of the sections (same indexes as the sections),
+	// empty if the lighting data is not read
+	std::vector<ChunkSectionLight> section_lights;
+
+	// which data of the chunk is read (GET_* flags)
+	int fields;
 
 	// the biomes in this chunk, as index z*16+x
 	uint8_t biomes[256];
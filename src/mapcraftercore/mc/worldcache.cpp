@@ -35,7 +35,7 @@ bool Block::isFullWater() const {
 }
 
 WorldCache::WorldCache(const World& world)
-		: world(world) {
+		: world(world), chunk_fields(GET_ALL) {
 	for (int i = 0; i < RSIZE; i++) {
 		regioncache[i].used = false;
 	}
@@ -59,6 +59,10 @@ int WorldCache::getChunkCacheIndex(const ChunkPos& pos) const {
 	return (((pos.x + 131072) & CMASK) * CWIDTH + (pos.z + 131072)) & CMASK;
 }
 
+void WorldCache::setChunkFields(int fields) {
+	chunk_fields = fields;
+}
+
 RegionFile* WorldCache::getRegion(const RegionPos& pos) {
 	CacheEntry<RegionPos, RegionFile>& entry = regioncache[getRegionCacheIndex(pos)];
 
@@ -111,6 +115,7 @@ Chunk* WorldCache::getChunk(const ChunkPos& pos) {
 	if (chunks_broken.count(pos))
 		return nullptr;
 
+	entry.value.setFields(chunk_fields);
 	int status = region->loadChunk(pos, entry.value);
 	// the chunk does not exist, chunk in cache was not modified
 	if (status == RegionFile::CHUNK_DOES_NOT_EXIST)
@@ -26,6 +26,7 @@
 #include "world.h"
 
 #include <set>
+#include <vector>
 
 namespace mapcrafter {
 namespace mc {
@@ -44,13 +45,6 @@ struct Block {
 	bool isFullWater() const;
 };
 
-const int GET_ID = 1;
-const int GET_DATA = 2;
-const int GET_BIOME = 4;
-const int GET_BLOCK_LIGHT = 8;
-const int GET_SKY_LIGHT = 16;
-const int GET_LIGHT = GET_BLOCK_LIGHT | GET_SKY_LIGHT;
-
 /**
  * Some cache statistics for debugging. Not used at the moment.
  *
@@ -98,6 +92,39 @@ struct CacheEntry {
 #define CSIZE (CWIDTH*CWIDTH)
 #define CMASK (CSIZE-1)
 
+/**
+ * A cache for data which is calculated from the chunks, for example by the tile
+ * renderer. Like the chunk cache of the world cache, the first bits (default 5, like the
+ * chunk cache) of the chunk coordinates are used to calculate the position in the cache.
+ * Use less bits for big chunk data.
+ *
+ * The memory of the cache is allocated when the cache is used for the first time.
+ */
+template <typename T, int BITS = CBITS>
+class ChunkDataCache {
+private:
+	std::vector<CacheEntry<ChunkPos, T> > entries;
+
+public:
+	/**
+	 * Returns the cache entry data of a chunk. The flag cached is set if the entry
+	 * already contains the data of this chunk. If not, the entry belongs now to this
+	 * chunk and the caller has to calculate the data.
+	 */
+	T& get(const ChunkPos& pos, bool& cached) {
+		const int width = 1 << BITS;
+		const int mask = width * width - 1;
+		if (entries.empty())
+			entries.resize(width * width);
+		CacheEntry<ChunkPos, T>& entry =
+				entries[(((pos.x + 131072) & mask) * width + (pos.z + 131072)) & mask];
+		cached = entry.used && entry.key == pos;
+		entry.key = pos;
+		entry.used = true;
+		return entry.value;
+	}
+};
+
 /**
  * This is a world cache with regions and chunks.
  *
@@ -134,12 +161,23 @@ private:
 	CacheStats regionstats;
 	CacheStats chunkstats;
 
+	// which data of the chunks is read
+	int chunk_fields;
+
 	int getRegionCacheIndex(const RegionPos& pos) const;
 	int getChunkCacheIndex(const ChunkPos& pos) const;
 
 public:
 	WorldCache(const World& world = World());
 
+	/**
+	 * Sets which data of the chunks (GET_* flags) is read when loading chunks, per
+	 * default all data. Chunk data which is not read is returned with default values.
+	 * This does not change the chunks already in the cache, so call it before using
+	 * the cache.
+	 */
+	void setChunkFields(int fields);
+
 	RegionFile* getRegion(const RegionPos& pos);
 	Chunk* getChunk(const ChunkPos& pos);
 
@@ -54,6 +54,20 @@ public:
 	static bool isBiomeBlock(uint16_t id, uint16_t data);
 };
 
+/**
+ * The colors to tint the biome-depend blocks with. Every column of blocks has such
+ * colors, calculated from the (smoothed) biome data of the column.
+ */
+struct BiomeColors {
+	BiomeColors(uint32_t grass = 0, uint32_t foliage = 0, uint32_t foliage_flipped = 0)
+		: grass(grass), foliage(foliage), foliage_flipped(foliage_flipped) {}
+
+	// grass color, also used for the other blocks which are not leaves
+	uint32_t grass;
+	// foliage color of leaves, and the one with flipped color x/y coordinates for birches
+	uint32_t foliage, foliage_flipped;
+};
+
 // different Minecraft Biomes
 // first few biomes from Minecraft Overviewer
 // temperature/rainfall data from Minecraft source code (via MCP)
@@ -22,11 +22,17 @@
 #include "tileset.h"
 #include "../util.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <map>
+#include <sstream>
 #include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 namespace fs = boost::filesystem;
 
@@ -471,6 +477,7 @@ bool BlockImages::loadBlocks(const std::string& block_dir) {
 
 	loadBlocks();
 	testWaterTransparency();
+	buildBlockTable();
 	createBiomeBlocks();
 	return true;
 }
@@ -497,6 +504,51 @@ bool BlockImages::loadAll(const std::string& textures_dir) {
 	return true;
 }
 
+/**
+ * Removes the cache files in the cache directory with a name which were created for
+ * older textures, except the current cache file.
+ */
+void removeOtherCaches(const fs::path& cache_dir, const std::string& name,
+		const fs::path& current) {
+	// the temporary files of the current cache are written by other processes
+	std::string current_filename = current.filename().string();
+	std::vector<fs::path> files;
+	boost::system::error_code error;
+	for (fs::directory_iterator it(cache_dir, error), end; !error && it != end; ++it) {
+		std::string filename = it->path().filename().string();
+		if (filename.compare(0, name.size() + 1, name + "-") == 0
+				&& filename.compare(0, current_filename.size(), current_filename) != 0)
+			files.push_back(it->path());
+	}
+	for (auto it = files.begin(); it != files.end(); ++it)
+		fs::remove(*it, error);
+}
+
+/**
+ * Loads the block images from the cache in the cache directory if the cache was created
+ * with the same textures and settings. Otherwise the block images are created from the
+ * textures and stored in the cache for the next time, the caches of these settings for
+ * other textures are removed then.
+ */
+bool BlockImages::loadAll(const std::string& textures_dir, const std::string& cache_dir) {
+	std::string name = getCacheName(textures_dir);
+	std::string key = getCacheKey(textures_dir);
+	fs::path filename = fs::path(cache_dir) / (name + "-" + key + ".cache");
+	if (fs::exists(filename)) {
+		if (loadCache(filename.string(), key))
+			return true;
+		LOG(WARNING) << "Unable to read block images cache '" << filename.string() << "'.";
+	}
+
+	if (!loadAll(textures_dir))
+		return false;
+	if (saveCache(filename.string(), key))
+		removeOtherCaches(cache_dir, name, filename);
+	else
+		LOG(WARNING) << "Unable to write block images cache '" << filename.string() << "'.";
+	return true;
+}
+
 /**
  * Comparator to sort the block int's with id and data.
  */
@@ -513,16 +565,12 @@ struct block_comparator {
 };
 
 bool BlockImages::saveBlocks(const std::string& filename) {
-	std::map<uint32_t, RGBAImage, block_comparator> blocks_sorted;
-	for (auto it = block_images.begin(); it != block_images.end(); ++it) {
-		uint16_t data = (it->first & 0xffff0000) >> 16;
-		if ((data & (EDGE_NORTH | EDGE_EAST | EDGE_BOTTOM)) == 0)
-			blocks_sorted[it->first] = it->second;
-	}
-
-		std::vector<RGBAImage> blocks;
-	for (auto it = blocks_sorted.begin(); it != blocks_sorted.end(); ++it)
-		blocks.push_back(it->second);
+	// the block sprites are already sorted by id and data
+	std::vector<RGBAImage> blocks;
+	for (size_t id = 0; id < block_table.size(); id++)
+		for (size_t data = 0; data < block_table[id].size(); data++)
+			if (block_table[id][data].sprite >= 0)
+				blocks.push_back(block_sprites[block_table[id][data].sprite]);
 
 	blocks.push_back(opaque_water[0]);
 	blocks.push_back(opaque_water[1]);
@@ -548,7 +596,7 @@ bool BlockImages::saveBlocks(const std::string& filename) {
 			img.alphablit(blocks.at(offset), x * blocksize, y * blocksize);
 		}
 	}
-	std::cout << block_images.size() << " blocks" << std::endl;
+	std::cout << block_sprites.size() << " blocks" << std::endl;
 	std::cout << "all: " << blocks.size() << std::endl;
 
 	/*
@@ -581,6 +629,275 @@ bool BlockImages::saveBlocks(const std::string& filename) {
 	return img.writePNG(filename);
 }
 
+// version of the block images cache format,
+// increase it when the cache format or the created block images change
+const uint32_t BLOCK_IMAGES_CACHE_VERSION = 1;
+const char BLOCK_IMAGES_CACHE_MAGIC[4] = {'M', 'C', 'B', 'I'};
+
+/**
+ * Adds data to a 64 bit FNV-1a hash.
+ */
+uint64_t hashData(uint64_t hash, const char* data, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (uint8_t) data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+template <typename T>
+uint64_t hashValue(uint64_t hash, T value) {
+	return hashData(hash, (const char*) &value, sizeof(T));
+}
+
+/**
+ * Reads the values and images of a (memory mapped) block images cache file.
+ */
+class BlockImagesCacheReader {
+public:
+	BlockImagesCacheReader(const char* data, size_t size)
+		: data(data), size(size), pos(0), ok(true) {}
+
+	template <typename T>
+	T read() {
+		T value = T();
+		readData((char*) &value, sizeof(T));
+		return value;
+	}
+
+	void readImage(RGBAImage& image) {
+		int32_t width = read<int32_t>();
+		int32_t height = read<int32_t>();
+		if (width < 0 || height < 0 || (size_t) width * height * sizeof(RGBAPixel) > size - pos) {
+			ok = false;
+			return;
+		}
+		image.setSize(width, height);
+		if (width != 0 && height != 0)
+			readData((char*) &image.pixel(0, 0), width * height * sizeof(RGBAPixel));
+	}
+
+	bool good() const {
+		return ok;
+	}
+
+private:
+	const char* data;
+	size_t size, pos;
+	bool ok;
+
+	void readData(char* dest, size_t count) {
+		if (!ok || count > size - pos) {
+			ok = false;
+			return;
+		}
+		std::memcpy(dest, data + pos, count);
+		pos += count;
+	}
+};
+
+template <typename T>
+void writeCacheValue(std::ostream& out, T value) {
+	out.write((const char*) &value, sizeof(T));
+}
+
+void writeCacheImage(std::ostream& out, const RGBAImage& image) {
+	writeCacheValue<int32_t>(out, image.getWidth());
+	writeCacheValue<int32_t>(out, image.getHeight());
+	if (image.getWidth() != 0 && image.getHeight() != 0)
+		out.write((const char*) &image.pixel(0, 0),
+				image.getWidth() * image.getHeight() * sizeof(RGBAPixel));
+}
+
+/**
+ * Returns a string with all settings which have an effect on the created block images.
+ * Block images with the same settings and textures are the same.
+ */
+std::string BlockImages::getSettingsKey() const {
+	std::stringstream ss;
+	ss << texture_size << ";" << rotation << ";" << render_unknown_blocks << ";"
+			<< render_leaves_transparent << ";" << dleft << ";" << dright;
+	return ss.str();
+}
+
+/**
+ * Returns the name of the block images caches of the texture directory and the current
+ * settings. The name is a hash of the path of the directory and the settings, the caches
+ * with this name are replaced when the textures change.
+ */
+std::string BlockImages::getCacheName(const std::string& textures_dir) const {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	std::string settings = getSettingsKey();
+	hash = hashData(hash, settings.c_str(), settings.size() + 1);
+	hash = hashData(hash, textures_dir.c_str(), textures_dir.size() + 1);
+
+	std::stringstream ss;
+	ss << "blockimages-" << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return ss.str();
+}
+
+/**
+ * Returns the key of the block images cache for the textures in the texture directory
+ * and the current settings. The key is a hash of the texture files and the settings.
+ */
+std::string BlockImages::getCacheKey(const std::string& textures_dir) const {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = hashValue(hash, BLOCK_IMAGES_CACHE_VERSION);
+	hash = hashValue(hash, BIOME_COLOR_BITS);
+	std::string settings = getSettingsKey();
+	hash = hashData(hash, settings.c_str(), settings.size() + 1);
+
+	// hash the paths and contents of all texture files, sorted by path
+	std::vector<std::string> files;
+	if (fs::is_directory(textures_dir)) {
+		for (fs::recursive_directory_iterator it(textures_dir);
+				it != fs::recursive_directory_iterator(); ++it)
+			if (fs::is_regular_file(it->path()))
+				files.push_back(it->path().string().substr(textures_dir.size()));
+	}
+	std::sort(files.begin(), files.end());
+	for (auto it = files.begin(); it != files.end(); ++it) {
+		hash = hashData(hash, it->c_str(), it->size() + 1);
+		std::ifstream in(textures_dir + *it, std::ios::binary);
+		char buffer[4096];
+		while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+			hash = hashData(hash, buffer, in.gcount());
+	}
+
+	std::stringstream ss;
+	ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return ss.str();
+}
+
+/**
+ * Loads the created block images from a cache file. The cache file is memory mapped, so
+ * reading it costs not much more than copying the images.
+ */
+bool BlockImages::loadCache(const std::string& filename, const std::string& key) {
+	boost::iostreams::mapped_file_source file;
+	try {
+		file.open(filename);
+	} catch (std::exception& e) {
+		LOG(WARNING) << "Unable to map block images cache '" << filename << "': " << e.what();
+		return false;
+	}
+
+	BlockImagesCacheReader reader(file.data(), file.size());
+	char magic[4];
+	for (int i = 0; i < 4; i++)
+		magic[i] = reader.read<char>();
+	if (std::memcmp(magic, BLOCK_IMAGES_CACHE_MAGIC, 4) != 0
+			|| reader.read<uint32_t>() != BLOCK_IMAGES_CACHE_VERSION)
+		return false;
+	std::string file_key(reader.read<uint32_t>(), ' ');
+	for (size_t i = 0; i < file_key.size() && reader.good(); i++)
+		file_key[i] = reader.read<char>();
+	if (!reader.good() || file_key != key)
+		return false;
+
+	max_water = reader.read<int32_t>();
+	reader.readImage(unknown_block);
+	for (int i = 0; i < 4; i++)
+		reader.readImage(opaque_water[i]);
+	reader.readImage(grasscolors);
+	reader.readImage(foliagecolors);
+	// the grass side overlay is needed to create the grass blocks with biome colors
+	reader.readImage(textures.GRASS_SIDE_OVERLAY);
+
+	block_images.clear();
+	block_transparency.clear();
+	uint32_t count = reader.read<uint32_t>();
+	for (uint32_t i = 0; i < count && reader.good(); i++) {
+		uint32_t block_key = reader.read<uint32_t>();
+		if (reader.read<uint8_t>())
+			block_transparency.insert(block_key);
+		reader.readImage(block_images[block_key]);
+	}
+
+	biome_images.clear();
+	count = reader.read<uint32_t>();
+	for (uint32_t i = 0; i < count && reader.good(); i++) {
+		uint64_t block_key = reader.read<uint64_t>();
+		reader.readImage(biome_images[block_key]);
+	}
+
+	if (!reader.good()) {
+		block_images.clear();
+		block_transparency.clear();
+		biome_images.clear();
+		return false;
+	}
+	buildBlockTable();
+	return true;
+}
+
+/**
+ * Saves the created block images to a cache file. The file is written to a temporary
+ * file first, so other processes never read a partially written cache.
+ */
+bool BlockImages::saveCache(const std::string& filename, const std::string& key) const {
+	fs::path path(filename);
+	// other processes might write the same cache at the same time
+	fs::path tmp_path = fs::unique_path(path.string() + ".%%%%-%%%%-%%%%-%%%%.tmp");
+	try {
+		if (path.has_parent_path())
+			fs::create_directories(path.parent_path());
+	} catch (fs::filesystem_error& e) {
+		LOG(WARNING) << e.what();
+		return false;
+	}
+
+	std::ofstream out(tmp_path.string(), std::ios::binary);
+	if (!out)
+		return false;
+	out.write(BLOCK_IMAGES_CACHE_MAGIC, 4);
+	writeCacheValue<uint32_t>(out, BLOCK_IMAGES_CACHE_VERSION);
+	writeCacheValue<uint32_t>(out, key.size());
+	out.write(key.c_str(), key.size());
+
+	writeCacheValue<int32_t>(out, max_water);
+	writeCacheImage(out, unknown_block);
+	for (int i = 0; i < 4; i++)
+		writeCacheImage(out, opaque_water[i]);
+	writeCacheImage(out, grasscolors);
+	writeCacheImage(out, foliagecolors);
+	writeCacheImage(out, textures.GRASS_SIDE_OVERLAY);
+
+	writeCacheValue<uint32_t>(out, block_sprites.size());
+	for (size_t id = 0; id < block_table.size(); id++)
+		for (size_t data = 0; data < block_table[id].size(); data++) {
+			const BlockEntry& entry = block_table[id][data];
+			if (entry.sprite < 0)
+				continue;
+			// the block image and the images with shadow edges (which are not transparent)
+			for (int edges = 0; edges < (entry.edges ? 8 : 1); edges++) {
+				writeCacheValue<uint32_t>(out, id | ((uint32_t) (data | edges << 13) << 16));
+				writeCacheValue<uint8_t>(out, edges == 0 && entry.transparent);
+				writeCacheImage(out, block_sprites[entry.sprite + edges]);
+			}
+		}
+
+	writeCacheValue<uint32_t>(out, biome_images.size());
+	for (auto it = biome_images.begin(); it != biome_images.end(); ++it) {
+		writeCacheValue<uint64_t>(out, it->first);
+		writeCacheImage(out, it->second);
+	}
+
+	out.close();
+	if (!out) {
+		fs::remove(tmp_path);
+		return false;
+	}
+	try {
+		fs::rename(tmp_path, path);
+	} catch (fs::filesystem_error& e) {
+		LOG(WARNING) << e.what();
+		fs::remove(tmp_path);
+		return false;
+	}
+	return true;
+}
+
 /**
  * This method filters unnecessary block data, for example the leaves decay counter.
  */
@@ -724,18 +1041,96 @@ void BlockImages::setBlockImage(uint16_t id, uint16_t data, const RGBAImage& blo
 		addBlockShadowEdges(id, data, block);
 }
 
-RGBAImage BlockImages::createBiomeBlock(uint16_t id, uint16_t data,
-        const Biome& biome_data) const {
-	if (!block_images.count(id | (data << 16)))
-		return unknown_block;
+/**
+ * Moves the created block images to the block sprites and builds the block lookup table.
+ * Looking up a block image needs then just two array accesses instead of hashing.
+ */
+void BlockImages::buildBlockTable() {
+	const uint16_t edge_mask = EDGE_NORTH | EDGE_EAST | EDGE_BOTTOM;
+	std::vector<uint32_t> keys;
+	for (auto it = block_images.begin(); it != block_images.end(); ++it)
+		if (((it->first >> 16) & edge_mask) == 0)
+			keys.push_back(it->first);
+	std::sort(keys.begin(), keys.end(), block_comparator());
+
+	block_sprites.clear();
+	block_sprites.reserve(block_images.size());
+	block_table.clear();
+	for (auto it = keys.begin(); it != keys.end(); ++it) {
+		uint16_t id = *it & 0xffff;
+		uint16_t data = *it >> 16;
+		if (block_table.size() <= id)
+			block_table.resize(id + 1);
+		if (block_table[id].size() <= data)
+			block_table[id].resize(data + 1);
+
+		BlockEntry& entry = block_table[id][data];
+		entry.sprite = block_sprites.size();
+		entry.transparent = block_transparency.count(*it) != 0;
+		// copy the images in this order (instead of moving them),
+		// so the images of similar blocks are next to each other in memory
+		block_sprites.push_back(block_images.at(*it));
+
+		// the images with shadow edges follow the block image, if there are any
+		entry.edges = block_images.count(*it | ((uint32_t) edge_mask << 16)) != 0;
+		for (int edges = 1; entry.edges && edges < 8; edges++)
+			block_sprites.push_back(block_images.at(*it | ((uint32_t) edges << 29)));
+	}
+
+	block_images.clear();
+	block_transparency.clear();
+}
 
-	uint32_t color;
+/**
+ * Returns the entry of a block (with data without edge bits) from the block lookup table,
+ * or a null pointer if there is no image of the block.
+ */
+const BlockImages::BlockEntry* BlockImages::findBlockEntry(uint16_t id,
+		uint16_t data) const {
+	if (id >= block_table.size() || data >= block_table[id].size()
+			|| block_table[id][data].sprite < 0)
+		return nullptr;
+	return &block_table[id][data];
+}
+
+/**
+ * Returns the image of a block or a null pointer if there is no image of the block.
+ */
+const RGBAImage* BlockImages::findBlock(uint16_t id, uint16_t data) const {
+	uint16_t edges = data & (EDGE_NORTH | EDGE_EAST | EDGE_BOTTOM);
+	const BlockEntry* entry = findBlockEntry(id, data & ~edges);
+	if (entry == nullptr || (edges != 0 && !entry->edges))
+		return nullptr;
+	return &block_sprites[entry->sprite + (edges >> 13)];
+}
+
+/**
+ * Quantizes a biome color to BIOME_COLOR_BITS per color channel.
+ */
+uint32_t quantizeBiomeColor(uint32_t color) {
+	uint32_t mask = (0xff << (8 - BIOME_COLOR_BITS)) & 0xff;
+	uint32_t half = (1 << (8 - BIOME_COLOR_BITS)) >> 1;
+	// drop the lower bits of the channels and use the middle value of them instead
+	return (color & (mask | mask << 8 | mask << 16)) | half | half << 8 | half << 16;
+}
+
+/**
+ * Returns the color a biome block is tinted with.
+ */
+uint32_t BlockImages::getBiomeColor(uint16_t id, uint16_t data,
+		const BiomeColors& colors) const {
 	// leaves have the foliage colors
 	// for birches, the color x/y coordinate is flipped
 	if (id == 18)
-		color = biome_data.getColor(foliagecolors, (data & util::binary<11>::value) == 2);
-	else
-		color = biome_data.getColor(grasscolors, false);
+		return (data & util::binary<11>::value) == 2 ? colors.foliage_flipped : colors.foliage;
+	return colors.grass;
+}
+
+RGBAImage BlockImages::createBiomeBlock(uint16_t id, uint16_t data,
+        uint32_t color) const {
+	const RGBAImage* block_image = findBlock(id, data);
+	if (block_image == nullptr)
+		return unknown_block;
 
 	double r = (double) rgba_red(color) / 255;
 	double g = (double) rgba_green(color) / 255;
@@ -743,7 +1138,7 @@ RGBAImage BlockImages::createBiomeBlock(uint16_t id, uint16_t data,
 
 	// grass block needs something special
 	if (id == 2) {
-		RGBAImage block = block_images.at(id | (data << 16));
+		RGBAImage block = *block_image;
 		RGBAImage side = textures.GRASS_SIDE_OVERLAY.colorize(r, g, b);
 
 		// blit the side overlay over the block
@@ -759,26 +1154,69 @@ RGBAImage BlockImages::createBiomeBlock(uint16_t id, uint16_t data,
 		return block;
 	}
 
-	return block_images.at(id | (data << 16)).colorize(r, g, b);
+	return block_image->colorize(r, g, b);
 }
 
-void BlockImages::createBiomeBlocks() {
-	for (std::unordered_map<uint32_t, RGBAImage>::iterator it = block_images.begin();
-			it != block_images.end(); ++it) {
-		uint16_t id = it->first & 0xffff;
-		uint16_t data = (it->first & 0xffff0000) >> 16;
+/**
+ * Returns the key of a biome block image, used for the precalculated biome block images
+ * and the biome block image cache.
+ */
+uint64_t getBiomeBlockKey(uint16_t id, uint16_t data, uint32_t color) {
+	return id | ((uint64_t) data << 16) | ((uint64_t) (color & 0xffffff) << 32);
+}
 
-		// check if this is a biome block
-		if (!Biome::isBiomeBlock(id, data))
-			continue;
+void BlockImages::createBiomeBlocks() {
+	for (uint16_t id = 0; id < block_table.size(); id++)
+		for (uint16_t base_data = 0; base_data < block_table[id].size(); base_data++) {
+			const BlockEntry& entry = block_table[id][base_data];
+			// check if this is a biome block
+			if (entry.sprite < 0 || !Biome::isBiomeBlock(id, base_data))
+				continue;
+
+			// also the images with shadow edges
+			for (int edges = 0; edges < (entry.edges ? 8 : 1); edges++) {
+				uint16_t data = base_data | edges << 13;
+				for (size_t i = 0; i < BIOMES_SIZE; i++) {
+					uint32_t color = getBiomeColor(id, data, getBiomeColors(BIOMES[i]));
+					uint64_t key = getBiomeBlockKey(id, data, color);
+					if (!biome_images.count(key))
+						biome_images[key] = createBiomeBlock(id, data, color);
+				}
+			}
+		}
+}
 
-		for (size_t i = 0; i < BIOMES_SIZE; i++) {
-			Biome biome = BIOMES[i];
-			uint64_t b = biome.getID();
-			biome_images[id | ((uint64_t) data << 16) | (b << 32)] =
-					createBiomeBlock(id, data, biome);
+/**
+ * Copies a biome block image with a color which is not precalculated to the supplied
+ * image. The created images are kept in a fixed size cache, so the expensive colorizing
+ * is needed only once for the most biome colors at the edges of biomes.
+ */
+void BlockImages::getCachedBiomeBlock(uint16_t id, uint16_t data, uint32_t color,
+		RGBAImage& block) const {
+	uint64_t key = getBiomeBlockKey(id, data, color);
+	// multiplicative hashing to spread the keys over the cache
+	size_t index = (key * 0x9e3779b97f4a7c15ULL) >> (64 - BIOME_CACHE_BITS);
+
+	{
+		thread_ns::unique_lock<thread_ns::mutex> lock(biome_cache_mutex);
+		if (biome_cache.empty())
+			biome_cache.resize(1 << BIOME_CACHE_BITS);
+		const BiomeCacheEntry& entry = biome_cache[index];
+		if (entry.used && entry.key == key) {
+			block = entry.image;
+			return;
 		}
 	}
+
+	// create the image without holding the lock,
+	// other threads may do this too, but then they just create the same image
+	block = createBiomeBlock(id, data, color);
+
+	thread_ns::unique_lock<thread_ns::mutex> lock(biome_cache_mutex);
+	BiomeCacheEntry& entry = biome_cache[index];
+	entry.key = key;
+	entry.used = true;
+	entry.image = block;
 }
 
 /**
@@ -2606,42 +3044,69 @@ bool BlockImages::isBlockTransparent(uint16_t id, uint16_t data) const {
 	// FIXME
 	if (id == 64 || id == 71)
 		return true;
-	if (block_images.count(id | (data << 16)) == 0)
+	const BlockEntry* entry = findBlockEntry(id, data);
+	if (entry == nullptr)
 		return !render_unknown_blocks;
-	return block_transparency.count(id | (data << 16)) != 0;
+	return entry->transparent;
 }
 
 bool BlockImages::hasBlock(uint16_t id, uint16_t data) const {
-	return block_images.count(id | (data << 16)) != 0;
+	return findBlock(id, data) != nullptr;
 }
 
 const RGBAImage& BlockImages::getBlock(uint16_t id, uint16_t data) const {
 	data = filterBlockData(id, data);
-	if (!hasBlock(id, data))
+	const RGBAImage* block = findBlock(id, data);
+	if (block == nullptr)
 		return unknown_block;
-	return block_images.at(id | (data << 16));
+	return *block;
 }
 
-RGBAImage BlockImages::getBiomeDependBlock(uint16_t id, uint16_t data,
-        const Biome& biome) const {
+/**
+ * Calculates the (quantized) colors to tint the biome-depend blocks with. The renderer
+ * calculates these colors once for every block column.
+ */
+BiomeColors BlockImages::getBiomeColors(const Biome& biome) const {
+	// use the colors of the biome itself if the biome data is nearly the same
+	Biome color_biome = biome;
+	if (biome == getBiome(biome.getID()))
+		color_biome = getBiome(biome.getID());
+
+	return BiomeColors(
+			quantizeBiomeColor(color_biome.getColor(grasscolors, false)),
+			quantizeBiomeColor(color_biome.getColor(foliagecolors, false)),
+			quantizeBiomeColor(color_biome.getColor(foliagecolors, true)));
+}
+
+/**
+ * Copies the image of a biome-depend block with the supplied biome colors to an image.
+ * The image is passed in to reuse its memory.
+ */
+void BlockImages::getBiomeDependBlock(uint16_t id, uint16_t data,
+        const BiomeColors& colors, RGBAImage& block) const {
 	data = filterBlockData(id, data);
 	// return normal block for the snowy grass block
-	if (id == 2 && (data & GRASS_SNOW))
-		return getBlock(id, data);
+	if (id == 2 && (data & GRASS_SNOW)) {
+		block = getBlock(id, data);
+		return;
+	}
 
-	if (!hasBlock(id, data))
-		return unknown_block;
+	if (!hasBlock(id, data)) {
+		block = unknown_block;
+		return;
+	}
+
+	uint32_t color = getBiomeColor(id, data, colors);
 
 	// check if this biome block is precalculated
-	if (biome == getBiome(biome.getID())) {
-		int64_t key = id | (((int64_t) data) << 16) | (((int64_t) biome.getID()) << 32);
-		if (!biome_images.count(key))
-			return unknown_block;
-		return biome_images.at(key);
+	auto it = biome_images.find(getBiomeBlockKey(id, data, color));
+	if (it != biome_images.end()) {
+		block = it->second;
+		return;
 	}
 
-	// create the block if not
-	return createBiomeBlock(id, data, biome);
+	// get the block from the cache (or create it) if not
+	getCachedBiomeBlock(id, data, color, block);
 }
 
 int BlockImages::getMaxWaterNeededOpaque() const {
@@ -23,11 +23,13 @@
 #include "biomes.h"
 #include "blocktextures.h"
 #include "image.h"
+#include "../compat/thread.h"
 
 #include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 /**
  * For the rendering we need to transform the Minecraft textures to some kind of block
@@ -152,6 +154,12 @@ const int REDSTONE_POWERED = 4096;
 
 const int LARGEPLANT_TOP = 16;
 
+// biome colors are quantized to this count of bits per color channel,
+// this limits the count of different biome block images at the biome edges
+const int BIOME_COLOR_BITS = 6;
+// the cache for the blended biome block images has 2^BIOME_CACHE_BITS entries
+const int BIOME_CACHE_BITS = 11;
+
 enum class SlabType {
 	STONE, STONE2, WOOD
 };
@@ -273,26 +281,69 @@ private:
 	// defaults to 0.75 and 0.6
 	double dleft, dright;
 
-	// map of block images
+	// map of block images while they are created
 	// key is a 32 bit integer, first two bytes id, second two bytes data
 	std::unordered_map<uint32_t, RGBAImage> block_images;
 
-	// map of biome block images, first four bytes id+data, next byte is the biome id
+	/**
+	 * An entry of the block lookup table.
+	 */
+	struct BlockEntry {
+		BlockEntry() : sprite(-1), transparent(false), edges(false) {}
+
+		// index of the block image in the block sprites, -1 if there is no block image
+		int32_t sprite;
+		bool transparent;
+		// whether the block has the images with shadow edges, they follow the block image
+		// in the block sprites (index + edge bits >> 13)
+		bool edges;
+	};
+
+	// the created block images, sorted by id and data
+	std::vector<RGBAImage> block_sprites;
+	// block lookup table, indexed by block id and then by block data (without edge bits)
+	std::vector<std::vector<BlockEntry> > block_table;
+
+	// map of biome block images of the normal biomes,
+	// first four bytes id+data, next three bytes are the quantized biome color
 	std::unordered_map<uint64_t, RGBAImage> biome_images;
 
+	/**
+	 * An entry of the biome block images cache.
+	 */
+	struct BiomeCacheEntry {
+		BiomeCacheEntry() : key(0), used(false) {}
+
+		uint64_t key;
+		bool used;
+		RGBAImage image;
+	};
+
+	// cache of biome block images with blended biome colors (at the edges of biomes),
+	// every key (see biome_images) has a fixed position in the cache
+	// the cache is shared by all render threads, so access it only with the mutex locked
+	mutable std::vector<BiomeCacheEntry> biome_cache;
+	mutable thread_ns::mutex biome_cache_mutex;
+
 	// set of id/data block combinations, which contain transparency
 	std::unordered_set<uint32_t> block_transparency;
 	RGBAImage unknown_block;
 
 	uint16_t filterBlockData(uint16_t id, uint16_t data) const;
+	void buildBlockTable();
+	const BlockEntry* findBlockEntry(uint16_t id, uint16_t data) const;
+	const RGBAImage* findBlock(uint16_t id, uint16_t data) const;
 	bool checkImageTransparency(const RGBAImage& block) const;
 	void addBlockShadowEdges(uint16_t id, uint16_t data, const RGBAImage& block);
 
 	void setBlockImage(uint16_t id, uint16_t data, const BlockImage& block);
 	void setBlockImage(uint16_t id, uint16_t data, const RGBAImage& block);
 
-	RGBAImage createBiomeBlock(uint16_t id, uint16_t data, const Biome& biome_data) const;
+	uint32_t getBiomeColor(uint16_t id, uint16_t data, const BiomeColors& colors) const;
+	RGBAImage createBiomeBlock(uint16_t id, uint16_t data, uint32_t color) const;
 	void createBiomeBlocks();
+	void getCachedBiomeBlock(uint16_t id, uint16_t data, uint32_t color,
+			RGBAImage& block) const;
 
 	void testWaterTransparency();
 
@@ -405,12 +456,21 @@ public:
 	bool loadOther(const std::string& endportal);
 	bool loadBlocks(const std::string& block_dir);
 	bool loadAll(const std::string& textures_dir);
+	bool loadAll(const std::string& textures_dir, const std::string& cache_dir);
 	bool saveBlocks(const std::string& filename);
 
+	std::string getSettingsKey() const;
+	std::string getCacheName(const std::string& textures_dir) const;
+	std::string getCacheKey(const std::string& textures_dir) const;
+	bool loadCache(const std::string& filename, const std::string& key);
+	bool saveCache(const std::string& filename, const std::string& key) const;
+
 	bool isBlockTransparent(uint16_t id, uint16_t data) const;
 	bool hasBlock(uint16_t id, uint16_t) const;
 	const RGBAImage& getBlock(uint16_t id, uint16_t data) const;
-	RGBAImage getBiomeDependBlock(uint16_t id, uint16_t data, const Biome& biome) const;
+	BiomeColors getBiomeColors(const Biome& biome) const;
+	void getBiomeDependBlock(uint16_t id, uint16_t data, const BiomeColors& colors,
+			RGBAImage& block) const;
 
 	int getMaxWaterNeededOpaque() const;
 	const RGBAImage& getOpaqueWater(bool south, bool west) const;
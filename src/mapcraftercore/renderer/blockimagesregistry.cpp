@@ -0,0 +1,172 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "blockimagesregistry.h"
+
+#include "../util.h"
+
+#include <algorithm>
+
+namespace mapcrafter {
+namespace renderer {
+
+/**
+ * Creates the (not yet loaded) block images of a rotation of a map.
+ */
+std::shared_ptr<BlockImages> createBlockImages(const config::MapSection& map,
+		int rotation) {
+	std::shared_ptr<BlockImages> images(new BlockImages);
+	images->setSettings(map.getTextureSize(), rotation, map.renderUnknownBlocks(),
+			map.renderLeavesTransparent(), map.getRendermode());
+	return images;
+}
+
+BlockImagesRegistry::BlockImagesRegistry(const std::string& cache_dir)
+	: cache_dir(cache_dir), queue_next(0), ahead(0), max_ahead(1), stopping(false) {
+}
+
+BlockImagesRegistry::~BlockImagesRegistry() {
+	{
+		thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition_ahead.notify_all();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+std::string BlockImagesRegistry::getKey(const config::MapSection& map,
+		const std::shared_ptr<BlockImages>& images) const {
+	return map.getTextureDir().string() + "|" + images->getSettingsKey();
+}
+
+void BlockImagesRegistry::add(const config::MapSection& map, int rotation) {
+	std::shared_ptr<BlockImages> images = createBlockImages(map, rotation);
+	Entry& entry = entries[getKey(map, images)];
+	if (entry.uses++ == 0) {
+		entry.texture_dir = map.getTextureDir().string();
+		entry.images = images;
+		queue.push_back(&entry);
+	}
+}
+
+void BlockImagesRegistry::build(int threads) {
+	threads = std::max(1, std::min(threads, (int) queue.size()));
+	max_ahead = threads;
+	for (int i = 0; i < threads; i++)
+		this->threads.push_back(thread_ns::thread(&BlockImagesRegistry::buildWorker, this));
+}
+
+std::shared_ptr<BlockImages> BlockImagesRegistry::get(const config::MapSection& map,
+		int rotation) {
+	std::string key = getKey(map, createBlockImages(map, rotation));
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	auto it = entries.find(key);
+	if (it == entries.end())
+		return std::shared_ptr<BlockImages>();
+
+	Entry& entry = it->second;
+	if (!entry.started)
+		buildEntry(entry, lock);
+	while (!entry.done)
+		condition_done.wait(lock);
+	std::shared_ptr<BlockImages> images;
+	if (entry.ok)
+		images = entry.images;
+	if (--entry.uses == 0)
+		releaseEntry(entry);
+	return images;
+}
+
+void BlockImagesRegistry::release(const config::MapSection& map, int rotation) {
+	std::string key = getKey(map, createBlockImages(map, rotation));
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	auto it = entries.find(key);
+	if (it == entries.end())
+		return;
+
+	// block images which are still created are freed by the thread creating them,
+	// block images which are not needed anymore are not created at all
+	Entry& entry = it->second;
+	if (--entry.uses != 0)
+		return;
+	if (!entry.started) {
+		entry.started = entry.done = true;
+		entry.images.reset();
+	} else if (entry.done)
+		releaseEntry(entry);
+}
+
+/**
+ * Creates the block images of an entry, the lock must be held. The lock is released
+ * while the block images are created.
+ */
+void BlockImagesRegistry::buildEntry(Entry& entry,
+		thread_ns::unique_lock<thread_ns::mutex>& lock) {
+	entry.started = true;
+	ahead++;
+	lock.unlock();
+
+	// the entries are not changed by other threads while they are not done
+	bool ok = false;
+	try {
+		ok = entry.images->loadAll(entry.texture_dir, cache_dir);
+	} catch (fs::filesystem_error& e) {
+		LOG(ERROR) << "Unable to create block images: " << e.what();
+	}
+
+	lock.lock();
+	entry.ok = ok;
+	entry.done = true;
+	if (entry.uses == 0)
+		releaseEntry(entry);
+	condition_done.notify_all();
+}
+
+/**
+ * Frees the created block images of an entry when they are not needed anymore,
+ * the lock must be held.
+ */
+void BlockImagesRegistry::releaseEntry(Entry& entry) {
+	entry.images.reset();
+	ahead--;
+	condition_ahead.notify_all();
+}
+
+/**
+ * Creates the queued block images until there are no more left.
+ */
+void BlockImagesRegistry::buildWorker() {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	while (true) {
+		while (queue_next < queue.size() && queue[queue_next]->started)
+			queue_next++;
+		if (stopping || queue_next >= queue.size())
+			return;
+		if (ahead >= max_ahead) {
+			condition_ahead.wait(lock);
+			continue;
+		}
+		buildEntry(*queue[queue_next++], lock);
+	}
+}
+
+}
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BLOCKIMAGESREGISTRY_H_
+#define BLOCKIMAGESREGISTRY_H_
+
+#include "blockimages.h"
+#include "../compat/thread.h"
+#include "../config/mapcrafterconfig.h"
+
+#include <map>
+#include <memory> // shared_ptr
+#include <string>
+#include <vector>
+
+namespace mapcrafter {
+namespace renderer {
+
+/**
+ * Creates the block images of the maps before they are rendered.
+ *
+ * The block images of all map rotations are added first. Maps with the same textures
+ * and block image settings share one block images object. Then all block images are
+ * created with a few threads in the background (for example while the worlds are
+ * scanned) and the renderer waits only for the block images it needs right now.
+ *
+ * The block images are created in the order they were added. The threads don't create
+ * more block images ahead of the renderer than there are threads, block images which
+ * the renderer needs before a thread started creating them are created by the renderer.
+ */
+class BlockImagesRegistry {
+public:
+	BlockImagesRegistry(const std::string& cache_dir);
+	~BlockImagesRegistry();
+
+	/**
+	 * Adds the block images of a rotation of a map. This must be called before the
+	 * block images are created.
+	 */
+	void add(const config::MapSection& map, int rotation);
+
+	/**
+	 * Starts creating all added block images with the specified count of threads.
+	 * The threads are stopped when the registry is destroyed.
+	 */
+	void build(int threads);
+
+	/**
+	 * Waits until the block images of a rotation of a map are created and returns them.
+	 * Returns a null pointer if the block images could not be created. The registry
+	 * drops its reference to block images when they were returned for every time they
+	 * were added, so they are freed after the last map using them is rendered.
+	 */
+	std::shared_ptr<BlockImages> get(const config::MapSection& map, int rotation);
+
+	/**
+	 * Drops a reference to the block images of a rotation of a map like get does, for
+	 * map rotations which were added but are not rendered.
+	 */
+	void release(const config::MapSection& map, int rotation);
+
+private:
+	struct Entry {
+		Entry() : uses(0), started(false), done(false), ok(false) {}
+
+		std::string texture_dir;
+		std::shared_ptr<BlockImages> images;
+		int uses;
+		bool started, done, ok;
+	};
+
+	std::string cache_dir;
+
+	std::map<std::string, Entry> entries;
+	std::vector<Entry*> queue;
+	size_t queue_next;
+
+	// count of block images which are created or created and not returned yet,
+	// the threads wait while this reaches the count of threads
+	int ahead, max_ahead;
+	bool stopping;
+
+	std::vector<thread_ns::thread> threads;
+	thread_ns::mutex mutex;
+	thread_ns::condition_variable condition_done, condition_ahead;
+
+	std::string getKey(const config::MapSection& map,
+			const std::shared_ptr<BlockImages>& images) const;
+	void buildEntry(Entry& entry, thread_ns::unique_lock<thread_ns::mutex>& lock);
+	void releaseEntry(Entry& entry);
+	void buildWorker();
+};
+
+}
+}
+
+#endif /* BLOCKIMAGESREGISTRY_H_ */
@@ -23,12 +23,17 @@
 
 #include "image.h"
 
+#include "../config.h"
 #include "../util.h"
 
 #include <jpeglib.h>
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace mapcrafter {
 namespace renderer {
@@ -251,6 +256,22 @@ void RGBAImage::clear() {
 	std::fill(data.begin(), data.end(), 0);
 }
 
+uint64_t RGBAImage::hash() const {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = (hash ^ (((uint64_t) width << 32) | (uint32_t) height)) * 0x100000001b3ULL;
+	// two pixels at once, the shift mixes the high bits back into the low bits
+	size_t size = data.size();
+	for (size_t i = 0; i + 1 < size; i += 2) {
+		hash ^= data[i] | ((uint64_t) data[i + 1] << 32);
+		hash *= 0x100000001b3ULL;
+		hash ^= hash >> 29;
+	}
+	if (size % 2 == 1)
+		hash = (hash ^ data[size - 1]) * 0x100000001b3ULL;
+	// 0 is reserved for images without hash
+	return hash != 0 ? hash : 1;
+}
+
 RGBAImage RGBAImage::clip(int x, int y, int width, int height) const {
 	RGBAImage image(width, height);
 	for (int xx = 0; xx < width && xx + x < this->width; xx++) {
@@ -400,24 +421,111 @@ void RGBAImage::resizeAuto(int new_width, int new_height, RGBAImage& dest) const
 
 void RGBAImage::resizeHalf(RGBAImage& dest) const {
 	dest.setSize(width / 2, height / 2);
+	resizeHalf(dest, 0, 0);
+}
 
-	for (int x = 0; x < width - 1; x += 2) {
-		for (int y = 0; y < height - 1; y += 2) {
-			RGBAPixel p1 = (data[y * width + x] >> 2) & 0x3f3f3f3f;
-			RGBAPixel p2 = (data[y * width + x + 1] >> 2) & 0x3f3f3f3f;
-			RGBAPixel p3 = (data[(y + 1) * width + x] >> 2) & 0x3f3f3f3f;
-			RGBAPixel p4 = (data[(y + 1) * width + x + 1] >> 2) & 0x3f3f3f3f;
-			dest.data[(y / 2) * dest.width + (x / 2)] = p1 + p2 + p3 + p4;
+/**
+ * Resizes the image to the half size and writes it directly to a position of another
+ * image, for example to a quadrant of a composite tile. Every pixel is the rounded
+ * average of the four pixels it replaces.
+ */
+void RGBAImage::resizeHalf(RGBAImage& dest, int x, int y) const {
+	int dest_width = std::min(width / 2, dest.width - x);
+	int dest_height = std::min(height / 2, dest.height - y);
+
+	for (int yy = 0; yy < dest_height; yy++) {
+		const RGBAPixel* row1 = &data[(2 * yy) * width];
+		const RGBAPixel* row2 = &data[(2 * yy + 1) * width];
+		RGBAPixel* out = &dest.data[(y + yy) * dest.width + x];
+
+		int xx = 0;
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i two = _mm_set1_epi16(2);
+		// four destination pixels at once
+		for (; xx + 4 <= dest_width; xx += 4) {
+			__m128i a1 = _mm_loadu_si128((const __m128i*) (row1 + 2 * xx));
+			__m128i b1 = _mm_loadu_si128((const __m128i*) (row1 + 2 * xx + 4));
+			__m128i a2 = _mm_loadu_si128((const __m128i*) (row2 + 2 * xx));
+			__m128i b2 = _mm_loadu_si128((const __m128i*) (row2 + 2 * xx + 4));
+
+			// add the two rows with 16 bit per channel
+			__m128i p01 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(a2, zero));
+			__m128i p23 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(a2, zero));
+			__m128i p45 = _mm_add_epi16(_mm_unpacklo_epi8(b1, zero), _mm_unpacklo_epi8(b2, zero));
+			__m128i p67 = _mm_add_epi16(_mm_unpackhi_epi8(b1, zero), _mm_unpackhi_epi8(b2, zero));
+
+			// then add the neighbor pixels and divide the sums by four with rounding
+			__m128i sum0123 = _mm_add_epi16(_mm_unpacklo_epi64(p01, p23),
+					_mm_unpackhi_epi64(p01, p23));
+			__m128i sum4567 = _mm_add_epi16(_mm_unpacklo_epi64(p45, p67),
+					_mm_unpackhi_epi64(p45, p67));
+			sum0123 = _mm_srli_epi16(_mm_add_epi16(sum0123, two), 2);
+			sum4567 = _mm_srli_epi16(_mm_add_epi16(sum4567, two), 2);
+			_mm_storeu_si128((__m128i*) (out + xx), _mm_packus_epi16(sum0123, sum4567));
+		}
+#endif
+		for (; xx < dest_width; xx++) {
+			RGBAPixel p1 = row1[2 * xx], p2 = row1[2 * xx + 1];
+			RGBAPixel p3 = row2[2 * xx], p4 = row2[2 * xx + 1];
+			RGBAPixel pixel = 0;
+			for (int shift = 0; shift < 32; shift += 8) {
+				uint32_t sum = ((p1 >> shift) & 0xff) + ((p2 >> shift) & 0xff)
+						+ ((p3 >> shift) & 0xff) + ((p4 >> shift) & 0xff);
+				pixel |= ((sum + 2) >> 2) << shift;
+			}
+			out[xx] = pixel;
 		}
 	}
 }
 
+RGBAImagePool::RGBAImagePool()
+	: used(0), allocations(0) {
+}
+
+RGBAImagePool::~RGBAImagePool() {
+}
+
+size_t RGBAImagePool::borrow(int width, int height) {
+	if (used == images.size()) {
+		images.push_back(RGBAImage());
+		capacities.push_back(0);
+	}
+#ifdef OPT_DEBUG
+	if (width * height > capacities[used])
+		allocations++;
+#endif
+	capacities[used] = std::max(capacities[used], width * height);
+	images[used].setSize(width, height);
+	return used++;
+}
+
+void RGBAImagePool::release(size_t index) {
+	used = std::min(used, index);
+}
+
+RGBAImage& RGBAImagePool::get(size_t index) {
+	return images[index];
+}
+
+long RGBAImagePool::getAllocations() const {
+	return allocations;
+}
+
 bool RGBAImage::readPNG(const std::string& filename) {
 	std::ifstream file(filename.c_str(), std::ios::binary);
 	if (!file) {
 		return false;
 	}
+	return readPNG(file);
+}
 
+bool RGBAImage::readPNGBuffer(const std::string& buffer) {
+	std::istringstream in(buffer);
+	return readPNG(in);
+}
+
+bool RGBAImage::readPNG(std::istream& file) {
 	uint8_t png_signature[8];
 	file.read((char*) &png_signature, 8);
 	if (png_sig_cmp(png_signature, 0, 8) != 0)
@@ -489,10 +597,21 @@ bool RGBAImage::readPNG(const std::string& filename) {
 
 bool RGBAImage::writePNG(const std::string& filename) const {
 	std::ofstream file(filename.c_str(), std::ios::binary);
-	if (!file) {
+	if (!file || !writePNG(file))
 		return false;
-	}
+	file.close();
+	return !file.fail();
+}
 
+bool RGBAImage::writePNGBuffer(std::string& buffer) const {
+	std::ostringstream out;
+	if (!writePNG(out))
+		return false;
+	buffer = out.str();
+	return true;
+}
+
+bool RGBAImage::writePNG(std::ostream& file) const {
 	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (png == NULL)
 		return false;
@@ -524,7 +643,6 @@ bool RGBAImage::writePNG(const std::string& filename) const {
 	else
 		png_write_png(png, info, PNG_TRANSFORM_IDENTITY, NULL);
 
-	file.close();
 	delete[] rows;
 	png_destroy_write_struct(&png, &info);
 	return true;
@@ -579,7 +697,101 @@ my_error_exit (j_common_ptr cinfo)
   longjmp(myerr->setjmp_buffer, 1);
 }
 
+#ifdef JCS_EXTENSIONS
+/**
+ * Returns the libjpeg-turbo color space which matches the byte order of our pixels
+ * in memory, with (alpha = true) or without a meaningful alpha byte.
+ */
+J_COLOR_SPACE jpegPixelColorSpace(bool alpha) {
+	if (mapcrafter::util::isBigEndian())
+		return alpha ? JCS_EXT_ABGR : JCS_EXT_XBGR;
+	return alpha ? JCS_EXT_RGBA : JCS_EXT_RGBX;
+}
+
+/**
+ * Puts a row of pixels onto the background color because jpeg does not support
+ * transparency. Pixels with only a bit of transparency are copied as they are.
+ */
+void blendJPEGBackground(const RGBAPixel* source, RGBAPixel* dest, int count,
+		RGBAPixel background) {
+	int x = 0;
+#ifdef __SSE2__
+	// the background is usually opaque, then every pixel is blended with
+	// (source * (alpha + 1) + background * (256 - alpha)) >> 8 like blend() does
+	if (rgba_alpha(background) == 255) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi16(1);
+		const __m128i all = _mm_set1_epi16(257);
+		const __m128i opaque = _mm_set1_epi32(0xff000000);
+		const __m128i threshold = _mm_set1_epi32(249);
+		const __m128i bg = _mm_unpacklo_epi8(_mm_set1_epi32(background), zero);
+		for (; x + 4 <= count; x += 4) {
+			__m128i pixels = _mm_loadu_si128((const __m128i*) (source + x));
+			__m128i lo = _mm_unpacklo_epi8(pixels, zero);
+			__m128i hi = _mm_unpackhi_epi8(pixels, zero);
+			// broadcast the alpha value + 1 of each pixel to its four channels
+			__m128i sa_lo = _mm_add_epi16(one, _mm_shufflehi_epi16(
+					_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)));
+			__m128i sa_hi = _mm_add_epi16(one, _mm_shufflehi_epi16(
+					_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)));
+			// the sums are at most 255 * 257 and fit into 16 bit
+			lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, sa_lo),
+					_mm_mullo_epi16(bg, _mm_sub_epi16(all, sa_lo))), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, sa_hi),
+					_mm_mullo_epi16(bg, _mm_sub_epi16(all, sa_hi))), 8);
+			__m128i blended = _mm_or_si128(_mm_packus_epi16(lo, hi), opaque);
+
+			// keep the pixels which are (nearly) opaque
+			__m128i keep = _mm_cmpgt_epi32(_mm_srli_epi32(pixels, 24), threshold);
+			_mm_storeu_si128((__m128i*) (dest + x), _mm_or_si128(
+					_mm_and_si128(keep, pixels), _mm_andnot_si128(keep, blended)));
+		}
+	}
+#endif
+	for (; x < count; x++) {
+		RGBAPixel color = source[x];
+		// add background color if this pixel has transparency
+		// but ignore a bit transparency
+		if (rgba_alpha(color) < 250) {
+			color = background;
+			blend(color, source[x]);
+		}
+		dest[x] = color;
+	}
+}
+#endif
+
 bool RGBAImage::readJPEG(const std::string& filename) {
+	return readJPEGScaled(filename, 1);
+}
+
+/**
+ * Reads a JPEG image and scales it down by 1/scale (1, 2, 4 or 8) while decoding it.
+ * libjpeg does this in the DCT domain, which is much faster than decoding the image
+ * at the full size and resizing it.
+ */
+bool RGBAImage::readJPEGScaled(const std::string& filename, int scale) {
+	FILE* infile = fopen(filename.c_str(), "rb");
+	if (infile == NULL)
+		return false;
+	bool ok = readJPEG(infile, NULL, 0, scale);
+	fclose(infile);
+	return ok;
+}
+
+bool RGBAImage::readJPEGBuffer(const std::string& buffer, int scale) {
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+	return readJPEG(NULL, (const unsigned char*) buffer.data(), buffer.size(), scale);
+#else
+	return false;
+#endif
+}
+
+/**
+ * Decodes a JPEG image either from a file or from a buffer in memory.
+ */
+bool RGBAImage::readJPEG(FILE* infile, const unsigned char* buffer, size_t size,
+		int scale) {
 	/* This struct contains the JPEG decompression parameters and pointers to
 	 * working space (which is allocated as needed by the JPEG library).
 	 */
@@ -590,21 +802,10 @@ bool RGBAImage::readJPEG(const std::string& filename) {
 	 */
 	struct my_error_mgr jerr;
 	/* More stuff */
-	FILE * infile;		/* source file */
-	JSAMPARRAY buffer;		/* Output row buffer */
+#ifndef JCS_EXTENSIONS
+	JSAMPARRAY row_buffer;		/* Output row buffer */
 	int row_stride;		/* physical row width in output buffer */
-
-	/* In this example we want to open the input file before doing anything else,
-	 * so that the setjmp() error recovery below can assume the file is open.
-	 * VERY IMPORTANT: use "b" option to fopen() if you are on a machine that
-	 * requires it in order to read binary files.
-	 */
-
-	if ((infile = fopen(filename.c_str(), "rb")) == NULL) {
-		//fprintf(stderr, "can't open %s\n", filename.c_str());
-		//return 0;
-		return false;
-	}
+#endif
 
 	/* Step 1: allocate and initialize JPEG decompression object */
 
@@ -614,18 +815,22 @@ bool RGBAImage::readJPEG(const std::string& filename) {
 	/* Establish the setjmp return context for my_error_exit to use. */
 	if (setjmp(jerr.setjmp_buffer)) {
 		/* If we get here, the JPEG code has signaled an error.
-		 * We need to clean up the JPEG object, close the input file, and return.
+		 * We need to clean up the JPEG object and return.
 		 */
 		jpeg_destroy_decompress(&cinfo);
-		fclose(infile);
-		return 0;
+		return false;
 	}
 	/* Now we can initialize the JPEG decompression object. */
 	jpeg_create_decompress(&cinfo);
 
 	/* Step 2: specify data source (eg, a file) */
 
-	jpeg_stdio_src(&cinfo, infile);
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+	if (infile == NULL)
+		jpeg_mem_src(&cinfo, (unsigned char*) buffer, size);
+	else
+#endif
+		jpeg_stdio_src(&cinfo, infile);
 
 	/* Step 3: read file parameters with jpeg_read_header() */
 
@@ -638,9 +843,12 @@ bool RGBAImage::readJPEG(const std::string& filename) {
 
 	/* Step 4: set parameters for decompression */
 
-	/* In this example, we don't need to change any of the defaults set by
-	 * jpeg_read_header(), so we do nothing here.
-	 */
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = scale;
+#ifdef JCS_EXTENSIONS
+	// libjpeg-turbo can decode directly into the memory layout of our pixels
+	cinfo.out_color_space = jpegPixelColorSpace(true);
+#endif
 
 	/* Step 5: Start decompressor */
 
@@ -655,11 +863,13 @@ bool RGBAImage::readJPEG(const std::string& filename) {
 	 * if we asked for color quantization.
 	 * In this example, we need to make an output work buffer of the right size.
 	 */
+#ifndef JCS_EXTENSIONS
 	/* JSAMPLEs per row in output buffer */
 	row_stride = cinfo.output_width * cinfo.output_components;
 	/* Make a one-row-high sample array that will go away when done with image */
-	buffer = (*cinfo.mem->alloc_sarray)
+	row_buffer = (*cinfo.mem->alloc_sarray)
 		((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
+#endif
 
 	/* Step 6: while (scan lines remain to be read) */
 	/*					 jpeg_read_scanlines(...); */
@@ -669,22 +879,29 @@ bool RGBAImage::readJPEG(const std::string& filename) {
 	/* Here we use the library's state variable cinfo.output_scanline as the
 	 * loop counter, so that we don't have to keep track ourselves.
 	 */
+#ifdef JCS_EXTENSIONS
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = (JSAMPROW) &data[cinfo.output_scanline * width];
+		(void) jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+#else
 	while (cinfo.output_scanline < cinfo.output_height) {
 		/* jpeg_read_scanlines expects an array of pointers to scanlines.
 		 * Here the array is only one element long, but you could ask for
 		 * more than one scanline at a time if that's more convenient.
 		 */
-		(void) jpeg_read_scanlines(&cinfo, buffer, 1);
+		(void) jpeg_read_scanlines(&cinfo, row_buffer, 1);
 		/* Assume put_scanline_someplace wants a pointer and sample count. */
 		for(int x = 0; x < width; x++) {
-			uint8_t red = buffer[0][3 * x];
-			uint8_t green = buffer[0][3 * x + 1];
-			uint8_t blue = buffer[0][3 * x + 2];
+			uint8_t red = row_buffer[0][3 * x];
+			uint8_t green = row_buffer[0][3 * x + 1];
+			uint8_t blue = row_buffer[0][3 * x + 2];
 			// output_scanline is increased by the jpeg_read_scanlines method
 			// before we use it for the image, that's why the -1
 			pixel(x, cinfo.output_scanline - 1) = rgba(red, green, blue, 255);
 		}
 	}
+#endif
 
 	/* Step 7: Finish decompression */
 
@@ -698,13 +915,6 @@ bool RGBAImage::readJPEG(const std::string& filename) {
 	/* This is an important step since it will release a good deal of memory. */
 	jpeg_destroy_decompress(&cinfo);
 
-	/* After finish_decompress, we can close the input file.
-	 * Here we postpone it until after no more JPEG errors are possible,
-	 * so as to simplify the setjmp error logic above.	(Actually, I don't
-	 * think that jpeg_destroy can do an error exit, but why assume anything...)
-	 */
-	fclose(infile);
-
 	/* At this point you may want to check to see whether any corrupt-data
 	 * warnings occurred (test whether jerr.pub.num_warnings is nonzero).
 	 */
@@ -716,6 +926,27 @@ bool RGBAImage::readJPEG(const std::string& filename) {
 
 bool RGBAImage::writeJPEG(const std::string& filename, int quality,
 		RGBAPixel background) const {
+	FILE* outfile = fopen(filename.c_str(), "wb");
+	if (outfile == NULL)
+		return false;
+	bool ok = writeJPEG(outfile, NULL, quality, background);
+	return fclose(outfile) == 0 && ok;
+}
+
+bool RGBAImage::writeJPEGBuffer(std::string& buffer, int quality,
+		RGBAPixel background) const {
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+	return writeJPEG(NULL, &buffer, quality, background);
+#else
+	return false;
+#endif
+}
+
+/**
+ * Encodes the image as JPEG either to a file or to a buffer in memory.
+ */
+bool RGBAImage::writeJPEG(FILE* outfile, std::string* buffer, int quality,
+		RGBAPixel background) const {
 
 	/* This struct contains the JPEG compression parameters and pointers to
 	 * working space (which is allocated as needed by the JPEG library).
@@ -734,7 +965,8 @@ bool RGBAImage::writeJPEG(const std::string& filename, int quality,
 	 */
 	struct jpeg_error_mgr jerr;
 	/* More stuff */
-	FILE * outfile;		/* target file */
+	unsigned char* mem_buffer = NULL;
+	unsigned long mem_size = 0;
 
 	/* Step 1: allocate and initialize JPEG compression object */
 
@@ -751,16 +983,14 @@ bool RGBAImage::writeJPEG(const std::string& filename, int quality,
 	/* Note: steps 2 and 3 can be done in either order. */
 
 	/* Here we use the library-supplied code to send compressed data to a
-	 * stdio stream.	You can also write your own code to do something else.
-	 * VERY IMPORTANT: use "b" option to fopen() if you are on a machine that
-	 * requires it in order to write binary files.
+	 * stdio stream or to a buffer in memory allocated by the library.
 	 */
-	if ((outfile = fopen(filename.c_str(), "wb")) == NULL) {
-		//fprintf(stderr, "can't open %s\n", filename.c_str());
-		//exit(1);
-		return false;
-	}
-	jpeg_stdio_dest(&cinfo, outfile);
+#if JPEG_LIB_VERSION >= 80 || defined(MEM_SRCDST_SUPPORTED)
+	if (outfile == NULL)
+		jpeg_mem_dest(&cinfo, &mem_buffer, &mem_size);
+	else
+#endif
+		jpeg_stdio_dest(&cinfo, outfile);
 
 	/* Step 3: set parameters for compression */
 
@@ -769,8 +999,14 @@ bool RGBAImage::writeJPEG(const std::string& filename, int quality,
 	 */
 	cinfo.image_width = width; 	/* image width and height, in pixels */
 	cinfo.image_height = height;
+#ifdef JCS_EXTENSIONS
+	// libjpeg-turbo can read our pixels directly and ignores the alpha byte
+	cinfo.input_components = 4;
+	cinfo.in_color_space = jpegPixelColorSpace(false);
+#else
 	cinfo.input_components = 3;		/* # of color components per pixel */
 	cinfo.in_color_space = JCS_RGB; 	/* colorspace of input image */
+#endif
 	/* Now use the library's routine to set default compression parameters.
 	 * (You must set at least cinfo.in_color_space before calling this,
 	 * since the defaults depend on the source color space.)
@@ -796,6 +1032,16 @@ bool RGBAImage::writeJPEG(const std::string& filename, int quality,
 	 * To keep things simple, we pass one scanline per call; you can pass
 	 * more if you wish, though.
 	 */
+#ifdef JCS_EXTENSIONS
+	std::vector<RGBAPixel> line_buffer(width, 0);
+	JSAMPROW scanlineData = (JSAMPROW) &line_buffer[0];
+
+	while (cinfo.next_scanline < cinfo.image_height) {
+		blendJPEGBackground(&data[cinfo.next_scanline * width], &line_buffer[0],
+				width, background);
+		(void) jpeg_write_scanlines(&cinfo, &scanlineData, 1);
+	}
+#else
 	std::vector<JSAMPLE> line_buffer(width * 3, 0);
 	JSAMPLE* scanlineData = &line_buffer[0];
 
@@ -820,12 +1066,15 @@ bool RGBAImage::writeJPEG(const std::string& filename, int quality,
 		}
 		(void) jpeg_write_scanlines(&cinfo, &scanlineData, 1);
 	}
+#endif
 
 	/* Step 6: Finish compression */
 
 	jpeg_finish_compress(&cinfo);
-	/* After finish_compress, we can close the output file. */
-	fclose(outfile);
+	if (buffer != NULL) {
+		buffer->assign((const char*) mem_buffer, mem_size);
+		free(mem_buffer);
+	}
 
 	/* Step 7: release JPEG compression object */
 
@@ -22,6 +22,9 @@
 
 #include <png.h>
 #include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <deque>
 #include <string>
 #include <vector>
 
@@ -84,6 +87,11 @@ public:
 	void fill(RGBAPixel color, int x1, int y1, int w, int h);
 	void clear();
 
+	/**
+	 * Returns a 64 bit hash of the size and the pixels of the image, never 0.
+	 */
+	uint64_t hash() const;
+
 	RGBAImage clip(int x, int y, int width, int height) const;
 	RGBAImage colorize(double r, double g, double b, double a = 1) const;
 	RGBAImage colorize(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) const;
@@ -96,13 +104,72 @@ public:
 	// automatically chooses an image resize interpolation
 	void resizeAuto(int new_width, int new_height, RGBAImage& dest) const;
 	void resizeHalf(RGBAImage& dest) const;
+	void resizeHalf(RGBAImage& dest, int x, int y) const;
 
 	bool readPNG(const std::string& filename);
 	bool writePNG(const std::string& filename) const;
 
 	bool readJPEG(const std::string& filename);
+	bool readJPEGScaled(const std::string& filename, int scale);
 	bool writeJPEG(const std::string& filename, int quality,
 			RGBAPixel background = rgba(255, 255, 255, 255)) const;
+
+	/**
+	 * Read/write encoded images from/to buffers in memory instead of files.
+	 */
+	bool readPNGBuffer(const std::string& buffer);
+	bool writePNGBuffer(std::string& buffer) const;
+
+	bool readJPEGBuffer(const std::string& buffer, int scale = 1);
+	bool writeJPEGBuffer(std::string& buffer, int quality,
+			RGBAPixel background = rgba(255, 255, 255, 255)) const;
+
+private:
+	bool readPNG(std::istream& in);
+	bool writePNG(std::ostream& out) const;
+
+	bool readJPEG(FILE* file, const unsigned char* buffer, size_t size, int scale);
+	bool writeJPEG(FILE* file, std::string* buffer, int quality,
+			RGBAPixel background) const;
+};
+
+/**
+ * A pool of reusable image buffers, every thread has its own pools. Images are borrowed
+ * from the pool and released in the reverse order, like on a stack. A released buffer
+ * keeps its memory, so borrowing it again with the same size does not allocate memory.
+ */
+class RGBAImagePool {
+public:
+	RGBAImagePool();
+	~RGBAImagePool();
+
+	/**
+	 * Borrows an image with the specified size and returns the index of it. The image
+	 * has the content it had the last time it was borrowed. References to borrowed
+	 * images stay valid while they are borrowed.
+	 */
+	size_t borrow(int width, int height);
+
+	/**
+	 * Releases the image with the specified index and all images borrowed after it.
+	 */
+	void release(size_t index);
+
+	RGBAImage& get(size_t index);
+
+	/**
+	 * Returns how often the pool had to allocate image memory. This is only counted in
+	 * debug builds and helps to make sure that the rendering reuses the buffers.
+	 */
+	long getAllocations() const;
+
+private:
+	// a deque keeps the references to the images valid when more images are added
+	std::deque<RGBAImage> images;
+	// biggest size (width * height) every buffer had
+	std::vector<int> capacities;
+	size_t used;
+	long allocations;
 };
 
 template <typename Pixel>
@@ -19,6 +19,7 @@
 
 #include "manager.h"
 
+#include "blockimagesregistry.h"
 #include "tilerenderworker.h"
 #include "../config/loggingconfig.h"
 #include "../thread/impl/singlethread.h"
@@ -31,7 +32,10 @@
 #include <ctime>
 #include <array>
 #include <fstream>
+#include <iomanip>
+#include <iterator>
 #include <memory>
+#include <sstream>
 #include <thread>
 
 namespace mapcrafter {
@@ -79,6 +83,8 @@ bool MapSettings::read(const fs::path& filename) {
 		render_leaves_transparent.set(root.get<bool>("render_leaves_transparent"));
 	if (root.has("render_biomes"))
 		render_biomes.set(root.get<bool>("render_biomes"));
+	// older maps were never rendered into a tile archive
+	use_tile_archive.set(root.get<bool>("use_tile_archive", false));
 
 	max_zoom = root.get<int>("max_zoom");
 
@@ -111,6 +117,7 @@ bool MapSettings::write(const fs::path& filename) const {
 	root.set("render_unknown_blocks", util::str(render_unknown_blocks.get()));
 	root.set("render_leaves_transparent", util::str(render_leaves_transparent.get()));
 	root.set("render_biomes", util::str(render_biomes.get()));
+	root.set("use_tile_archive", util::str(use_tile_archive.get()));
 
 	root.set("max_zoom", util::str(max_zoom));
 
@@ -149,6 +156,8 @@ bool MapSettings::syncMapConfig(const config::MapSection& map) {
 		render_leaves_transparent.set(map.renderLeavesTransparent());
 	if (render_biomes.isNull())
 		render_biomes.set(map.renderBiomes());
+	if (use_tile_archive.isNull())
+		use_tile_archive.set(map.useTileArchive());
 
 	bool changed = true;
 	bool force_required = false;
@@ -164,6 +173,14 @@ bool MapSettings::syncMapConfig(const config::MapSection& map) {
 				<< "generated with the other image format.";
 		force_required = true;
 		return false;
+	} else if (use_tile_archive.get() != map.useTileArchive()) {
+		LOG(ERROR) << "You changed the use of a tile archive from "
+				<< util::str(use_tile_archive.get()) << " to "
+				<< util::str(map.useTileArchive()) << ".";
+		LOG(ERROR) << "Force-render the whole map in order for the new "
+				<< "configuration to come into effect and delete the images "
+				<< "generated without/with the tile archive.";
+		return false;
 	} else if (!util::floatingPointEquals(lighting_intensity.get(), map.getLightingIntensity())) {
 		LOG(WARNING) << "You changed the lighting intensity from "
 				<< lighting_intensity.get() << " to " << map.getLightingIntensity() << ".";
@@ -206,6 +223,7 @@ MapSettings MapSettings::byMapConfig(const config::MapSection& map) {
 	settings.render_unknown_blocks.set(map.renderUnknownBlocks());
 	settings.render_leaves_transparent.set(map.renderLeavesTransparent());
 	settings.render_biomes.set(map.renderBiomes());
+	settings.use_tile_archive.set(map.useTileArchive());
 
 	auto rotations = map.getRotations();
 	for (auto it = rotations.begin(); it != rotations.end(); ++it)
@@ -214,6 +232,82 @@ MapSettings MapSettings::byMapConfig(const config::MapSection& map) {
 	return settings;
 }
 
+/**
+ * Returns the key of the tile set index and chunk hash index of a world rotation, the
+ * indexes are only used with the same configuration of the world.
+ */
+std::string getWorldIndexKey(const config::WorldSection& world, int rotation) {
+	std::stringstream ss;
+	world.dump(ss);
+	ss << "rotation = " << rotation << std::endl;
+	return ss.str();
+}
+
+/**
+ * Returns the key of the tile hash index of a map rotation, the hashes are only used
+ * while the tile files are written in the same way and at the same positions.
+ */
+std::string getTileHashesKey(const config::MapSection& map, const config::Color& background,
+		const TileSet& tile_set) {
+	std::stringstream ss;
+	ss << "image_format = " << map.getImageFormatSuffix() << std::endl;
+	if (map.getImageFormat() == config::ImageFormat::JPEG)
+		ss << "jpeg_quality = " << map.getJPEGQuality() << std::endl
+			<< "background_color = " << background.hex << std::endl;
+	ss << "depth = " << tile_set.getDepth() << std::endl;
+	ss << "tile_offset = " << tile_set.getTileOffset() << std::endl;
+	// all tile files are written again to (un)link them when the deduplication changes
+	ss << "deduplicate_tiles = " << map.deduplicateTiles() << std::endl;
+	return ss.str();
+}
+
+/**
+ * Returns the name of the encoding parameters of the tile images of a map, the tile store
+ * keeps the images written with other parameters apart.
+ */
+std::string getTileStoreEncoding(const config::MapSection& map,
+		const config::Color& background) {
+	std::stringstream ss;
+	ss << map.getImageFormatSuffix();
+	if (map.getImageFormat() == config::ImageFormat::JPEG)
+		ss << "-" << map.getJPEGQuality() << "-" << std::hex << std::setfill('0')
+			<< std::setw(2) << (int) background.red << std::setw(2) << (int) background.green
+			<< std::setw(2) << (int) background.blue;
+	return ss.str();
+}
+
+/**
+ * Removes the temporary tile files an interrupted rendering left in a tile directory.
+ */
+void removeTempTileFiles(const fs::path& dir) {
+	if (!fs::exists(dir))
+		return;
+	std::vector<fs::path> files;
+	for (fs::recursive_directory_iterator it(dir), end; it != end; ++it)
+		if (it->path().extension() == ".tmp" && fs::is_regular_file(it->status()))
+			files.push_back(it->path());
+	boost::system::error_code error;
+	for (auto it = files.begin(); it != files.end(); ++it)
+		fs::remove(*it, error);
+	if (!files.empty())
+		LOG(INFO) << "Removed " << files.size() << " temporary tile files of the "
+				<< "interrupted rendering.";
+}
+
+/**
+ * Returns the key of the render journal of a map rotation, an interrupted rendering is
+ * only continued with the same configuration and the same tile positions.
+ */
+std::string getRenderJournalKey(const config::MapSection& map,
+		const config::WorldSection& world, int rotation, const config::Color& background,
+		const TileSet& tile_set) {
+	std::stringstream ss;
+	map.dump(ss);
+	ss << getWorldIndexKey(world, rotation);
+	ss << getTileHashesKey(map, background, tile_set);
+	return ss.str();
+}
+
 RenderManager::RenderManager(const RenderOpts& opts)
 	: opts(opts) {
 }
@@ -364,18 +458,11 @@ void RenderManager::increaseMaxZoom(const fs::path& dir,
 	int s = img1.getWidth();
 	// create images for the new directories
 	RGBAImage new1(s, s), new2(s, s), new3(s, s), new4(s, s);
-	RGBAImage old1, old2, old3, old4;
-	// resize the old images...
-	img1.resizeHalf(old1);
-	img2.resizeHalf(old2);
-	img3.resizeHalf(old3);
-	img4.resizeHalf(old4);
-
-	// ...to blit them to the images of the new directories
-	new1.simpleblit(old1, s/2, s/2);
-	new2.simpleblit(old2, 0, s/2);
-	new3.simpleblit(old3, s/2, 0);
-	new4.simpleblit(old4, 0, 0);
+	// resize the old images directly into the images of the new directories
+	img1.resizeHalf(new1, s/2, s/2);
+	img2.resizeHalf(new2, 0, s/2);
+	img3.resizeHalf(new3, s/2, 0);
+	img4.resizeHalf(new4, 0, 0);
 
 	// now save the new images in the output directory
 	if (image_format == "png") {
@@ -391,18 +478,71 @@ void RenderManager::increaseMaxZoom(const fs::path& dir,
 	}
 
 	// don't forget the base.png
-	RGBAImage base_big(2*s, 2*s), base;
-	base_big.simpleblit(new1, 0, 0);
-	base_big.simpleblit(new2, s, 0);
-	base_big.simpleblit(new3, 0, s);
-	base_big.simpleblit(new4, s, s);
-	base_big.resizeHalf(base);
+	RGBAImage base(s, s);
+	new1.resizeHalf(base, 0, 0);
+	new2.resizeHalf(base, s/2, 0);
+	new3.resizeHalf(base, 0, s/2);
+	new4.resizeHalf(base, s/2, s/2);
 	if (image_format == "png")
 		base.writePNG((dir / "base.png").string());
 	else
 		base.writeJPEG((dir / "base.jpg").string(), jpeg_quality);
 }
 
+/**
+ * Increases the max zoom of a map rendered into a tile archive like the method above.
+ */
+void RenderManager::increaseMaxZoom(TileArchive& archive,
+		std::string image_format, int jpeg_quality) const {
+	bool png = image_format == "png";
+	if (!archive.increaseDepth())
+		return;
+
+	// read the images of the old first zoom level from their new positions
+	// and compose the new first zoom level and the base tile of them
+	RGBAImage new_images[4];
+	RGBAImage base;
+	int s = 0;
+	for (int i = 1; i <= 4; i++) {
+		TilePath old_tile = TilePath() + i + (5 - i);
+		std::string data;
+		RGBAImage old_image;
+		if (!archive.readTile(old_tile, data)
+				|| !(png ? old_image.readPNGBuffer(data) : old_image.readJPEGBuffer(data)))
+			continue;
+		if (s == 0) {
+			s = old_image.getWidth();
+			base.setSize(s, s);
+			for (int j = 0; j < 4; j++)
+				new_images[j].setSize(s, s);
+		}
+		// the old tile is in the opposite corner of the new tile
+		int x = (i == 1 || i == 3) ? s/2 : 0;
+		int y = (i == 1 || i == 2) ? s/2 : 0;
+		old_image.resizeHalf(new_images[i-1], x, y);
+	}
+	if (s == 0)
+		return;
+
+	for (int i = 1; i <= 4; i++) {
+		std::string data;
+		if (png)
+			new_images[i-1].writePNGBuffer(data);
+		else
+			new_images[i-1].writeJPEGBuffer(data, jpeg_quality);
+		archive.writeTile(TilePath() + i, data);
+		new_images[i-1].resizeHalf(base, (i == 2 || i == 4) ? s/2 : 0,
+				(i == 3 || i == 4) ? s/2 : 0);
+	}
+
+	std::string data;
+	if (png)
+		base.writePNGBuffer(data);
+	else
+		base.writeJPEGBuffer(data, jpeg_quality);
+	archive.writeTile(TilePath(), data);
+}
+
 /**
  * Starts the whole rendering thing.
  */
@@ -468,6 +608,25 @@ bool RenderManager::run() {
 		}
 	}
 
+	// start creating the block images of all rotations of all maps to render,
+	// they are created in the background while the worlds are scanned
+	BlockImagesRegistry block_images_registry(config.getOutputPath(".cache").string());
+	for (auto map_it = config_maps.begin(); map_it != config_maps.end(); ++map_it) {
+		auto rotations = map_it->getRotations();
+		for (auto rotation_it = rotations.begin(); rotation_it != rotations.end(); ++rotation_it)
+			if (confighelper.getRenderBehavior(map_it->getShortName(), *rotation_it)
+					!= config::MapcrafterConfigHelper::RENDER_SKIP)
+				block_images_registry.add(*map_it, *rotation_it);
+	}
+	block_images_registry.build(opts.jobs);
+	// the block images of map rotations which are not rendered because of an error need
+	// to be released, otherwise they are kept in memory until all maps are rendered
+	auto release_block_images = [&](const config::MapSection& map, int rotation) {
+		if (confighelper.getRenderBehavior(map.getShortName(), rotation)
+				!= config::MapcrafterConfigHelper::RENDER_SKIP)
+			block_images_registry.release(map, rotation);
+	};
+
 	// ###
 	// ### Second big step: Scan the worlds
 	// ###
@@ -508,6 +667,15 @@ bool RenderManager::run() {
 				LOG(FATAL) << "Unable to load world " << world_name << "!";
 				return false;
 			}
+			// the tiles of the regions which weren't changed since the last run
+			// are taken from the tile set index of this world and rotation,
+			// the index is only used with the same world configuration
+			TileSetIndex index;
+			fs::path index_file = config.getOutputPath(".cache/tiles-" + world_name
+					+ "-" + util::str(*rotation_it) + ".index");
+			std::string index_key = getWorldIndexKey(world_it->second, *rotation_it);
+			index.read(index_file.string(), index_key);
+
 			// create a tileset for this world
 			std::shared_ptr<TileSet> tile_set(new TileSet);
 			// and scan for tiles of this world,
@@ -516,11 +684,16 @@ bool RenderManager::run() {
 			//  - the ones with complete specified x- AND z-bounds
 			if (world_it->second.needsWorldCentering()) {
 				TilePos tile_offset;
-				tile_set->scan(world, true, tile_offset);
+				tile_set->scan(world, true, tile_offset, &index);
 				confighelper.setWorldTileOffset(world_name, *rotation_it, tile_offset);
 			} else {
-				tile_set->scan(world);
+				tile_set->scan(world, &index);
 			}
+			LOG(DEBUG) << "Scanned " << index.getScannedRegionsCount() << " regions of world "
+					<< world_name << ", took " << index.getIndexedRegionsCount()
+					<< " unchanged regions from the tile set index.";
+			if (!index.write(index_file.string(), index_key))
+				LOG(WARNING) << "Unable to write tile set index '" << index_file.string() << "'.";
 			// update the highest max zoom level
 			zoomlevels_max = std::max(zoomlevels_max, tile_set->getMinDepth());
 
@@ -578,12 +751,19 @@ bool RenderManager::run() {
 			if (!settings.read(settings_file)) {
 				LOG(ERROR) << "Unable to load old map.settings file!"
 						<< "You have to force-render the whole map.";
+				auto rotations = map.getRotations();
+				for (auto it = rotations.begin(); it != rotations.end(); ++it)
+					release_block_images(map, *it);
 				continue;
 			}
 
 			// check whether the config file was changed when rendering incrementally
-			if (!settings.syncMapConfig(map))
+			if (!settings.syncMapConfig(map)) {
+				auto rotations = map.getRotations();
+				for (auto it = rotations.begin(); it != rotations.end(); ++it)
+					release_block_images(map, *it);
 				continue;
+			}
 
 			// for force-render rotations
 			// -> set the last render time to 0 -> to render all tiles
@@ -612,6 +792,16 @@ bool RenderManager::run() {
 			// if zoom level has increased, increase zoom levels of tile sets
 			for (auto rotation_it = rotations.begin(); rotation_it != rotations.end();
 					++rotation_it) {
+				if (map.useTileArchive()) {
+					TileArchive archive;
+					if (!archive.open(config.getOutputPath(map_name + "/"
+							+ config::ROTATION_NAMES_SHORT[*rotation_it] + ".tiles")))
+						continue;
+					for (int i = settings.max_zoom; i < world_zoomlevels; i++)
+						increaseMaxZoom(archive, map.getImageFormatSuffix());
+					archive.close();
+					continue;
+				}
 				fs::path output_dir = config.getOutputPath(map_name + "/"
 						+ config::ROTATION_NAMES_SHORT[*rotation_it]);
 				for (int i = settings.max_zoom; i < world_zoomlevels; i++)
@@ -661,35 +851,137 @@ bool RenderManager::run() {
 
 			fs::path output_dir = config.getOutputPath(map_name + "/"
 					+ config::ROTATION_NAMES_SHORT[rotation]);
-			// if incremental render scan which tiles might have changed
+			// the hashes of the chunk sections of the last rendering of this map rotation
+			ChunkHashIndex chunk_hashes;
+			fs::path chunk_hashes_file = config.getOutputPath(map_name + "/chunks-"
+					+ config::ROTATION_NAMES_SHORT[rotation] + ".hashes");
+			std::string chunk_hashes_key = getWorldIndexKey(
+					config.getWorld(world_name), rotation);
+
+			// the archive the tiles of this map rotation are stored in, if used
+			std::shared_ptr<TileArchive> tile_archive;
+			fs::path tile_archive_file = config.getOutputPath(map_name + "/"
+					+ config::ROTATION_NAMES_SHORT[rotation] + ".tiles");
+			if (map.useTileArchive()) {
+				tile_archive.reset(new TileArchive);
+				if (!tile_archive->open(tile_archive_file)) {
+					LOG(ERROR) << "Skipping rotation.";
+					release_block_images(map, rotation);
+					continue;
+				}
+			}
+
 			std::shared_ptr<TileSet> tile_set(new TileSet(*tile_sets[world_name][rotation]));
-			if (confighelper.getRenderBehavior(map_name, rotation)
-					== config::MapcrafterConfigHelper::RENDER_AUTO) {
+
+			// the journal of an interrupted rendering of this map rotation,
+			// the rendering is continued without the already rendered tiles
+			std::shared_ptr<RenderJournal> render_journal(new RenderJournal);
+			fs::path render_journal_file = config.getOutputPath(map_name + "/tiles-"
+					+ config::ROTATION_NAMES_SHORT[rotation] + ".journal");
+			std::string render_journal_key = getRenderJournalKey(map,
+					config.getWorld(world_name), rotation, config.getBackgroundColor(),
+					*tile_set);
+			fs::path tile_hashes_file = config.getOutputPath(map_name + "/tiles-"
+					+ config::ROTATION_NAMES_SHORT[rotation] + ".hashes");
+			bool resume = false;
+			bool interrupted = fs::exists(render_journal_file);
+			if (interrupted) {
+				resume = render_journal->read(render_journal_file, render_journal_key);
+				// the tile hashes do not belong to the partially rendered tiles anymore
+				if (!resume) {
+					LOG(WARNING) << "Unable to continue the interrupted rendering, "
+							<< "the configuration was changed.";
+					fs::remove(render_journal_file);
+					if (fs::exists(tile_hashes_file))
+						fs::remove(tile_hashes_file);
+				}
+				if (!tile_archive)
+					removeTempTileFiles(output_dir);
+			}
+			if (!resume) {
+				render_journal->setStartTime(start_scanning);
+				render_journal->setForceRender(confighelper.getRenderBehavior(map_name,
+						rotation) == config::MapcrafterConfigHelper::RENDER_FORCE);
+			}
+			// an interrupted force-render is continued as force-render
+			bool render_auto = confighelper.getRenderBehavior(map_name, rotation)
+					== config::MapcrafterConfigHelper::RENDER_AUTO
+					&& !render_journal->isForceRender();
+
+			// if incremental render scan which tiles might have changed
+			if (render_auto) {
 				LOG(INFO) << "Scanning required tiles...";
 				// use the incremental check specified in the config
-				if (map.useImageModificationTimes())
+				if (map.useChunkHashes()) {
+					chunk_hashes.read(chunk_hashes_file.string(), chunk_hashes_key);
+					tile_set->scanRequiredByHashes(worlds[world_name][rotation],
+							settings.last_render[rotation], chunk_hashes);
+					LOG(INFO) << "Read " << chunk_hashes.getReadChunksCount()
+							<< " chunks with newer timestamps, "
+							<< chunk_hashes.getChangedSectionsCount()
+							<< " chunk sections changed.";
+				} else if (map.useImageModificationTimes() && tile_archive)
+					tile_set->scanRequiredByTileTimes(tile_archive->getTileTimes());
+				// deduplicated tile files share the modification times of their images
+				else if (map.useImageModificationTimes() && !map.deduplicateTiles())
 					tile_set->scanRequiredByFiletimes(output_dir,
-							map.getImageFormatSuffix());
+							map.getImageFormatSuffix(), opts.jobs);
 				else
 					tile_set->scanRequiredByTimestamp(settings.last_render[rotation]);
 			}
 
+			// the tiles written by an interrupted rendering are newer than their chunks now,
+			// the render tiles it required are taken from the journal, a force-render
+			// requires all tiles anyway
+			if (resume)
+				tile_set->addRequiredRenderTiles(render_journal->getRequiredTiles());
+			if (render_auto) {
+				std::vector<TilePath> required_tiles;
+				const auto& required_render_tiles = tile_set->getRequiredRenderTiles();
+				required_tiles.reserve(required_render_tiles.size());
+				for (auto it = required_render_tiles.begin();
+						it != required_render_tiles.end(); ++it)
+					required_tiles.push_back(TilePath::byTilePos(*it, tile_set->getDepth()));
+				render_journal->setRequiredTiles(required_tiles);
+			}
+
+			if (resume) {
+				int render_tiles = tile_set->getRequiredRenderTilesCount();
+				tile_set->removeRequiredSubtrees(render_journal->getFinishedTiles());
+				std::time_t t = render_journal->getStartTime();
+				char buffer[256];
+				std::strftime(buffer, sizeof(buffer), "%d %b %Y, %H:%M:%S", std::localtime(&t));
+				LOG(INFO) << "Continuing the interrupted rendering from " << buffer << ", "
+						<< tile_set->getRequiredRenderTilesCount() << " of " << render_tiles
+						<< " render tiles are left.";
+			}
+
 			std::time_t time_start = std::time(nullptr);
 
-			// create block images
-			std::shared_ptr<BlockImages> block_images(new BlockImages);
-			block_images->setSettings(map.getTextureSize(), rotation, map.renderUnknownBlocks(),
-					map.renderLeavesTransparent(), map.getRendermode());
+			// get the block images, they might still be created
+			std::shared_ptr<BlockImages> block_images = block_images_registry.get(map, rotation);
 			// if textures do not work, it does not make much sense
 			// to try the other rotations with the same textures
-			if (!block_images->loadAll(map.getTextureDir().string())) {
+			if (!block_images) {
 				LOG(ERROR) << "Skipping remaining rotations.";
+				for (auto it = std::next(rotation_it); it != rotations.end(); ++it)
+					release_block_images(map, *it);
 				break;
 			}
 
-			// render the map
-			if (tile_set->getRequiredRenderTilesCount() == 0) {
+			// the chunk hashes are only kept if the map is rendered incrementally with them,
+			// otherwise they don't belong to the rendered tiles anymore,
+			// the new hashes are written when the required tiles are rendered
+			bool write_chunk_hashes = map.useChunkHashes() && render_auto;
+			if (!write_chunk_hashes && fs::exists(chunk_hashes_file))
+				fs::remove(chunk_hashes_file);
+
+			// render the map, an interrupted rendering might only need to compose some
+			// composite tiles and needs to be finished anyway
+			if (tile_set->getRequiredRenderTilesCount() == 0 && !resume) {
 				LOG(INFO) << "No tiles need to get rendered.";
+				if (write_chunk_hashes)
+					chunk_hashes.write(chunk_hashes_file.string(), chunk_hashes_key);
 				continue;
 			}
 
@@ -701,6 +993,49 @@ bool RenderManager::run() {
 			context.block_images = block_images;
 			context.world = worlds[world_name][rotation];
 			context.tile_set = tile_set;
+			context.tile_archive = tile_archive;
+			context.sync_tiles = opts.sync_tiles;
+
+			// the tiles changed by this rendering are appended to the manifest
+			if (map.writeTileManifest()) {
+				context.tile_manifest.reset(new TileManifest(
+						config::ROTATION_NAMES_SHORT[rotation], map.getImageFormatSuffix()));
+				if (!context.tile_manifest->open(config.getOutputPath(map_name + "/tiles-"
+						+ config::ROTATION_NAMES_SHORT[rotation] + ".manifest")))
+					context.tile_manifest.reset();
+			}
+
+			// the store is also needed to replace the tile files which are still hard
+			// links into the store if the tiles are not deduplicated anymore
+			fs::path tile_store_dir = config.getOutputPath(map_name + "/"
+					+ config::ROTATION_NAMES_SHORT[rotation] + ".store");
+			if (!tile_archive && (map.deduplicateTiles() || fs::exists(tile_store_dir)))
+				context.tile_store.reset(new TileStore(tile_store_dir,
+						map.getImageFormatSuffix(),
+						getTileStoreEncoding(map, config.getBackgroundColor()),
+						map.deduplicateTiles()));
+
+			// tiles whose images did not change since the last rendering are not written,
+			// the hashes of an interrupted rendering are taken from its journal
+			context.tile_hashes.reset(new TileHashIndex);
+			std::string tile_hashes_key = getTileHashesKey(map,
+					config.getBackgroundColor(), *tile_set);
+			context.tile_hashes->read(tile_hashes_file.string(), tile_hashes_key);
+			if (resume)
+				render_journal->updateTileHashes(*context.tile_hashes);
+
+			// the finished render works are journaled, the hash file is kept together
+			// with the journal, otherwise it is removed while rendering because it does
+			// not belong to the tile files anymore if the rendering is interrupted
+			if (render_journal->open(render_journal_file, render_journal_key,
+					opts.sync_tiles))
+				context.render_journal = render_journal;
+			else {
+				LOG(WARNING) << "Unable to write render journal '"
+						<< render_journal_file.string() << "'.";
+				if (fs::exists(tile_hashes_file))
+					fs::remove(tile_hashes_file);
+			}
 
 			std::shared_ptr<thread::Dispatcher> dispatcher;
 			if (opts.jobs == 1)
@@ -725,10 +1060,33 @@ bool RenderManager::run() {
 			if (progress_bar != nullptr)
 				progress_bar->finish();
 
+			if (tile_archive) {
+				// rewrite the archive if most of it are replaced tile images
+				if (tile_archive->getWastedSize() > tile_archive->getSize() / 2) {
+					LOG(INFO) << "Compacting tile archive '"
+							<< tile_archive_file.string() << "'...";
+					tile_archive->compact();
+				}
+				tile_archive->close();
+			}
+			if (context.tile_store)
+				context.tile_store->cleanup();
+			if (context.tile_manifest)
+				context.tile_manifest->close();
+
 			// update the settings file with last render time
 			settings.rotations[rotation] = true;
-			settings.last_render[rotation] = start_scanning;
+			settings.last_render[rotation] = render_journal->getStartTime();
 			settings.write(settings_file);
+			if (write_chunk_hashes
+					&& !chunk_hashes.write(chunk_hashes_file.string(), chunk_hashes_key))
+				LOG(WARNING) << "Unable to write chunk hashes '"
+						<< chunk_hashes_file.string() << "'.";
+			if (!context.tile_hashes->write(tile_hashes_file.string(), tile_hashes_key))
+				LOG(WARNING) << "Unable to write tile hashes '"
+						<< tile_hashes_file.string() << "'.";
+			if (context.render_journal)
+				context.render_journal->remove();
 
 			std::time_t took = std::time(nullptr) - time_start;
 			LOG(INFO) << "[" << progress_maps << "." << progress_rotations << "/"
@@ -20,6 +20,7 @@
 #ifndef MANAGER_H_
 #define MANAGER_H_
 
+#include "tilearchive.h"
 #include "tilerenderer.h"
 #include "tileset.h"
 #include "../config/mapcrafterconfig.h"
@@ -48,6 +49,7 @@ struct RenderOpts {
 	std::vector<std::string> render_skip, render_auto, render_force;
 	bool skip_all;
 	int jobs;
+	bool sync_tiles;
 };
 
 /**
@@ -61,6 +63,7 @@ struct MapSettings {
 	util::Nullable<bool> render_unknown_blocks;
 	util::Nullable<bool> render_leaves_transparent;
 	util::Nullable<bool> render_biomes;
+	util::Nullable<bool> use_tile_archive;
 
 	int max_zoom;
 	std::array<bool, 4> rotations;
@@ -94,6 +97,8 @@ private:
 
 	void increaseMaxZoom(const fs::path& dir, std::string image_format,
 			int jpeg_quality = 85) const;
+	void increaseMaxZoom(TileArchive& archive, std::string image_format,
+			int jpeg_quality = 85) const;
 
 public:
 	RenderManager(const RenderOpts& opts);
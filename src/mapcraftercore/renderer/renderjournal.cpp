@@ -0,0 +1,200 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "renderjournal.h"
+
+#include "../config.h"
+#include "../util.h"
+
+#include <fstream>
+
+#ifdef HAVE_UNISTD_H
+#  include <unistd.h>
+#endif
+
+namespace mapcrafter {
+namespace renderer {
+
+// version of the journal format, increase it when the format changes
+const uint32_t RENDER_JOURNAL_VERSION = 3;
+const char RENDER_JOURNAL_MAGIC[4] = {'M', 'C', 'R', 'J'};
+
+// records: a required render tile, a finished tile (keys of the tile paths)
+// or a new image hash of a tile
+const char RENDER_JOURNAL_REQUIRED = 'R';
+const char RENDER_JOURNAL_FINISHED = 'F';
+const char RENDER_JOURNAL_HASH = 'H';
+
+template <typename T>
+bool writeJournalValue(std::FILE* file, T value) {
+	return std::fwrite(&value, sizeof(T), 1, file) == 1;
+}
+
+RenderJournal::RenderJournal()
+	: start_time(0), force_render(false), file(nullptr), sync(false) {
+}
+
+RenderJournal::~RenderJournal() {
+	if (file != nullptr)
+		std::fclose(file);
+}
+
+bool RenderJournal::read(const fs::path& filename, const std::string& key) {
+	required_tiles.clear();
+	finished_tiles.clear();
+	hashes.clear();
+	std::ifstream in(filename.string(), std::ios::binary);
+	if (!in)
+		return false;
+
+	if (!util::readBinaryHeader(in, RENDER_JOURNAL_MAGIC, RENDER_JOURNAL_VERSION, key))
+		return false;
+	start_time = util::readBinaryValue<int64_t>(in);
+	force_render = util::readBinaryValue<uint8_t>(in) != 0;
+	if (!in)
+		return false;
+
+	// the last record is incomplete if the rendering was interrupted while writing it
+	while (true) {
+		char type = util::readBinaryValue<char>(in);
+		uint64_t tile = util::readBinaryValue<uint64_t>(in);
+		uint64_t value = util::readBinaryValue<uint64_t>(in);
+		if (!in)
+			break;
+		if (type == RENDER_JOURNAL_REQUIRED)
+			required_tiles.push_back(TilePath::byKey(tile));
+		else if (type == RENDER_JOURNAL_FINISHED)
+			finished_tiles.insert(TilePath::byKey(tile));
+		else if (type == RENDER_JOURNAL_HASH)
+			hashes[tile] = value;
+		else {
+			LOG(WARNING) << "Render journal '" << filename.string() << "' is corrupt.";
+			break;
+		}
+	}
+	return true;
+}
+
+bool RenderJournal::open(const fs::path& filename, const std::string& key, bool sync) {
+	this->filename = filename;
+	this->sync = sync;
+
+	// an existing journal is only replaced by a complete one
+	bool ok = util::writeFileAtomically(filename, [&](std::ostream& out) {
+		util::writeBinaryHeader(out, RENDER_JOURNAL_MAGIC, RENDER_JOURNAL_VERSION, key);
+		util::writeBinaryValue<int64_t>(out, start_time);
+		util::writeBinaryValue<uint8_t>(out, force_render);
+		for (auto it = required_tiles.begin(); it != required_tiles.end(); ++it) {
+			util::writeBinaryValue<char>(out, RENDER_JOURNAL_REQUIRED);
+			util::writeBinaryValue<uint64_t>(out, it->getKey());
+			util::writeBinaryValue<uint64_t>(out, 0);
+		}
+		for (auto it = finished_tiles.begin(); it != finished_tiles.end(); ++it) {
+			util::writeBinaryValue<char>(out, RENDER_JOURNAL_FINISHED);
+			util::writeBinaryValue<uint64_t>(out, it->getKey());
+			util::writeBinaryValue<uint64_t>(out, 0);
+		}
+		for (auto it = hashes.begin(); it != hashes.end(); ++it) {
+			util::writeBinaryValue<char>(out, RENDER_JOURNAL_HASH);
+			util::writeBinaryValue<uint64_t>(out, it->first);
+			util::writeBinaryValue<uint64_t>(out, it->second);
+		}
+	});
+	if (!ok)
+		return false;
+
+	file = std::fopen(filename.string().c_str(), "ab");
+	return file != nullptr;
+}
+
+void RenderJournal::remove() {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	if (file != nullptr)
+		std::fclose(file);
+	file = nullptr;
+	boost::system::error_code error;
+	fs::remove(filename, error);
+}
+
+int64_t RenderJournal::getStartTime() const {
+	return start_time;
+}
+
+void RenderJournal::setStartTime(int64_t start_time) {
+	this->start_time = start_time;
+}
+
+bool RenderJournal::isForceRender() const {
+	return force_render;
+}
+
+void RenderJournal::setForceRender(bool force_render) {
+	this->force_render = force_render;
+}
+
+const std::vector<TilePath>& RenderJournal::getRequiredTiles() const {
+	return required_tiles;
+}
+
+void RenderJournal::setRequiredTiles(const std::vector<TilePath>& required_tiles) {
+	this->required_tiles = required_tiles;
+}
+
+const std::set<TilePath>& RenderJournal::getFinishedTiles() const {
+	return finished_tiles;
+}
+
+void RenderJournal::updateTileHashes(TileHashIndex& tile_hashes) const {
+	for (auto it = hashes.begin(); it != hashes.end(); ++it)
+		tile_hashes.setHash(TilePath::byKey(it->first), it->second);
+	tile_hashes.retainSubtrees(finished_tiles);
+}
+
+bool RenderJournal::addWork(const std::set<TilePath>& tiles,
+		const std::vector<std::pair<TilePath, uint64_t> >& tile_hashes) {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	if (file == nullptr)
+		return false;
+
+	// the hashes are written first, a tile is only finished with all its hashes
+	bool ok = true;
+	for (auto it = tile_hashes.begin(); ok && it != tile_hashes.end(); ++it) {
+		ok = writeRecord(RENDER_JOURNAL_HASH, it->first.getKey(), it->second);
+		hashes[it->first.getKey()] = it->second;
+	}
+	for (auto it = tiles.begin(); ok && it != tiles.end(); ++it) {
+		ok = writeRecord(RENDER_JOURNAL_FINISHED, it->getKey(), 0);
+		finished_tiles.insert(*it);
+	}
+	ok = std::fflush(file) == 0 && ok;
+#ifdef HAVE_UNISTD_H
+	if (ok && sync)
+		ok = fsync(fileno(file)) == 0;
+#endif
+	return ok;
+}
+
+bool RenderJournal::writeRecord(char type, uint64_t key, uint64_t value) {
+	return writeJournalValue<char>(file, type)
+			&& writeJournalValue<uint64_t>(file, key)
+			&& writeJournalValue<uint64_t>(file, value);
+}
+
+} /* namespace renderer */
+} /* namespace mapcrafter */
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RENDERJOURNAL_H_
+#define RENDERJOURNAL_H_
+
+#include "tileset.h"
+#include "../compat/thread.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace mapcrafter {
+namespace renderer {
+
+/**
+ * A log of the finished render works of a rendering of a map rotation, so a rendering
+ * which was interrupted (crash, killed process, power loss) can be continued later
+ * without rendering the already finished tiles again.
+ *
+ * The journal records the render tiles the rendering requires, the tiles whose subtrees
+ * are completely rendered and the new hashes of the tile images written by them. Every
+ * finished render work is appended to the journal file right away, an incomplete last
+ * record of an interrupted rendering is ignored. The journal file is removed when the
+ * rendering is finished.
+ *
+ * All methods except read and open can be used by multiple threads at once.
+ */
+class RenderJournal {
+public:
+	RenderJournal();
+	~RenderJournal();
+
+	/**
+	 * Reads the journal of an interrupted rendering. The key describes everything which
+	 * has an effect on the rendered tiles (map and world configuration, zoom level,
+	 * tile offset, ...), a journal with a different key is not used.
+	 */
+	bool read(const fs::path& filename, const std::string& key);
+
+	/**
+	 * Writes a new journal file with the already finished tiles and keeps it open to
+	 * append the render works of this rendering. If sync is set, the journal file is
+	 * synced to the disk after every render work.
+	 */
+	bool open(const fs::path& filename, const std::string& key, bool sync);
+
+	/**
+	 * Closes and removes the journal file, the rendering is finished.
+	 */
+	void remove();
+
+	/**
+	 * Time when the interrupted rendering was started and whether it force-rendered the
+	 * map rotation. The rendering continuing it renders the tiles required at that time.
+	 */
+	int64_t getStartTime() const;
+	void setStartTime(int64_t start_time);
+	bool isForceRender() const;
+	void setForceRender(bool force_render);
+
+	/**
+	 * Returns/sets the render tiles the interrupted rendering required. They are required
+	 * by the rendering continuing it even if their tile images were already written.
+	 */
+	const std::vector<TilePath>& getRequiredTiles() const;
+	void setRequiredTiles(const std::vector<TilePath>& required_tiles);
+
+	/**
+	 * Returns the tiles whose subtrees were completely rendered.
+	 */
+	const std::set<TilePath>& getFinishedTiles() const;
+
+	/**
+	 * Updates the hashes of the tile images of the last complete rendering with the
+	 * journal. Only the hashes in the finished subtrees are kept, the other tiles might
+	 * have been written by the interrupted rendering before it finished them.
+	 */
+	void updateTileHashes(TileHashIndex& tile_hashes) const;
+
+	/**
+	 * Appends a finished render work to the journal: The tiles of the render work and the
+	 * new hashes of the tile images it wrote.
+	 */
+	bool addWork(const std::set<TilePath>& tiles,
+			const std::vector<std::pair<TilePath, uint64_t> >& tile_hashes);
+
+private:
+	bool writeRecord(char type, uint64_t key, uint64_t value);
+
+	int64_t start_time;
+	bool force_render;
+
+	std::vector<TilePath> required_tiles;
+	std::set<TilePath> finished_tiles;
+	// the new image hashes by the keys of the tile paths
+	std::unordered_map<uint64_t, uint64_t> hashes;
+
+	fs::path filename;
+	std::FILE* file;
+	bool sync;
+
+	thread_ns::mutex mutex;
+};
+
+} /* namespace renderer */
+} /* namespace mapcrafter */
+
+#endif /* RENDERJOURNAL_H_ */
@@ -21,6 +21,8 @@
 
 #include "../../mc/world.h"
 
+#include <typeinfo>
+
 namespace mapcrafter {
 namespace renderer {
 
@@ -44,6 +46,10 @@ bool Rendermode::isHidden(const mc::BlockPos& pos, uint16_t id, uint16_t data) {
 void Rendermode::draw(RGBAImage& image, const mc::BlockPos& pos, uint16_t id, uint16_t data) {
 }
 
+int Rendermode::getChunkFields() const {
+	return 0;
+}
+
 bool createRendermode(const config::WorldSection& world_config,
 		const config::MapSection& map_config,
 		const RenderState& state, std::vector<std::shared_ptr<Rendermode>>& modes) {
@@ -67,5 +73,49 @@ bool createRendermode(const config::WorldSection& world_config,
 	return true;
 }
 
+DynamicRendermodePipeline::DynamicRendermodePipeline(
+		const std::vector<std::shared_ptr<Rendermode>>& modes)
+	: modes(modes) {
+}
+
+void DynamicRendermodePipeline::start() {
+	for (size_t i = 0; i < modes.size(); i++)
+		modes[i]->start();
+}
+
+void DynamicRendermodePipeline::end() {
+	for (size_t i = 0; i < modes.size(); i++)
+		modes[i]->end();
+}
+
+bool DynamicRendermodePipeline::isHidden(const mc::BlockPos& pos,
+		uint16_t id, uint16_t data) {
+	for (size_t i = 0; i < modes.size(); i++)
+		if (modes[i]->isHidden(pos, id, data))
+			return true;
+	return false;
+}
+
+void DynamicRendermodePipeline::draw(RGBAImage& image, const mc::BlockPos& pos,
+		uint16_t id, uint16_t data) {
+	for (size_t i = 0; i < modes.size(); i++)
+		modes[i]->draw(image, pos, id, data);
+}
+
+/**
+ * Returns the type of the static pipeline for some rendermodes. The rendermodes need
+ * to have exactly the types of the pipeline, otherwise the dynamic pipeline is used.
+ */
+RendermodePipelineType getRendermodePipelineType(
+		const std::vector<std::shared_ptr<Rendermode>>& modes) {
+	if (modes.empty())
+		return RendermodePipelineType::PLAIN;
+	if (modes.size() == 1 && typeid(*modes[0]) == typeid(CaveRendermode))
+		return RendermodePipelineType::CAVE;
+	if (modes.size() == 1 && typeid(*modes[0]) == typeid(LightingRendermode))
+		return RendermodePipelineType::LIGHTING;
+	return RendermodePipelineType::DYNAMIC;
+}
+
 } /* namespace render */
 } /* namespace mapcrafter */
@@ -51,12 +51,100 @@ public:
 	virtual bool isHidden(const mc::BlockPos& pos, uint16_t id, uint16_t data);
 	// is called to allow the rendermode to change a block image
 	virtual void draw(RGBAImage& image, const mc::BlockPos& pos, uint16_t id, uint16_t data);
+
+	// returns which chunk data the rendermode needs (mc::GET_* flags)
+	virtual int getChunkFields() const;
 };
 
 bool createRendermode(const config::WorldSection& world_config,
 		const config::MapSection& map_config,
 		const RenderState& state, std::vector<std::shared_ptr<Rendermode>>& modes);
 
+/**
+ * The rendermode pipelines call the hooks of the rendermodes of a map for the tile
+ * renderer.
+ *
+ * A static pipeline knows the exact types of its rendermodes and calls their hooks
+ * directly (without virtual calls), so the compiler can inline them into the tile
+ * renderer. There are static pipelines for the rendermode combinations which are used
+ * by the maps, every other combination of rendermodes uses the dynamic pipeline.
+ */
+template <typename... Modes>
+class RendermodePipeline;
+
+template <>
+class RendermodePipeline<> {
+public:
+	RendermodePipeline(const std::vector<std::shared_ptr<Rendermode>>& modes,
+			size_t index = 0) {}
+
+	void start() {}
+	void end() {}
+
+	bool isHidden(const mc::BlockPos& pos, uint16_t id, uint16_t data) {
+		return false;
+	}
+	void draw(RGBAImage& image, const mc::BlockPos& pos, uint16_t id, uint16_t data) {}
+};
+
+template <typename Mode, typename... Modes>
+class RendermodePipeline<Mode, Modes...> {
+public:
+	RendermodePipeline(const std::vector<std::shared_ptr<Rendermode>>& modes,
+			size_t index = 0)
+		: mode(static_cast<Mode*>(modes[index].get())), next(modes, index + 1) {}
+
+	void start() {
+		mode->Mode::start();
+		next.start();
+	}
+
+	void end() {
+		mode->Mode::end();
+		next.end();
+	}
+
+	bool isHidden(const mc::BlockPos& pos, uint16_t id, uint16_t data) {
+		return mode->Mode::isHidden(pos, id, data) || next.isHidden(pos, id, data);
+	}
+
+	void draw(RGBAImage& image, const mc::BlockPos& pos, uint16_t id, uint16_t data) {
+		mode->Mode::draw(image, pos, id, data);
+		next.draw(image, pos, id, data);
+	}
+
+private:
+	Mode* mode;
+	RendermodePipeline<Modes...> next;
+};
+
+/**
+ * Calls the hooks of any rendermodes with virtual calls.
+ */
+class DynamicRendermodePipeline {
+public:
+	DynamicRendermodePipeline(const std::vector<std::shared_ptr<Rendermode>>& modes);
+
+	void start();
+	void end();
+
+	bool isHidden(const mc::BlockPos& pos, uint16_t id, uint16_t data);
+	void draw(RGBAImage& image, const mc::BlockPos& pos, uint16_t id, uint16_t data);
+
+private:
+	const std::vector<std::shared_ptr<Rendermode>>& modes;
+};
+
+enum class RendermodePipelineType {
+	DYNAMIC,
+	PLAIN,
+	CAVE,
+	LIGHTING
+};
+
+RendermodePipelineType getRendermodePipelineType(
+		const std::vector<std::shared_ptr<Rendermode>>& modes);
+
 } /* namespace render */
 } /* namespace mapcrafter */
 
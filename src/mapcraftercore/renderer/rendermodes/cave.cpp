@@ -19,9 +19,16 @@
 
 #include "cave.h"
 
+#include <algorithm>
+
 namespace mapcrafter {
 namespace renderer {
 
+// flags of the blocks used to calculate the cave masks
+const uint8_t CAVE_SKY_LIGHT = 1;
+const uint8_t CAVE_TRANSPARENT = 2;
+const uint8_t CAVE_WATER = 4;
+
 CaveRendermode::CaveRendermode(const RenderState& state, bool high_contrast)
 	: Rendermode(state), high_contrast(high_contrast) {
 }
@@ -37,7 +44,11 @@ bool CaveRendermode::isTransparentBlock(const mc::Block& block) const {
 	return block.id == 0 || state.images->isBlockTransparent(block.id, block.data);
 }
 
-bool CaveRendermode::isHidden(const mc::BlockPos& pos, uint16_t id, uint16_t data) {
+/**
+ * Checks if a block is hidden by querying the neighbor blocks. Used for blocks which
+ * are not part of the cave masks.
+ */
+bool CaveRendermode::isHiddenBlock(const mc::BlockPos& pos, uint16_t id, uint16_t data) {
 	mc::BlockPos directions[6] = {
 			mc::DIR_NORTH, mc::DIR_SOUTH, mc::DIR_EAST, mc::DIR_WEST,
 			mc::DIR_TOP, mc::DIR_BOTTOM
@@ -84,6 +95,105 @@ bool CaveRendermode::isHidden(const mc::BlockPos& pos, uint16_t id, uint16_t dat
 	return true;
 }
 
+/**
+ * Calculates the cave visibility of all blocks of a chunk. This does the same checks as
+ * isHiddenBlock, but with the block flags of the chunk and of the adjacent blocks of
+ * the neighbor chunks, which are read only once for every block.
+ */
+void CaveRendermode::calculateCaveMask(const mc::ChunkPos& chunk_pos, ChunkCaveMask& mask) {
+	// the blocks are stored with one adjacent block on every side
+	// (x/z -1 ... 16 and y -1 ... 256)
+	block_flags.resize(18 * 18 * 258);
+	auto index = [](int x, int z, int y) {
+		return ((y + 1) * 18 + (z + 1)) * 18 + (x + 1);
+	};
+
+	// blocks of not existing chunks or out of the world are air with sky light
+	std::fill(block_flags.begin(), block_flags.end(), CAVE_SKY_LIGHT | CAVE_TRANSPARENT);
+
+	mc::BlockPos directions[5] = {
+			mc::BlockPos(0, 0, 0),
+			mc::DIR_NORTH, mc::DIR_SOUTH, mc::DIR_EAST, mc::DIR_WEST
+	};
+	for (int i = 0; i < 5; i++) {
+		mc::ChunkPos other_pos(chunk_pos.x + directions[i].x, chunk_pos.z + directions[i].z);
+		const mc::Chunk* chunk = state.world->getChunk(other_pos);
+		if (chunk == nullptr)
+			continue;
+		// of the neighbor chunks we need only the blocks next to the chunk
+		int x1 = 0, x2 = 15, z1 = 0, z2 = 15;
+		if (directions[i].x != 0)
+			x1 = x2 = directions[i].x < 0 ? 15 : 0;
+		if (directions[i].z != 0)
+			z1 = z2 = directions[i].z < 0 ? 15 : 0;
+		for (int x = x1; x <= x2; x++)
+			for (int z = z1; z <= z2; z++)
+				for (int y = 0; y < 256; y++) {
+					mc::LocalBlockPos local(x, z, y);
+					uint16_t id = chunk->getBlockID(local);
+					uint8_t flags = 0;
+					if (chunk->getSkyLight(local) > 0)
+						flags |= CAVE_SKY_LIGHT;
+					if (id == 0 || state.images->isBlockTransparent(id,
+							chunk->getBlockData(local)))
+						flags |= CAVE_TRANSPARENT;
+					if (id == 8 || id == 9)
+						flags |= CAVE_WATER;
+					block_flags[index(x + directions[i].x * 16,
+							z + directions[i].z * 16, y)] = flags;
+				}
+	}
+
+	std::fill(mask.hidden, mask.hidden + 16 * 16 * 256 / 32, 0);
+	for (int x = 0; x < 16; x++)
+		for (int z = 0; z < 16; z++) {
+			// whether the surface of the water above a block has sky light,
+			// the surface is the first block above which is not water
+			bool water_surface_light = true;
+			for (int y = 255; y >= 0; y--) {
+				uint8_t top = block_flags[index(x, z, y + 1)];
+				if (!(top & CAVE_WATER))
+					water_surface_light = top & CAVE_SKY_LIGHT;
+
+				uint8_t flags = block_flags[index(x, z, y)];
+				uint8_t south = block_flags[index(x, z + 1, y)];
+				uint8_t west = block_flags[index(x - 1, z, y)];
+
+				bool hidden = (top | block_flags[index(x, z, y - 1)]
+						| south | block_flags[index(x, z - 1, y)]
+						| west | block_flags[index(x + 1, z, y)]) & CAVE_SKY_LIGHT;
+				if (!hidden && ((flags | top) & CAVE_WATER))
+					hidden = water_surface_light;
+				if (!hidden)
+					hidden = !((top | south | west) & CAVE_TRANSPARENT);
+
+				if (hidden) {
+					int offset = (y * 16 + z) * 16 + x;
+					mask.hidden[offset / 32] |= 1u << (offset % 32);
+				}
+			}
+		}
+}
+
+/**
+ * Checks if a block is hidden with the cave mask of its chunk. The mask is calculated
+ * for the blocks of the chunk, the supplied id is expected to be the id of the block.
+ */
+bool CaveRendermode::isHidden(const mc::BlockPos& pos, uint16_t id, uint16_t data) {
+	if (pos.y < 0 || pos.y >= 256)
+		return isHiddenBlock(pos, id, data);
+
+	mc::ChunkPos chunk_pos(pos);
+	bool cached;
+	ChunkCaveMask& mask = cave_masks.get(chunk_pos, cached);
+	if (!cached)
+		calculateCaveMask(chunk_pos, mask);
+
+	mc::LocalBlockPos local(pos);
+	int offset = (local.y * 16 + local.z) * 16 + local.x;
+	return mask.hidden[offset / 32] & (1u << (offset % 32));
+}
+
 void CaveRendermode::draw(RGBAImage& image, const mc::BlockPos& pos,
 		uint16_t id, uint16_t data) {
 	// a nice color gradient to see something
@@ -144,5 +254,9 @@ void CaveRendermode::draw(RGBAImage& image, const mc::BlockPos& pos,
 	}
 }
 
+int CaveRendermode::getChunkFields() const {
+	return mc::GET_ID | mc::GET_DATA | mc::GET_SKY_LIGHT;
+}
+
 } /* namespace render */
 } /* namespace mapcrafter */
@@ -22,9 +22,21 @@
 
 #include "base.h"
 
+#include <vector>
+
 namespace mapcrafter {
 namespace renderer {
 
+// bits of the chunk coordinates to calculate the position of a cave mask in the cache
+const int CAVE_CACHE_BITS = 4;
+
+/**
+ * The cave visibility of all blocks of a chunk, a bit is set if the block is hidden.
+ */
+struct ChunkCaveMask {
+	uint32_t hidden[16 * 16 * 256 / 32];
+};
+
 class CaveRendermode: public Rendermode {
 public:
 	CaveRendermode(const RenderState& state, bool high_contrast);
@@ -35,11 +47,22 @@ public:
 	virtual void draw(RGBAImage& image, const mc::BlockPos& pos,
 			uint16_t id, uint16_t data);
 
+	virtual int getChunkFields() const;
+
 protected:
 	bool isLight(const mc::BlockPos& pos);
 	bool isTransparentBlock(const mc::Block& block) const;
+	bool isHiddenBlock(const mc::BlockPos& pos, uint16_t id, uint16_t data);
+
+	void calculateCaveMask(const mc::ChunkPos& chunk_pos, ChunkCaveMask& mask);
 
 	bool high_contrast;
+
+	// cave visibility of the chunks, calculated once for every chunk
+	mc::ChunkDataCache<ChunkCaveMask, CAVE_CACHE_BITS> cave_masks;
+	// flags of the blocks of a chunk and the adjacent blocks,
+	// used to calculate the cave masks
+	std::vector<uint8_t> block_flags;
 };
 
 } /* namespace render */
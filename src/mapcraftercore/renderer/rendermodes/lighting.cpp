@@ -22,7 +22,11 @@
 #include "../blockimages.h"
 #include "../../util.h"
 
+#include <algorithm>
 #include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace mapcrafter {
 namespace renderer {
@@ -82,7 +86,7 @@ FaceCorners::FaceCorners(const CornerNeighbors& corner1)
  * Draws the bottom triangle.
  * This is the triangle with corners top left, bottom left and bottom right.
  */
-void drawBottomTriangle(RGBAImage& image, int size, double c1, double c2,
+void drawBottomTriangle(std::vector<double>& shade, int size, double c1, double c2,
 		double c3) {
 	double e1diff = c2 - c1;
 	double e2diff = c3 - c1;
@@ -101,7 +105,7 @@ void drawBottomTriangle(RGBAImage& image, int size, double c1, double c2,
 		for (int x = 0; x <= y; x++, fx+=fxStep) {
 			double color = color1 + colordiff*fx;
 			//color += (1-color)*(1-LIGHTNING_INTENSITY);
-			image.pixel(x, y) = rgba(0, 0, 0, color * 255);
+			shade[y * size + x] = color;
 		}
 	}
 }
@@ -110,7 +114,8 @@ void drawBottomTriangle(RGBAImage& image, int size, double c1, double c2,
  * Draws the top triangle.
  * This is the triangle with corners top left, top right and bottom right.
  */
-void drawTopTriangle(RGBAImage& image, int size, double c1, double c2, double c3) {
+void drawTopTriangle(std::vector<double>& shade, int size, double c1, double c2,
+		double c3) {
 	double e1diff = c2 - c1;
 	double e2diff = c3 - c1;
 	double fy = 0;
@@ -128,15 +133,159 @@ void drawTopTriangle(RGBAImage& image, int size, double c1, double c2, double c3
 		for (int x = 0; x <= y; x++, fx+=fxStep) {
 			double color = color1 + colordiff*fx;
 			//color += (1-color)*(1-LIGHTNING_INTENSITY);
-			image.pixel(size-1-x, size-1-y) = rgba(0, 0, 0, color * 255);
+			shade[(size-1-y) * size + size-1-x] = color;
 		}
 	}
 }
 
+FaceShader::FaceShader(int size)
+	: size(size) {
+	if (size == 0)
+		return;
+
+	// the shade is linear in the corner colors,
+	// so we draw the shade of every single corner to get the weights of the corners
+	std::vector<double> corner_shades[4];
+	for (int i = 0; i < 4; i++) {
+		CornerColors corners = {{0, 0, 0, 0}};
+		corners[i] = 1;
+		corner_shades[i].resize(size * size);
+		drawBottomTriangle(corner_shades[i], size, corners[0], corners[2], corners[3]);
+		drawTopTriangle(corner_shades[i], size, corners[3], corners[1], corners[0]);
+	}
+
+	for (int face = LEFT; face <= TOP; face++) {
+		weights[face].resize(size * size * 4);
+		dest_x[face].resize(size * size);
+		dest_y[face].resize(size * size);
+	}
+
+	auto addPixel = [&](int face, int src_x, int src_y, int x, int y) {
+		int index = src_y * size + src_x;
+		int16_t* w = &weights[face][index * 4];
+		int sum = 0, max = 0;
+		for (int i = 0; i < 4; i++) {
+			w[i] = corner_shades[i][index] * 16384 + 0.5;
+			sum += w[i];
+			if (w[i] > w[max])
+				max = i;
+		}
+		// the weights should sum up to exactly 1.0
+		w[max] += 16384 - sum;
+		dest_x[face][index] = x;
+		dest_y[face][index] = y;
+	};
+
+	for (SideFaceIterator it(size, SideFaceIterator::LEFT); !it.end(); it.next())
+		addPixel(LEFT, it.src_x, it.src_y, it.dest_x, it.dest_y + size/2);
+	for (SideFaceIterator it(size, SideFaceIterator::RIGHT); !it.end(); it.next())
+		addPixel(RIGHT, it.src_x, it.src_y, it.dest_x + size, it.dest_y + size/2);
+	for (TopFaceIterator it(size); !it.end(); it.next())
+		addPixel(TOP, it.src_x, it.src_y, it.dest_x, it.dest_y);
+}
+
+FaceShader::~FaceShader() {
+}
+
+int FaceShader::getSize() const {
+	return size;
+}
+
+/**
+ * Shades a face of a block image. The corner colors are quantized to one byte each.
+ *
+ * Only the rows ystart to yend (inclusive, -1 is the last row) of the face texture are
+ * shaded, the y-offset moves the shaded face in the block image.
+ */
+void FaceShader::shade(RGBAImage& image, int face, const CornerColors& corners,
+		int yoff, int ystart, int yend) const {
+	if (yend < 0 || yend >= size)
+		yend = size - 1;
+	if (ystart < 0)
+		ystart = 0;
+	if (size == 0 || ystart > yend)
+		return;
+
+	int16_t c[4];
+	for (int i = 0; i < 4; i++)
+		c[i] = std::min(std::max(corners[i], 0.0), 1.0) * 255 + 0.5;
+
+	const int16_t* w = &weights[face][0];
+	const int* xs = &dest_x[face][0];
+	const int* ys = &dest_y[face][0];
+	RGBAPixel* data = &image.pixel(0, 0);
+	int width = image.getWidth();
+
+	int i = ystart * size;
+	int end = (yend + 1) * size;
+#ifdef __SSE2__
+	const __m128i colors = _mm_setr_epi16(c[0], c[1], c[2], c[3], c[0], c[1], c[2], c[3]);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i alpha_mask = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+	const __m128i alpha = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+	// shade four pixels at once
+	for (; i + 4 <= end; i += 4) {
+		// the weighted sums of the corner colors are the shades of the pixels
+		__m128i sums01 = _mm_madd_epi16(
+				_mm_loadu_si128((const __m128i*) (w + i*4)), colors);
+		__m128i sums23 = _mm_madd_epi16(
+				_mm_loadu_si128((const __m128i*) (w + i*4 + 8)), colors);
+		sums01 = _mm_shuffle_epi32(sums01, _MM_SHUFFLE(3, 1, 2, 0));
+		sums23 = _mm_shuffle_epi32(sums23, _MM_SHUFFLE(3, 1, 2, 0));
+		__m128i shades = _mm_add_epi32(_mm_unpacklo_epi64(sums01, sums23),
+				_mm_unpackhi_epi64(sums01, sums23));
+		shades = _mm_srli_epi32(shades, 14);
+
+		// spread the shades to the color channels of the pixels,
+		// the alpha channel is multiplied with 255
+		shades = _mm_packs_epi32(shades, shades);
+		shades = _mm_unpacklo_epi16(shades, shades);
+		__m128i shades01 = _mm_unpacklo_epi32(shades, shades);
+		__m128i shades23 = _mm_unpackhi_epi32(shades, shades);
+		shades01 = _mm_or_si128(_mm_andnot_si128(alpha_mask, shades01), alpha);
+		shades23 = _mm_or_si128(_mm_andnot_si128(alpha_mask, shades23), alpha);
+
+		int offsets[4];
+		for (int j = 0; j < 4; j++)
+			offsets[j] = (ys[i + j] + yoff) * width + xs[i + j];
+		__m128i pixels = _mm_setr_epi32(data[offsets[0]], data[offsets[1]],
+				data[offsets[2]], data[offsets[3]]);
+
+		// multiply the channels with the shades and divide them by 255,
+		// x / 255 = (x + 1 + (x >> 8)) >> 8 for 0 <= x <= 255*255
+		__m128i pixels01 = _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), shades01);
+		__m128i pixels23 = _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), shades23);
+		pixels01 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pixels01, one),
+				_mm_srli_epi16(pixels01, 8)), 8);
+		pixels23 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pixels23, one),
+				_mm_srli_epi16(pixels23, 8)), 8);
+		pixels = _mm_packus_epi16(pixels01, pixels23);
+
+		RGBAPixel result[4];
+		_mm_storeu_si128((__m128i*) result, pixels);
+		for (int j = 0; j < 4; j++)
+			data[offsets[j]] = result[j];
+	}
+#endif
+	for (; i < end; i++) {
+		const int16_t* wi = w + i*4;
+		uint8_t d = (wi[0]*c[0] + wi[1]*c[1] + wi[2]*c[2] + wi[3]*c[3]) >> 14;
+		RGBAPixel& pixel = data[(ys[i] + yoff) * width + xs[i]];
+		pixel = rgba_multiply(pixel, d, d, d);
+	}
+}
+
 LightingRendermode::LightingRendermode(const RenderState& state, bool day,
 		double lighting_intensity, bool dimension_end)
 	: Rendermode(state), day(day), lighting_intensity(lighting_intensity),
 	  dimension_end(dimension_end) {
+	for (uint8_t block_light = 0; block_light < 16; block_light++)
+		for (uint8_t sky_light = 0; sky_light < 16; sky_light++) {
+			LightingColor color = calculateLightingColor(block_light, sky_light);
+			lighting_colors[block_light][sky_light] =
+					color + (1-color)*(1-lighting_intensity);
+		}
 }
 
 LightingRendermode::~LightingRendermode() {
@@ -144,13 +293,12 @@ LightingRendermode::~LightingRendermode() {
 }
 
 /**
- * Draws the shade of the corners by drawing two triangles with the supplied colors.
+ * Returns the face shader for the texture size of the block images.
  */
-void LightingRendermode::createShade(RGBAImage& image,
-		const CornerColors& corners) const {
-	int size = image.getWidth();
-	drawBottomTriangle(image, size, corners[0], corners[2], corners[3]);
-	drawTopTriangle(image, size, corners[3], corners[1], corners[0]);
+const FaceShader& LightingRendermode::getShader(int size) {
+	if (shader.getSize() != size)
+		shader = FaceShader(size);
+	return shader;
 }
 
 /**
@@ -234,10 +382,10 @@ void LightingRendermode::estimateBlockLight(mc::Block& block,
 }
 
 /**
- * Returns the light of a block (sky/block light). This also means that the light is
+ * Calculates the light of a block (sky/block light). This also means that the light is
  * estimated if this is a special transparent block.
  */
-LightingData LightingRendermode::getBlockLight(const mc::BlockPos& pos) {
+LightingData LightingRendermode::calculateBlockLight(const mc::BlockPos& pos) {
 	mc::Block block = state.getBlock(pos, mc::GET_ID | mc::GET_DATA | mc::GET_LIGHT);
 	if (isSpecialTransparent(block.id))
 		estimateBlockLight(block, pos);
@@ -257,13 +405,39 @@ LightingData LightingRendermode::getBlockLight(const mc::BlockPos& pos) {
 	return light;
 }
 
+/**
+ * Returns the light of a block from the light volume of its chunk. The light is
+ * calculated if it is needed the first time.
+ */
+LightingData LightingRendermode::getBlockLight(const mc::BlockPos& pos) {
+	// the light volumes contain only the blocks with valid y coordinates
+	if (pos.y < 0 || pos.y >= 256)
+		return calculateBlockLight(pos);
+
+	bool cached;
+	ChunkLightVolume& volume = light_volumes.get(mc::ChunkPos(pos), cached);
+	if (!cached)
+		std::fill(volume.light, volume.light + 16 * 16 * 256, LIGHT_UNKNOWN);
+
+	mc::LocalBlockPos local(pos);
+	uint16_t& light = volume.light[(local.y * 16 + local.z) * 16 + local.x];
+	LightingData data;
+	if (light == LIGHT_UNKNOWN) {
+		data = calculateBlockLight(pos);
+		light = data.block | (data.sky << 4);
+	} else {
+		data.block = light & 15;
+		data.sky = light >> 4;
+	}
+	return data;
+}
+
 /**
  * Returns the lighting color of a block.
  */
 LightingColor LightingRendermode::getLightingColor(const mc::BlockPos& pos) {
 	LightingData lighting = getBlockLight(pos);
-	LightingColor color = calculateLightingColor(lighting.block, lighting.sky);
-	return color + (1-color)*(1-lighting_intensity);
+	return lighting_colors[lighting.block & 15][lighting.sky & 15];
 }
 
 /**
@@ -298,68 +472,26 @@ CornerColors LightingRendermode::getCornerColors(const mc::BlockPos& pos,
  * Adds smooth lighting to the left face of a block image.
  */
 void LightingRendermode::lightLeft(RGBAImage& image, const CornerColors& colors) {
-	int size = image.getWidth() / 2;
-	RGBAImage tex(size, size);
-	createShade(tex, colors);
-
-	for (SideFaceIterator it(size, SideFaceIterator::LEFT); !it.end(); it.next()) {
-		uint32_t& pixel = image.pixel(it.dest_x, it.dest_y + size/2);
-		if (pixel != 0) {
-			uint8_t d = rgba_alpha(tex.pixel(it.src_x, it.src_y));
-			pixel = rgba_multiply(pixel, d, d, d);
-		}
-	}
+	getShader(image.getWidth() / 2).shade(image, FaceShader::LEFT, colors);
 }
 
 void LightingRendermode::lightLeft(RGBAImage& image, const CornerColors& colors,
 		int ystart, int yend) {
-	int size = image.getWidth() / 2;
-	RGBAImage tex(size, size);
-	createShade(tex, colors);
-
-	for (SideFaceIterator it(size, SideFaceIterator::LEFT); !it.end(); it.next()) {
-		if (it.src_y < ystart || it.src_y > yend)
-			continue;
-		uint32_t& pixel = image.pixel(it.dest_x, it.dest_y + size/2);
-		if (pixel != 0) {
-			uint8_t d = rgba_alpha(tex.pixel(it.src_x, it.src_y));
-			pixel = rgba_multiply(pixel, d, d, d);
-		}
-	}
+	getShader(image.getWidth() / 2).shade(image, FaceShader::LEFT, colors,
+			0, ystart, yend);
 }
 
 /**
  * Adds smooth lighting to the right face of a block image.
  */
 void LightingRendermode::lightRight(RGBAImage& image, const CornerColors& colors) {
-	int size = image.getWidth() / 2;
-	RGBAImage tex(size, size);
-	createShade(tex, colors);
-
-	for (SideFaceIterator it(size, SideFaceIterator::RIGHT); !it.end(); it.next()) {
-		uint32_t& pixel = image.pixel(it.dest_x + size, it.dest_y + size/2);
-		if (pixel != 0) {
-			uint8_t d = rgba_alpha(tex.pixel(it.src_x, it.src_y));
-			pixel = rgba_multiply(pixel, d, d, d);
-		}
-	}
+	getShader(image.getWidth() / 2).shade(image, FaceShader::RIGHT, colors);
 }
 
 void LightingRendermode::lightRight(RGBAImage& image, const CornerColors& colors,
 		int ystart, int yend) {
-	int size = image.getWidth() / 2;
-	RGBAImage tex(size, size);
-	createShade(tex, colors);
-
-	for (SideFaceIterator it(size, SideFaceIterator::RIGHT); !it.end(); it.next()) {
-		if (it.src_y < ystart || it.src_y > yend)
-			continue;
-		uint32_t& pixel = image.pixel(it.dest_x + size, it.dest_y + size/2);
-		if (pixel != 0) {
-			uint8_t d = rgba_alpha(tex.pixel(it.src_x, it.src_y));
-			pixel = rgba_multiply(pixel, d, d, d);
-		}
-	}
+	getShader(image.getWidth() / 2).shade(image, FaceShader::RIGHT, colors,
+			0, ystart, yend);
 }
 
 /**
@@ -367,19 +499,9 @@ void LightingRendermode::lightRight(RGBAImage& image, const CornerColors& colors
  */
 void LightingRendermode::lightTop(RGBAImage& image, const CornerColors& colors,
 		int yoff) {
-	int size = image.getWidth() / 2;
-	RGBAImage tex(size, size);
 	// we need to rotate the corners a bit to make them suitable for the TopFaceIterator
 	CornerColors rotated = {{colors[1], colors[3], colors[0], colors[2]}};
-	createShade(tex, rotated);
-
-	for (TopFaceIterator it(size); !it.end(); it.next()) {
-		uint32_t& pixel = image.pixel(it.dest_x, it.dest_y + yoff);
-		if (pixel != 0) {
-			uint8_t d = rgba_alpha(tex.pixel(it.src_x, it.src_y));
-			pixel = rgba_multiply(pixel, d, d, d);
-		}
-	}
+	getShader(image.getWidth() / 2).shade(image, FaceShader::TOP, rotated, yoff);
 }
 
 /**
@@ -511,5 +633,9 @@ void LightingRendermode::draw(RGBAImage& image, const mc::BlockPos& pos,
 	}
 }
 
+int LightingRendermode::getChunkFields() const {
+	return mc::GET_ID | mc::GET_DATA | mc::GET_LIGHT;
+}
+
 } /* namespace render */
 } /* namespace mapcrafter */
@@ -23,6 +23,7 @@
 #include "base.h"
 
 #include <array>
+#include <vector>
 
 namespace mapcrafter {
 namespace renderer {
@@ -78,16 +79,72 @@ typedef double LightingColor;
 // - defined as array with corners top left / top right / bottom left / bottom right
 typedef std::array<LightingColor, 4> CornerColors;
 
+// bits of the chunk coordinates to calculate the position of a light volume in the cache
+const int LIGHT_CACHE_BITS = 3;
+// light volume entry of a block whose light is not calculated yet
+const uint16_t LIGHT_UNKNOWN = 0xffff;
+
+/**
+ * The effective light values (block light | sky light << 4) of all blocks of a chunk.
+ * The light of a block is calculated the first time it is needed, until then it is
+ * LIGHT_UNKNOWN.
+ */
+struct ChunkLightVolume {
+	uint16_t light[16 * 16 * 256];
+};
+
+/**
+ * Applies the smooth lighting shade of the corner colors directly to the pixels of a
+ * block face. The shade of a face pixel is interpolated from the corner colors like two
+ * triangles were drawn between them. The interpolation weights of the corners are
+ * calculated once for every face pixel (as 14 bit fixed-point numbers), so shading a face
+ * is just one pass over its pixels without any allocations.
+ */
+class FaceShader {
+public:
+	FaceShader(int size = 0);
+	~FaceShader();
+
+	int getSize() const;
+
+	void shade(RGBAImage& image, int face, const CornerColors& corners,
+			int yoff = 0, int ystart = 0, int yend = -1) const;
+
+	static const int LEFT = 0;
+	static const int RIGHT = 1;
+	static const int TOP = 2;
+
+private:
+	// size of the face textures
+	int size;
+
+	// pixels of each face type, ordered by the rows of the face texture
+	// - weights of the four corners (four per pixel)
+	// - position of the pixels in the block image
+	std::vector<int16_t> weights[3];
+	std::vector<int> dest_x[3], dest_y[3];
+};
+
 class LightingRendermode : public Rendermode {
 private:
 	bool day;
 	double lighting_intensity;
 	bool dimension_end;
 
-	void createShade(RGBAImage& image, const CornerColors& corners) const;
-	
+	// light volumes of the chunks, so the light of every block is calculated only once
+	mc::ChunkDataCache<ChunkLightVolume, LIGHT_CACHE_BITS> light_volumes;
+
+	// lighting colors (with lighting intensity) of all block/sky light combinations
+	LightingColor lighting_colors[16][16];
+
+	// shader to apply the shades to the block faces, created for the texture size
+	FaceShader shader;
+
+	const FaceShader& getShader(int size);
+
 	LightingColor calculateLightingColor(uint8_t block_light, uint8_t sky_light) const;
 	void estimateBlockLight(mc::Block& block, const mc::BlockPos& pos);
+	LightingData calculateBlockLight(const mc::BlockPos& pos);
 	LightingData getBlockLight(const mc::BlockPos& pos);
 
 	LightingColor getLightingColor(const mc::BlockPos& pos);
@@ -120,6 +177,8 @@ public:
 			uint16_t id, uint16_t data);
 	virtual void draw(RGBAImage& image, const mc::BlockPos& pos,
 			uint16_t id, uint16_t data);
+
+	virtual int getChunkFields() const;
 };
 
 } /* namespace render */
@@ -0,0 +1,621 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tilearchive.h"
+
+#include "../util.h"
+
+#include <algorithm>
+#include <ctime>
+
+#ifdef HAVE_UNISTD_H
+#  include <fcntl.h>
+#  include <sys/file.h>
+#  include <unistd.h>
+#endif
+
+namespace mapcrafter {
+namespace renderer {
+
+// version of the archive and index format, increase it when the format changes
+const uint32_t TILE_ARCHIVE_VERSION = 1;
+const uint32_t TILE_ARCHIVE_INDEX_VERSION = 2;
+const char TILE_ARCHIVE_MAGIC[4] = {'M', 'C', 'T', 'A'};
+const char TILE_ARCHIVE_INDEX_MAGIC[4] = {'M', 'C', 'T', 'X'};
+
+// size of the archive header (magic, version)
+const uint64_t TILE_ARCHIVE_HEADER_SIZE = 4 + 4;
+// size of the header of every tile image (tile path key, modification time, size),
+// a header with size 0 and without image removes the tile
+const uint64_t TILE_ARCHIVE_TILE_HEADER_SIZE = 8 + 8 + 4;
+// size of the index header (magic, version, indexed size, wasted size, count of tiles)
+// and of every entry (tile path key, offset, size, modification time)
+const uint64_t TILE_ARCHIVE_INDEX_HEADER_SIZE = 4 + 4 + 8 + 8 + 8;
+const uint64_t TILE_ARCHIVE_INDEX_ENTRY_SIZE = 8 + 8 + 4 + 8;
+
+TileArchive::TileArchive()
+	: read_only(false), size(0), wasted_size(0), flushed_size(0),
+#ifdef HAVE_UNISTD_H
+	  lock_fd(-1), read_fd(-1),
+#endif
+	  reading(0) {
+}
+
+TileArchive::~TileArchive() {
+	if (isOpen())
+		close();
+	unlockArchive();
+}
+
+bool TileArchive::open(const fs::path& filename, bool read_only) {
+	this->filename = filename;
+	this->read_only = read_only;
+	entries.clear();
+	size = TILE_ARCHIVE_HEADER_SIZE;
+	wasted_size = 0;
+
+	if (!fs::exists(filename) && read_only) {
+		LOG(ERROR) << "Tile archive '" << filename.string() << "' does not exist.";
+		return false;
+	}
+	if (!read_only) {
+		if (filename.has_parent_path() && !fs::exists(filename.parent_path()))
+			fs::create_directories(filename.parent_path());
+		if (!lockArchive())
+			return false;
+	}
+	if (!fs::exists(filename)) {
+		std::ofstream out(filename.string(), std::ios::binary);
+		util::writeBinaryHeader(out, TILE_ARCHIVE_MAGIC, TILE_ARCHIVE_VERSION);
+		if (!out) {
+			LOG(ERROR) << "Unable to create tile archive '" << filename.string() << "'.";
+			return false;
+		}
+	}
+
+	uint64_t file_size = fs::file_size(filename);
+	std::ifstream in(filename.string(), std::ios::binary);
+	if (!util::readBinaryHeader(in, TILE_ARCHIVE_MAGIC, TILE_ARCHIVE_VERSION)) {
+		LOG(ERROR) << "'" << filename.string() << "' is not a tile archive of this version.";
+		return false;
+	}
+
+	// take the tiles from the index and find the tiles appended after it was written
+	uint64_t indexed_size;
+	if (!readIndex(indexed_size) || indexed_size > file_size) {
+		entries.clear();
+		wasted_size = 0;
+		indexed_size = TILE_ARCHIVE_HEADER_SIZE;
+	}
+	size = scanTiles(in, indexed_size, file_size, [&](uint64_t key, const Entry& entry) {
+		auto it = entries.find(key);
+		if (it != entries.end())
+			wasted_size += TILE_ARCHIVE_TILE_HEADER_SIZE + it->second.size;
+		if (entry.size == 0) {
+			// the tile was removed
+			wasted_size += TILE_ARCHIVE_TILE_HEADER_SIZE;
+			if (it != entries.end())
+				entries.erase(it);
+		} else
+			entries[key] = entry;
+	});
+	flushed_size = size;
+	in.close();
+
+	// remove a partially written tile image at the end
+	if (size != file_size && !read_only) {
+		LOG(WARNING) << "Tile archive '" << filename.string() << "' has an incomplete tile "
+				<< "at the end, it is removed.";
+		fs::resize_file(filename, size);
+	}
+
+	std::ios::openmode mode = std::ios::in | std::ios::binary;
+	if (!read_only)
+		mode |= std::ios::out;
+	file.open(filename.string(), mode);
+	if (!file || !openReadFile()) {
+		file.close();
+		LOG(ERROR) << "Unable to open tile archive '" << filename.string() << "'.";
+		return false;
+	}
+	return true;
+}
+
+bool TileArchive::close() {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	closeReadFile(lock);
+	file.close();
+	if (read_only)
+		return true;
+	bool ok = true;
+	if (file.fail()) {
+		LOG(ERROR) << "Unable to write tile archive '" << filename.string() << "'.";
+		ok = false;
+	} else if (!writeIndex()) {
+		LOG(WARNING) << "Unable to write index of tile archive '" << filename.string() << "'.";
+		ok = false;
+	}
+	unlockArchive();
+	return ok;
+}
+
+bool TileArchive::isOpen() const {
+	return file.is_open();
+}
+
+bool TileArchive::readSingleTile(const fs::path& filename, const TilePath& tile,
+		std::string& data) {
+	std::ifstream in(filename.string(), std::ios::binary);
+	boost::system::error_code error;
+	uint64_t file_size = fs::file_size(filename, error);
+	if (error || !util::readBinaryHeader(in, TILE_ARCHIVE_MAGIC, TILE_ARCHIVE_VERSION))
+		return false;
+
+	uint64_t key = tile.getKey();
+	uint64_t indexed_size;
+	Entry entry;
+	bool found;
+	if (!findIndexEntry(filename, key, indexed_size, entry, found)
+			|| indexed_size > file_size) {
+		indexed_size = TILE_ARCHIVE_HEADER_SIZE;
+		found = false;
+	}
+	// a newer image of the tile might have been appended after the index was written
+	scanTiles(in, indexed_size, file_size, [&](uint64_t tile_key, const Entry& tile_entry) {
+		if (tile_key == key) {
+			entry = tile_entry;
+			found = tile_entry.size != 0;
+		}
+	});
+	if (!found)
+		return false;
+
+	in.clear();
+	data.resize(entry.size);
+	in.seekg(entry.offset);
+	in.read(&data[0], entry.size);
+	return !in.fail();
+}
+
+bool TileArchive::hasTile(const TilePath& tile) const {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	return entries.count(tile.getKey()) != 0;
+}
+
+bool TileArchive::readTile(const TilePath& tile, std::string& data) const {
+	Entry entry;
+	{
+		thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+		auto it = entries.find(tile.getKey());
+		if (it == entries.end())
+			return false;
+		entry = it->second;
+		// the image might still be in the write buffer of the archive file
+		if (entry.offset + entry.size > flushed_size && !flushFile())
+			return false;
+		reading++;
+	}
+
+	// written tile images are never changed, so they are read without holding the lock
+	bool ok = readData(entry, data);
+
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	if (--reading == 0)
+		reading_finished.notify_all();
+	return ok;
+}
+
+bool TileArchive::writeTile(const TilePath& tile, const std::string& data) {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	// an empty image would remove the tile
+	if (read_only || data.empty())
+		return false;
+	int64_t mtime = std::time(nullptr);
+	file.seekp(size);
+	util::writeBinaryValue<uint64_t>(file, tile.getKey());
+	util::writeBinaryValue<int64_t>(file, mtime);
+	util::writeBinaryValue<uint32_t>(file, data.size());
+	file.write(data.data(), data.size());
+	if (!file) {
+		file.clear();
+		return false;
+	}
+
+	auto it = entries.find(tile.getKey());
+	if (it != entries.end())
+		wasted_size += TILE_ARCHIVE_TILE_HEADER_SIZE + it->second.size;
+	Entry& entry = entries[tile.getKey()];
+	entry.offset = size + TILE_ARCHIVE_TILE_HEADER_SIZE;
+	entry.size = data.size();
+	entry.mtime = mtime;
+	size = entry.offset + entry.size;
+	return true;
+}
+
+bool TileArchive::removeTile(const TilePath& tile) {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	if (read_only)
+		return false;
+	auto it = entries.find(tile.getKey());
+	if (it == entries.end())
+		return true;
+	file.seekp(size);
+	util::writeBinaryValue<uint64_t>(file, tile.getKey());
+	util::writeBinaryValue<int64_t>(file, std::time(nullptr));
+	util::writeBinaryValue<uint32_t>(file, 0);
+	if (!file) {
+		file.clear();
+		return false;
+	}
+
+	wasted_size += 2 * TILE_ARCHIVE_TILE_HEADER_SIZE + it->second.size;
+	entries.erase(it);
+	size += TILE_ARCHIVE_TILE_HEADER_SIZE;
+	return true;
+}
+
+void TileArchive::touchTile(const TilePath& tile) {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	auto it = entries.find(tile.getKey());
+	if (it != entries.end())
+		it->second.mtime = std::time(nullptr);
+}
+
+bool TileArchive::flush() {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	return flushFile();
+}
+
+std::vector<TilePath> TileArchive::getTiles() const {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	std::vector<TilePath> tiles;
+	tiles.reserve(entries.size());
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+		tiles.push_back(TilePath::byKey(it->first));
+	std::sort(tiles.begin(), tiles.end());
+	return tiles;
+}
+
+std::vector<std::pair<uint64_t, int64_t> > TileArchive::getTileTimes() const {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	std::vector<std::pair<uint64_t, int64_t> > times;
+	times.reserve(entries.size());
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+		times.push_back(std::make_pair(it->first, it->second.mtime));
+	std::sort(times.begin(), times.end());
+	return times;
+}
+
+uint64_t TileArchive::getSize() const {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	return size;
+}
+
+uint64_t TileArchive::getWastedSize() const {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	return wasted_size;
+}
+
+bool TileArchive::compact() {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	if (read_only)
+		return false;
+	std::unordered_map<uint64_t, uint64_t> keys;
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+		keys[it->first] = it->first;
+	return rewrite(keys, lock);
+}
+
+bool TileArchive::increaseDepth() {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	if (read_only)
+		return false;
+	// the tiles of the old top level move into the opposite corners of the new top
+	// level tiles: 1 -> 1/4, 2 -> 2/3, 3 -> 3/2, 4 -> 4/1, the old base tile is removed
+	std::unordered_map<uint64_t, uint64_t> keys;
+	for (auto it = entries.begin(); it != entries.end(); ++it) {
+		std::vector<int> path = TilePath::byKey(it->first).getPath();
+		if (path.empty() || (int) path.size() >= TilePath::MAX_DEPTH)
+			continue;
+		path.insert(path.begin(), path[0]);
+		path[1] = 5 - path[0];
+		keys[it->first] = TilePath(path).getKey();
+	}
+	return rewrite(keys, lock);
+}
+
+/**
+ * Reads the headers of the tile images from a position of the archive to its end and
+ * calls the callback with the key and the entry of every tile image. Returns the size of
+ * the archive up to the end of the last complete tile image.
+ */
+uint64_t TileArchive::scanTiles(std::istream& in, uint64_t size, uint64_t file_size,
+		const std::function<void(uint64_t, const Entry&)>& callback) {
+	in.seekg(size);
+	while (size + TILE_ARCHIVE_TILE_HEADER_SIZE <= file_size) {
+		uint64_t key = util::readBinaryValue<uint64_t>(in);
+		int64_t mtime = util::readBinaryValue<int64_t>(in);
+		uint32_t tile_size = util::readBinaryValue<uint32_t>(in);
+		if (!in || size + TILE_ARCHIVE_TILE_HEADER_SIZE + tile_size > file_size)
+			break;
+		Entry entry;
+		entry.offset = size + TILE_ARCHIVE_TILE_HEADER_SIZE;
+		entry.size = tile_size;
+		entry.mtime = mtime;
+		callback(key, entry);
+		size = entry.offset + tile_size;
+		in.seekg(size);
+	}
+	return size;
+}
+
+/**
+ * Looks up a tile with a binary search in the index file, the entries of the index are
+ * sorted by the tile path keys and have a fixed size. Returns false if the index can't
+ * be used, found is set if the index contains the tile.
+ */
+bool TileArchive::findIndexEntry(const fs::path& filename, uint64_t key,
+		uint64_t& indexed_size, Entry& entry, bool& found) {
+	std::string index_filename = filename.string() + ".index";
+	std::ifstream in(index_filename, std::ios::binary);
+	if (!util::readBinaryHeader(in, TILE_ARCHIVE_INDEX_MAGIC, TILE_ARCHIVE_INDEX_VERSION))
+		return false;
+	indexed_size = util::readBinaryValue<uint64_t>(in);
+	// the wasted size is not needed
+	util::readBinaryValue<uint64_t>(in);
+	uint64_t count = util::readBinaryValue<uint64_t>(in);
+	boost::system::error_code error;
+	uint64_t index_size = fs::file_size(index_filename, error);
+	if (!in || error || index_size != TILE_ARCHIVE_INDEX_HEADER_SIZE
+			+ count * TILE_ARCHIVE_INDEX_ENTRY_SIZE)
+		return false;
+
+	uint64_t first = 0, last = count;
+	while (first < last) {
+		uint64_t middle = first + (last - first) / 2;
+		in.seekg(TILE_ARCHIVE_INDEX_HEADER_SIZE + middle * TILE_ARCHIVE_INDEX_ENTRY_SIZE);
+		if (util::readBinaryValue<uint64_t>(in) < key)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+
+	found = false;
+	if (first < count) {
+		in.seekg(TILE_ARCHIVE_INDEX_HEADER_SIZE + first * TILE_ARCHIVE_INDEX_ENTRY_SIZE);
+		found = util::readBinaryValue<uint64_t>(in) == key;
+		entry.offset = util::readBinaryValue<uint64_t>(in);
+		entry.size = util::readBinaryValue<uint32_t>(in);
+		entry.mtime = util::readBinaryValue<int64_t>(in);
+	}
+	return !in.fail();
+}
+
+/**
+ * Reads the index file, returns the size of the archive covered by the index.
+ */
+bool TileArchive::readIndex(uint64_t& indexed_size) {
+	std::ifstream in((filename.string() + ".index").c_str(), std::ios::binary);
+	if (!in)
+		return false;
+
+	if (!util::readBinaryHeader(in, TILE_ARCHIVE_INDEX_MAGIC, TILE_ARCHIVE_INDEX_VERSION))
+		return false;
+	indexed_size = util::readBinaryValue<uint64_t>(in);
+	wasted_size = util::readBinaryValue<uint64_t>(in);
+	uint64_t count = util::readBinaryValue<uint64_t>(in);
+	for (uint64_t i = 0; i < count && in; i++) {
+		uint64_t key = util::readBinaryValue<uint64_t>(in);
+		Entry& entry = entries[key];
+		entry.offset = util::readBinaryValue<uint64_t>(in);
+		entry.size = util::readBinaryValue<uint32_t>(in);
+		entry.mtime = util::readBinaryValue<int64_t>(in);
+	}
+
+	if (!in) {
+		LOG(WARNING) << "Index of tile archive '" << filename.string() << "' is corrupt.";
+		return false;
+	}
+	return true;
+}
+
+bool TileArchive::writeIndex() const {
+	std::vector<uint64_t> keys;
+	keys.reserve(entries.size());
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+		keys.push_back(it->first);
+	std::sort(keys.begin(), keys.end());
+
+	return util::writeFileAtomically(filename.string() + ".index", [&](std::ostream& out) {
+		util::writeBinaryHeader(out, TILE_ARCHIVE_INDEX_MAGIC, TILE_ARCHIVE_INDEX_VERSION);
+		util::writeBinaryValue<uint64_t>(out, size);
+		util::writeBinaryValue<uint64_t>(out, wasted_size);
+		util::writeBinaryValue<uint64_t>(out, keys.size());
+		for (auto it = keys.begin(); it != keys.end(); ++it) {
+			const Entry& entry = entries.at(*it);
+			util::writeBinaryValue<uint64_t>(out, *it);
+			util::writeBinaryValue<uint64_t>(out, entry.offset);
+			util::writeBinaryValue<uint32_t>(out, entry.size);
+			util::writeBinaryValue<int64_t>(out, entry.mtime);
+		}
+	});
+}
+
+/**
+ * Writes the tiles of the archive sorted by their (new) keys to a new archive file
+ * which replaces the old one. Tiles which are not in the key map are removed. The lock
+ * must be held.
+ */
+bool TileArchive::rewrite(const std::unordered_map<uint64_t, uint64_t>& keys,
+		thread_ns::unique_lock<thread_ns::mutex>& lock) {
+	std::vector<std::pair<TilePath, uint64_t> > tiles;
+	for (auto it = keys.begin(); it != keys.end(); ++it)
+		tiles.push_back(std::make_pair(TilePath::byKey(it->second), it->first));
+	std::sort(tiles.begin(), tiles.end());
+
+	fs::path tmp_path = filename.string() + ".tmp";
+	std::ofstream out(tmp_path.string(), std::ios::binary);
+	util::writeBinaryHeader(out, TILE_ARCHIVE_MAGIC, TILE_ARCHIVE_VERSION);
+
+	std::unordered_map<uint64_t, Entry> new_entries;
+	uint64_t new_size = TILE_ARCHIVE_HEADER_SIZE;
+	std::string data;
+	for (auto it = tiles.begin(); it != tiles.end() && out; ++it) {
+		const Entry& entry = entries.at(it->second);
+		data.resize(entry.size);
+		file.seekg(entry.offset);
+		file.read(&data[0], entry.size);
+		if (!file)
+			break;
+
+		uint64_t key = it->first.getKey();
+		util::writeBinaryValue<uint64_t>(out, key);
+		util::writeBinaryValue<int64_t>(out, entry.mtime);
+		util::writeBinaryValue<uint32_t>(out, entry.size);
+		out.write(data.data(), entry.size);
+
+		Entry& new_entry = new_entries[key];
+		new_entry.offset = new_size + TILE_ARCHIVE_TILE_HEADER_SIZE;
+		new_entry.size = entry.size;
+		new_entry.mtime = entry.mtime;
+		new_size = new_entry.offset + entry.size;
+	}
+	out.close();
+	if (!file || !out) {
+		file.clear();
+		fs::remove(tmp_path);
+		LOG(ERROR) << "Unable to rewrite tile archive '" << filename.string() << "'.";
+		return false;
+	}
+
+	// the old index must not be used with the new archive
+	closeReadFile(lock);
+	file.close();
+	fs::remove(filename.string() + ".index");
+	fs::rename(tmp_path, filename);
+	entries = new_entries;
+	size = new_size;
+	flushed_size = new_size;
+	wasted_size = 0;
+
+	file.open(filename.string(), std::ios::in | std::ios::out | std::ios::binary);
+	return file && openReadFile() && writeIndex();
+}
+
+/**
+ * Takes the advisory lock of the archive, it is released when the archive is closed.
+ */
+bool TileArchive::lockArchive() {
+#ifdef HAVE_UNISTD_H
+	unlockArchive();
+	std::string lock_filename = filename.string() + ".lock";
+	lock_fd = ::open(lock_filename.c_str(), O_RDWR | O_CREAT, 0644);
+	if (lock_fd == -1) {
+		LOG(ERROR) << "Unable to open lock file '" << lock_filename << "'.";
+		return false;
+	}
+	if (flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+		LOG(ERROR) << "Tile archive '" << filename.string() << "' is used by another "
+				<< "process (rendering or compacting it).";
+		unlockArchive();
+		return false;
+	}
+#endif
+	return true;
+}
+
+void TileArchive::unlockArchive() {
+#ifdef HAVE_UNISTD_H
+	// closing the file releases the lock
+	if (lock_fd != -1)
+		::close(lock_fd);
+	lock_fd = -1;
+#endif
+}
+
+/**
+ * Writes the buffered tile images to the archive file, the lock must be held.
+ */
+bool TileArchive::flushFile() const {
+	if (read_only)
+		return true;
+	file.flush();
+	if (!file) {
+		file.clear();
+		return false;
+	}
+	flushed_size = size;
+	return true;
+}
+
+bool TileArchive::openReadFile() {
+#ifdef HAVE_UNISTD_H
+	read_fd = ::open(filename.string().c_str(), O_RDONLY);
+	return read_fd != -1;
+#else
+	read_file.open(filename.string(), std::ios::binary);
+	return !read_file.fail();
+#endif
+}
+
+/**
+ * Closes the handle to read the tile images when no thread is reading anymore,
+ * the lock must be held.
+ */
+void TileArchive::closeReadFile(thread_ns::unique_lock<thread_ns::mutex>& lock) {
+	while (reading > 0)
+		reading_finished.wait(lock);
+#ifdef HAVE_UNISTD_H
+	if (read_fd != -1)
+		::close(read_fd);
+	read_fd = -1;
+#else
+	read_file.close();
+#endif
+}
+
+/**
+ * Reads the image of a tile, multiple threads can read at once.
+ */
+bool TileArchive::readData(const Entry& entry, std::string& data) const {
+	data.resize(entry.size);
+#ifdef HAVE_UNISTD_H
+	// pread does not use the file position of the handle, so it can be shared
+	uint32_t read = 0;
+	while (read < entry.size) {
+		ssize_t count = pread(read_fd, &data[read], entry.size - read, entry.offset + read);
+		if (count <= 0)
+			return false;
+		read += count;
+	}
+	return true;
+#else
+	thread_ns::unique_lock<thread_ns::mutex> lock(read_mutex);
+	read_file.seekg(entry.offset);
+	read_file.read(&data[0], entry.size);
+	if (!read_file) {
+		read_file.clear();
+		return false;
+	}
+	return true;
+#endif
+}
+
+} /* namespace renderer */
+} /* namespace mapcrafter */
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILEARCHIVE_H_
+#define TILEARCHIVE_H_
+
+#include "tileset.h"
+#include "../compat/thread.h"
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace mapcrafter {
+namespace renderer {
+
+/**
+ * Stores the (encoded) tile images of a map rotation in a single file instead of a file
+ * per tile. New tile images are appended to the end of the file, an index with the
+ * position of every tile is kept in memory and written to a second file (.index) when
+ * the archive is closed. The index file is sorted by the tiles, so single tiles can be
+ * looked up without reading the whole index.
+ *
+ * If the index is missing or does not cover the whole archive (for example if the
+ * renderer was interrupted), the tiles at the end of the archive are found by reading
+ * the headers of the tiles after the indexed part again. Images which were replaced
+ * by newer ones or removed waste space in the archive until it is compacted.
+ *
+ * An archive which is not opened read only is locked (with an advisory lock on the
+ * .lock file next to it), so only one process at a time can change it.
+ *
+ * All methods can be used by multiple threads at once. The tile images are read without
+ * waiting for other threads reading or writing tiles.
+ */
+class TileArchive {
+public:
+	TileArchive();
+	~TileArchive();
+
+	/**
+	 * Opens an archive file, a new archive is created if the file does not exist.
+	 * An archive opened read only is not changed, it can be read while the renderer
+	 * is still writing it. Opening fails if another process has the archive open to
+	 * change it.
+	 */
+	bool open(const fs::path& filename, bool read_only = false);
+
+	/**
+	 * Writes the index (if the archive is not read only) and closes the archive.
+	 */
+	bool close();
+
+	bool isOpen() const;
+
+	/**
+	 * Reads a single tile of an archive without opening it. Only the entry of the tile is
+	 * looked up in the index file, and only the tiles appended after the index was
+	 * written are scanned.
+	 */
+	static bool readSingleTile(const fs::path& filename, const TilePath& tile,
+			std::string& data);
+
+	bool hasTile(const TilePath& tile) const;
+	bool readTile(const TilePath& tile, std::string& data) const;
+
+	/**
+	 * Appends the image of a tile to the archive, the modification time of the tile is
+	 * the current time.
+	 */
+	bool writeTile(const TilePath& tile, const std::string& data);
+
+	/**
+	 * Removes a tile from the archive. A record without image is appended which removes
+	 * the tile again when the archive is opened the next time.
+	 */
+	bool removeTile(const TilePath& tile);
+
+	/**
+	 * Sets the modification time of a tile to the current time.
+	 */
+	void touchTile(const TilePath& tile);
+
+	/**
+	 * Writes the buffered tile images to the archive file.
+	 */
+	bool flush();
+
+	/**
+	 * Returns all tiles of the archive.
+	 */
+	std::vector<TilePath> getTiles() const;
+
+	/**
+	 * Returns the (tile path key, modification time) pairs of all tiles, sorted.
+	 */
+	std::vector<std::pair<uint64_t, int64_t> > getTileTimes() const;
+
+	/**
+	 * Returns the size of the archive file and the size of the images in it which
+	 * were replaced by newer ones or removed.
+	 */
+	uint64_t getSize() const;
+	uint64_t getWastedSize() const;
+
+	/**
+	 * Rewrites the archive without the replaced and removed images, sorted by the
+	 * tile paths.
+	 */
+	bool compact();
+
+	/**
+	 * Moves all tiles one zoom level deeper like RenderManager::increaseMaxZoom does with
+	 * the tile directories. The tiles of the first zoom level and the base tile need to
+	 * be composed again afterwards.
+	 */
+	bool increaseDepth();
+
+private:
+	struct Entry {
+		// position and size of the image data in the archive file
+		uint64_t offset;
+		uint32_t size;
+		int64_t mtime;
+	};
+
+	static uint64_t scanTiles(std::istream& in, uint64_t size, uint64_t file_size,
+			const std::function<void(uint64_t, const Entry&)>& callback);
+	static bool findIndexEntry(const fs::path& filename, uint64_t key,
+			uint64_t& indexed_size, Entry& entry, bool& found);
+
+	bool readIndex(uint64_t& indexed_size);
+	bool writeIndex() const;
+	bool rewrite(const std::unordered_map<uint64_t, uint64_t>& keys,
+			thread_ns::unique_lock<thread_ns::mutex>& lock);
+
+	bool lockArchive();
+	void unlockArchive();
+
+	bool flushFile() const;
+	bool openReadFile();
+	void closeReadFile(thread_ns::unique_lock<thread_ns::mutex>& lock);
+	bool readData(const Entry& entry, std::string& data) const;
+
+	fs::path filename;
+	bool read_only;
+	mutable std::fstream file;
+
+	std::unordered_map<uint64_t, Entry> entries;
+	uint64_t size, wasted_size;
+	// size of the archive which was written to the archive file
+	mutable uint64_t flushed_size;
+
+	mutable thread_ns::mutex mutex;
+
+#ifdef HAVE_UNISTD_H
+	// the locked .lock file of an archive which is not opened read only
+	int lock_fd;
+#endif
+
+	// the tile images are read with a second handle of the archive file,
+	// the count of threads currently reading it
+#ifdef HAVE_UNISTD_H
+	int read_fd;
+#else
+	mutable std::ifstream read_file;
+	mutable thread_ns::mutex read_mutex;
+#endif
+	mutable int reading;
+	mutable thread_ns::condition_variable reading_finished;
+};
+
+} /* namespace renderer */
+} /* namespace mapcrafter */
+
+#endif /* TILEARCHIVE_H_ */
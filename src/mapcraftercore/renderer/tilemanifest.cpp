@@ -0,0 +1,85 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tilemanifest.h"
+
+#include "../util.h"
+
+#include <cstdio>
+#include <ctime>
+
+namespace mapcrafter {
+namespace renderer {
+
+TileManifest::TileManifest(const std::string& rotation, const std::string& suffix)
+	: rotation(rotation), suffix(suffix), written(0), unchanged(0), deleted(0) {
+}
+
+TileManifest::~TileManifest() {
+}
+
+bool TileManifest::open(const fs::path& filename) {
+	out.open(filename.string(), std::ios::out | std::ios::app);
+	out << "# begin " << std::time(nullptr) << std::endl;
+	if (!out) {
+		LOG(WARNING) << "Unable to open tile manifest '" << filename.string() << "'.";
+		return false;
+	}
+	return true;
+}
+
+bool TileManifest::close() {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	out << "# end " << std::time(nullptr) << std::endl;
+	out.close();
+	if (!out)
+		return false;
+	LOG(INFO) << "Tile manifest: " << written << " tiles written, "
+			<< unchanged << " unchanged, " << deleted << " deleted.";
+	return true;
+}
+
+void TileManifest::addTile(const TilePath& tile, TileChange change, uint64_t hash) {
+	char line[64];
+	char type = 'W';
+	if (change == TileChange::UNCHANGED)
+		type = 'U';
+	else if (change == TileChange::DELETED)
+		type = 'D';
+	std::snprintf(line, sizeof(line), "%c %016llx ", type, (unsigned long long) hash);
+	std::string file = rotation + "/"
+			+ (tile.getDepth() == 0 ? std::string("base") : tile.toString()) + "." + suffix;
+
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	out << line << file << '\n';
+	if (change == TileChange::WRITTEN)
+		written++;
+	else if (change == TileChange::UNCHANGED)
+		unchanged++;
+	else
+		deleted++;
+}
+
+void TileManifest::flush() {
+	thread_ns::unique_lock<thread_ns::mutex> lock(mutex);
+	out.flush();
+}
+
+} /* namespace renderer */
+} /* namespace mapcrafter */
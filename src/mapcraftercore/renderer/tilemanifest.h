@@ -0,0 +1,90 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILEMANIFEST_H_
+#define TILEMANIFEST_H_
+
+#include "tileset.h"
+#include "../compat/thread.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace mapcrafter {
+namespace renderer {
+
+enum class TileChange {
+	// the tile image was written
+	WRITTEN,
+	// the tile was rendered, but the image did not change and was not written
+	UNCHANGED,
+	// the tile is not part of the map anymore and its image was deleted
+	DELETED
+};
+
+/**
+ * Records the tiles of a map rotation which were written, deleted or found unchanged by
+ * a rendering, so tools uploading the map somewhere need to sync only these tiles.
+ *
+ * The manifest is a text file the tiles of every rendering are appended to. A rendering
+ * starts with a line "# begin <time>" and ends with a line "# end <time>" if it was
+ * not interrupted. Every tile is a line "<W|U|D> <hash> <file>", the hash is the 64 bit
+ * hash of the tile image (hexadecimal, 0 for deleted tiles) and the file is relative to
+ * the map directory, for example "W 5b3f0e1c2a4d6e8f tl/1/4/2.png".
+ *
+ * All methods can be used by multiple threads at once.
+ */
+class TileManifest {
+public:
+	TileManifest(const std::string& rotation, const std::string& suffix);
+	~TileManifest();
+
+	/**
+	 * Opens the manifest file to append the tiles of a rendering.
+	 */
+	bool open(const fs::path& filename);
+
+	/**
+	 * Marks the rendering as finished and closes the manifest file.
+	 */
+	bool close();
+
+	void addTile(const TilePath& tile, TileChange change, uint64_t hash);
+
+	/**
+	 * Writes the buffered tiles to the manifest file.
+	 */
+	void flush();
+
+private:
+	std::string rotation, suffix;
+
+	std::ofstream out;
+	int written, unchanged, deleted;
+	thread_ns::mutex mutex;
+};
+
+} /* namespace renderer */
+} /* namespace mapcrafter */
+
+#endif /* TILEMANIFEST_H_ */
@@ -22,6 +22,7 @@
 #include "rendermodes/base.h"
 #include "biomes.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -129,7 +130,8 @@ bool RenderBlock::operator<(const RenderBlock& other) const {
 }
 
 TileRenderer::TileRenderer()
-		: state(), render_biomes(false), water_preblit(true) {
+		: state(), render_biomes(false), water_preblit(true),
+		  pipeline_type(RendermodePipelineType::PLAIN) {
 }
 
 TileRenderer::TileRenderer(std::shared_ptr<mc::WorldCache> world,
@@ -139,43 +141,84 @@ TileRenderer::TileRenderer(std::shared_ptr<mc::WorldCache> world,
 		: state(world, images), render_biomes(map_config.renderBiomes()),
 		  water_preblit(map_config.getRendermode() != "daylight"
 				  && map_config.getRendermode() != "nightlight") {
+	if (images)
+		default_biome_colors = images->getBiomeColors(getBiome(DEFAULT_BIOME));
 	createRendermode(world_config, map_config, state, rendermodes);
+	pipeline_type = getRendermodePipelineType(rendermodes);
+
+	// read only the chunk data which is needed by the renderer and the rendermodes
+	int chunk_fields = mc::GET_ID | mc::GET_DATA;
+	if (render_biomes)
+		chunk_fields |= mc::GET_BIOME;
+	for (size_t i = 0; i < rendermodes.size(); i++)
+		chunk_fields |= rendermodes[i]->getChunkFields();
+	if (world)
+		world->setChunkFields(chunk_fields);
 }
 
 TileRenderer::~TileRenderer() {
 }
 
-Biome TileRenderer::getBiomeOfBlock(const mc::BlockPos& pos, const mc::Chunk* chunk) {
-	// return default biome if we don't want to render different biomes
-	if (!render_biomes)
-		return getBiome(DEFAULT_BIOME);
-	uint8_t biome_id = chunk->getBiomeAt(mc::LocalBlockPos(pos));
-	Biome biome = getBiome(biome_id);
-	int count = 1;
-
-	// get average biome data to make smooth edges between
-	// different biomes
-	for (int dx = -1; dx <= 1; dx++)
-		for (int dz = -1; dz <= 1; dz++) {
-			if (dx == 0 && dz == 0)
-				continue;
+/**
+ * Calculates the smoothed biome colors of all block columns of a chunk. The biome data
+ * of every column is averaged with the data of the adjacent columns to make smooth
+ * edges between different biomes. The neighbor chunks are needed for the columns at
+ * the edges of the chunk.
+ */
+void TileRenderer::calculateBiomeColors(const mc::Chunk* chunk, ChunkBiomeColors& colors) {
+	// biome ids of the chunk columns with the adjacent columns of the neighbor chunks,
+	// -1 if a neighbor chunk does not exist
+	int biomes[18][18];
+	mc::ChunkPos chunk_pos = chunk->getPos();
+	for (int cx = -1; cx <= 1; cx++)
+		for (int cz = -1; cz <= 1; cz++) {
+			const mc::Chunk* other = chunk;
+			if (cx != 0 || cz != 0)
+				other = state.world->getChunk(mc::ChunkPos(chunk_pos.x + cx, chunk_pos.z + cz));
+			// only the columns next to the chunk are needed of the neighbor chunks
+			for (int x = (cx == -1 ? 15 : 0); x <= (cx == 1 ? 0 : 15); x++)
+				for (int z = (cz == -1 ? 15 : 0); z <= (cz == 1 ? 0 : 15); z++) {
+					int id = -1;
+					if (other != nullptr)
+						id = other->getBiomeAt(mc::LocalBlockPos(x, z, 0));
+					biomes[x + cx * 16 + 1][z + cz * 16 + 1] = id;
+				}
+		}
 
-			mc::BlockPos other = pos + mc::BlockPos(dx, dz, 0);
-			mc::ChunkPos chunk_pos(other);
-			uint8_t other_id = chunk->getBiomeAt(mc::LocalBlockPos(other));
-			if (chunk_pos != chunk->getPos()) {
-				mc::Chunk* other_chunk = state.world->getChunk(chunk_pos);
-				if (other_chunk == nullptr)
-					continue;
-				other_id = other_chunk->getBiomeAt(mc::LocalBlockPos(other));
-			}
+	for (int x = 0; x < 16; x++)
+		for (int z = 0; z < 16; z++) {
+			Biome biome = getBiome(biomes[x + 1][z + 1]);
+			int count = 1;
+
+			for (int dx = -1; dx <= 1; dx++)
+				for (int dz = -1; dz <= 1; dz++) {
+					int other_id = biomes[x + dx + 1][z + dz + 1];
+					if ((dx == 0 && dz == 0) || other_id == -1)
+						continue;
+					biome += getBiome(other_id);
+					count++;
+				}
 
-			biome += getBiome(other_id);
-			count++;
+			biome /= count;
+			colors.columns[z * 16 + x] = state.images->getBiomeColors(biome);
 		}
+}
 
-	biome /= count;
-	return biome;
+/**
+ * Returns the biome colors of the block column of a block.
+ */
+const BiomeColors& TileRenderer::getBiomeColors(const mc::BlockPos& pos,
+		const mc::Chunk* chunk) {
+	// return default biome colors if we don't want to render different biomes
+	if (!render_biomes)
+		return default_biome_colors;
+
+	bool cached;
+	ChunkBiomeColors& colors = biome_colors.get(chunk->getPos(), cached);
+	if (!cached)
+		calculateBiomeColors(chunk, colors);
+	mc::LocalBlockPos local(pos);
+	return colors.columns[local.z * 16 + local.x];
 }
 
 /**
@@ -432,8 +475,13 @@ uint16_t TileRenderer::checkNeighbors(const mc::BlockPos& pos, uint16_t id, uint
 	return data;
 }
 
+/**
+ * Renders a tile. The hooks of the rendermodes are called with the supplied rendermode
+ * pipeline.
+ */
+template <typename Pipeline>
 void TileRenderer::renderTile(const TilePos& tile_pos, const TilePos& tile_offset,
-		RGBAImage& tile) {
+		RGBAImage& tile, Pipeline& pipeline) {
 	// some vars, set correct image size
 	int block_size = state.images->getBlockImageSize();
 	int tile_size = state.images->getTileSize();
@@ -444,11 +492,11 @@ void TileRenderer::renderTile(const TilePos& tile_pos, const TilePos& tile_offse
 	int max_water = state.images->getMaxWaterNeededOpaque();
 
 	// all visible blocks which are rendered in this tile
-	std::set<RenderBlock> blocks;
+	blocks.clear();
+	block_image_pool.release(0);
 
 	// call start method of the rendermodes
-	for (size_t i = 0; i < rendermodes.size(); i++)
-		rendermodes[i]->start();
+	pipeline.start();
 
 	// iterate over the highest blocks in the tile
 	// we use as tile position tile_pos+tile_offset because the offset means that
@@ -463,8 +511,9 @@ void TileRenderer::renderTile(const TilePos& tile_pos, const TilePos& tile_offse
 		// water counter, how many water blocks are at the moment in this row?
 		int water = 0;
 
-		// the render block objects in our current block row
-		std::set<RenderBlock> row_nodes;
+		// the render block objects in our current block row,
+		// from the highest to the lowest block
+		row_nodes.clear();
 		// then iterate over the blocks, which are on the tile at the same position,
 		// beginning from the highest block
 		for (BlockRowIterator block(it.current); !block.end(); block.next()) {
@@ -500,14 +549,7 @@ void TileRenderer::renderTile(const TilePos& tile_pos, const TilePos& tile_offse
 			uint16_t data = state.chunk->getBlockData(local);
 
 			// check if a rendermode hides this block
-			bool visible = true;
-			for (size_t i = 0; i < rendermodes.size(); i++) {
-				if (rendermodes[i]->isHidden(block.current, id, data)) {
-					visible = false;
-					break;
-				}
-			}
-			if (!visible)
+			if (pipeline.isHidden(block.current, id, data))
 				continue;
 
 			bool is_water = (id == 8 || id == 9) && data == 0;
@@ -541,14 +583,13 @@ void TileRenderer::renderTile(const TilePos& tile_pos, const TilePos& tile_offse
 					// we can stop searching more blocks
 					// and replace the already added render blocks with a preblit water block
 					if (water > max_water) {
-						std::set<RenderBlock>::const_iterator it = row_nodes.begin();
-						// iterate through the render blocks in this row
-						while (it != row_nodes.end()) {
-							std::set<RenderBlock>::const_iterator current = it++;
+						// iterate through the render blocks in this row, from the lowest block
+						while (!row_nodes.empty()) {
+							size_t current = row_nodes.size() - 1;
 							// check if we have reached the top most water block
-							if (it == row_nodes.end() || (it->id != 8 && it->id != 9)) {
-								RenderBlock top = *current;
-								row_nodes.erase(current);
+							if (current == 0 || (row_nodes[current - 1].id != 8
+									&& row_nodes[current - 1].id != 9)) {
+								RenderBlock& top = row_nodes[current];
 
 								// check for neighbors
 								mc::Block south, west;
@@ -562,20 +603,18 @@ void TileRenderer::renderTile(const TilePos& tile_pos, const TilePos& tile_offse
 								if (neighbor_west)
 									data |= DATA_WEST;
 
-								// get image and replace the old render block with this
-								top.image = state.images->getOpaqueWater(neighbor_south,
+								// get image and replace the old render block image with this
+								RGBAImage& image = block_image_pool.get(top.image);
+								image = state.images->getOpaqueWater(neighbor_south,
 										neighbor_west);
 
 								// don't forget the rendermodes
-								for (size_t i = 0; i < rendermodes.size(); i++)
-									rendermodes[i]->draw(top.image, top.pos, id, data);
-
-								row_nodes.insert(top);
+								pipeline.draw(image, top.pos, id, data);
 								break;
 
 							} else {
 								// water render block
-								row_nodes.erase(current);
+								row_nodes.pop_back();
 							}
 						}
 
@@ -589,61 +628,75 @@ void TileRenderer::renderTile(const TilePos& tile_pos, const TilePos& tile_offse
 			data = checkNeighbors(block.current, id, data);
 			//if (is_water && (data & DATA_WEST) && (data & DATA_SOUTH))
 			//	continue;
-			RGBAImage image;
 			bool transparent = state.images->isBlockTransparent(id, data);
 
-			// check for biome data
-			if (Biome::isBiomeBlock(id, data))
-				image = state.images->getBiomeDependBlock(id, data, getBiomeOfBlock(block.current, state.chunk));
-			else
-				image = state.images->getBlock(id, data);
-
 			RenderBlock node;
 			node.x = it.draw_x;
 			node.y = it.draw_y;
 			node.pos = block.current;
-			node.image = image;
+			node.image = block_image_pool.borrow(block_size, block_size);
 			node.id = id;
 			node.data = data;
 
+			// check for biome data
+			RGBAImage& image = block_image_pool.get(node.image);
+			if (Biome::isBiomeBlock(id, data))
+				state.images->getBiomeDependBlock(id, data,
+						getBiomeColors(block.current, state.chunk), image);
+			else
+				image = state.images->getBlock(id, data);
+
 			// let the rendermodes do their magic with the block image
-			for (size_t i = 0; i < rendermodes.size(); i++)
-				rendermodes[i]->draw(node.image, node.pos, id, data);
+			pipeline.draw(image, node.pos, id, data);
 
 			// insert into current row
-			row_nodes.insert(node);
+			row_nodes.push_back(node);
 
 			// if this block is not transparent, then break
 			if (!transparent)
 				break;
 		}
 
-		// iterate through the created render blocks
-		for (std::set<RenderBlock>::const_iterator it = row_nodes.begin();
-		        it != row_nodes.end(); ++it) {
-			std::set<RenderBlock>::const_iterator next = it;
-			next++;
-			// insert render block to
-			if (next == row_nodes.end()) {
-				blocks.insert(*it);
-			} else {
-				// skip unnecessary leaves
-				if (it->id == 18 && next->id == 18 && (next->data & 3) == (it->data & 3))
-					continue;
-				blocks.insert(*it);
-			}
+		// iterate through the created render blocks, from the lowest block
+		for (size_t i = row_nodes.size(); i-- > 0; ) {
+			const RenderBlock& node = row_nodes[i];
+			// skip unnecessary leaves
+			if (i > 0 && node.id == 18 && row_nodes[i - 1].id == 18
+					&& (row_nodes[i - 1].data & 3) == (node.data & 3))
+				continue;
+			blocks.push_back(node);
 		}
 	}
 
-	// now blit all blocks
-	for (std::set<RenderBlock>::const_iterator it = blocks.begin(); it != blocks.end();
-			++it) {
-		tile.alphablit(it->image, it->x, it->y);
-	}
+	// now blit all blocks, sorted by their positions
+	// (every block position is only once in the blocks of a tile)
+	std::sort(blocks.begin(), blocks.end());
+	for (auto it = blocks.begin(); it != blocks.end(); ++it)
+		tile.alphablit(block_image_pool.get(it->image), it->x, it->y);
 
 	// call the end method of the rendermodes
-	for (size_t i = 0; i < rendermodes.size(); i++)
-		rendermodes[i]->end();
+	pipeline.end();
+}
+
+void TileRenderer::renderTile(const TilePos& tile_pos, const TilePos& tile_offset,
+		RGBAImage& tile) {
+	if (pipeline_type == RendermodePipelineType::PLAIN) {
+		RendermodePipeline<> pipeline(rendermodes);
+		renderTile(tile_pos, tile_offset, tile, pipeline);
+	} else if (pipeline_type == RendermodePipelineType::CAVE) {
+		RendermodePipeline<CaveRendermode> pipeline(rendermodes);
+		renderTile(tile_pos, tile_offset, tile, pipeline);
+	} else if (pipeline_type == RendermodePipelineType::LIGHTING) {
+		RendermodePipeline<LightingRendermode> pipeline(rendermodes);
+		renderTile(tile_pos, tile_offset, tile, pipeline);
+	} else {
+		DynamicRendermodePipeline pipeline(rendermodes);
+		renderTile(tile_pos, tile_offset, tile, pipeline);
+	}
+}
+
+const RGBAImagePool& TileRenderer::getBlockImagePool() const {
+	return block_image_pool;
 }
 
 }
@@ -101,14 +101,23 @@ struct RenderBlock {
 	// drawing position in pixels on the tile
 	int x, y;
 	bool transparent;
-	RGBAImage image;
+	// index of the block image in the block image pool of the tile renderer
+	size_t image;
 	mc::BlockPos pos;
 	uint8_t id, data;
 
 	bool operator<(const RenderBlock& other) const;
 };
 
+/**
+ * The biome colors of all block columns of a chunk.
+ */
+struct ChunkBiomeColors {
+	BiomeColors columns[16 * 16];
+};
+
 class Rendermode;
+enum class RendermodePipelineType;
 
 /**
  * Renders tiles from world data.
@@ -120,11 +129,28 @@ private:
 	bool render_biomes;
 	bool water_preblit;
 
+	// biome colors if we don't want to render different biomes
+	BiomeColors default_biome_colors;
+	// smoothed biome colors of the chunks, calculated once for every chunk
+	mc::ChunkDataCache<ChunkBiomeColors> biome_colors;
+
 	std::vector<std::shared_ptr<Rendermode>> rendermodes;
+	// type of the rendermode pipeline used to call the rendermodes
+	RendermodePipelineType pipeline_type;
+
+	// buffers for the block images and render blocks of a tile,
+	// they are kept to reuse their memory for the next tiles
+	RGBAImagePool block_image_pool;
+	std::vector<RenderBlock> blocks, row_nodes;
 
-	Biome getBiomeOfBlock(const mc::BlockPos& pos, const mc::Chunk* chunk);
+	void calculateBiomeColors(const mc::Chunk* chunk, ChunkBiomeColors& colors);
+	const BiomeColors& getBiomeColors(const mc::BlockPos& pos, const mc::Chunk* chunk);
 
 	uint16_t checkNeighbors(const mc::BlockPos& pos, uint16_t id, uint16_t data);
+
+	template <typename Pipeline>
+	void renderTile(const TilePos& tile_pos, const TilePos& tile_offset, RGBAImage& tile,
+			Pipeline& pipeline);
 public:
 	TileRenderer();
 	TileRenderer(std::shared_ptr<mc::WorldCache> world,
@@ -134,6 +160,8 @@ public:
 	~TileRenderer();
 
 	void renderTile(const TilePos& tile_pos, const TilePos& tile_offset, RGBAImage& tile);
+
+	const RGBAImagePool& getBlockImagePool() const;
 };
 
 }
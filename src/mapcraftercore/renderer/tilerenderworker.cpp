@@ -19,9 +19,34 @@
 
 #include "tilerenderworker.h"
 
+#include "../config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <set>
+#ifdef HAVE_UNISTD_H
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
 namespace mapcrafter {
 namespace renderer {
 
+// count of written tile files which are synced and renamed at once
+const size_t TILE_SYNC_BATCH_SIZE = 64;
+
+void journalRenderWork(const RenderContext& context, const RenderWorkResult& result) {
+	if (!context.render_journal)
+		return;
+	if (context.tile_archive)
+		context.tile_archive->flush();
+	if (context.tile_manifest)
+		context.tile_manifest->flush();
+	if (!context.render_journal->addWork(result.render_work.tiles, result.tile_hashes))
+		LOG(WARNING) << "Unable to write render journal.";
+}
+
 TileRenderWorker::TileRenderWorker()
 	: progress(new util::DummyProgressHandler), finished(new bool) {
 }
@@ -50,44 +75,129 @@ void TileRenderWorker::setProgressHandler(
 	this->finished = finished;
 }
 
-void TileRenderWorker::saveTile(const TilePath& tile, const RGBAImage& image) {
+/**
+ * Writes the image of a tile to its file if the image changed since the last rendering
+ * or if the file is missing. Returns whether the image changed.
+ */
+bool TileRenderWorker::saveTile(const TilePath& tile, const RGBAImage& image) {
 	bool png = render_context.map_config.getImageFormat() == config::ImageFormat::PNG;
-	std::string suffix = std::string(".") + render_context.map_config.getImageFormatSuffix();
-	std::string filename = tile.toString() + suffix;
-	if (tile.getDepth() == 0)
-		filename = std::string("base") + suffix;
-	fs::path file = render_context.output_dir / filename;
-	if (!fs::exists(file.branch_path()))
-		fs::create_directories(file.branch_path());
+	fs::path file = getTileFile(tile);
 
-	if (png && !image.writePNG(file.string()))
-		LOG(WARNING) << "Unable to write '" << file.string() << "'.";
+	uint64_t hash = 0;
+	bool changed = true;
+	std::shared_ptr<TileStore> store = render_context.tile_store;
+	if (render_context.tile_hashes) {
+		hash = image.hash();
+		changed = hash != render_context.tile_hashes->getHash(tile);
+		if (!changed && hasTileImage(tile)) {
+			if (render_context.tile_manifest)
+				render_context.tile_manifest->addTile(tile, TileChange::UNCHANGED, hash);
+			// the modification times of the tiles tell which tiles are up to date,
+			// but not the shared ones of tile files linked into the tile store
+			if (render_context.map_config.useImageModificationTimes()
+					&& !(store && store->isDeduplicating())) {
+				if (render_context.tile_archive)
+					render_context.tile_archive->touchTile(tile);
+				else
+					fs::last_write_time(file, std::time(nullptr));
+			}
+			return false;
+		}
+	}
 
-	config::Color bg = render_context.background_color;
-	if (!png && !image.writeJPEG(file.string(),
-			render_context.map_config.getJPEGQuality(), rgba(bg.red, bg.green, bg.blue, 255)))
-		LOG(WARNING) << "Unable to write '" << file.string() << "'.";
+	bool written;
+	if (render_context.tile_archive) {
+		config::Color bg = render_context.background_color;
+		std::string data;
+		written = png ? image.writePNGBuffer(data) : image.writeJPEGBuffer(data,
+				render_context.map_config.getJPEGQuality(),
+				rgba(bg.red, bg.green, bg.blue, 255));
+		written = written && render_context.tile_archive->writeTile(tile, data);
+	} else if (store && store->isDeduplicating()) {
+		// the image is only written if the store doesn't have an image with this hash yet
+		if (hash == 0)
+			hash = image.hash();
+		written = true;
+		if (!fs::exists(store->getImageFile(hash))) {
+			auto start = std::chrono::steady_clock::now();
+			fs::path tmp_file = store->getTempFile(hash);
+			written = encodeTileFile(tmp_file, image);
+			int64_t time = std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::steady_clock::now() - start).count();
+			written = written && store->addImage(hash, tmp_file, time);
+		}
+		createTileDirectory(file.parent_path());
+		written = written && store->linkTile(file, hash);
+	} else {
+		createTileDirectory(file.parent_path());
+		written = writeTileFile(tile, image);
+	}
+
+	if (!written) {
+		LOG(WARNING) << "Unable to write tile '" << tile.toString() << "'.";
+		return changed;
+	}
+	if (changed && render_context.tile_hashes)
+		render_work_result.tile_hashes.push_back(std::make_pair(tile, hash));
+	if (render_context.tile_manifest)
+		render_context.tile_manifest->addTile(tile, TileChange::WRITTEN,
+				hash != 0 ? hash : image.hash());
+	return changed;
 }
 
-void TileRenderWorker::renderRecursive(const TilePath& tile, RGBAImage& image) {
-	// if this is tile is not required or we should skip it, try to load it from file
-	if (!render_context.tile_set->isTileRequired(tile)
-			|| render_work.tiles_skip.count(tile)) {
-		bool png = render_context.map_config.getImageFormat() == config::ImageFormat::PNG;
-		fs::path file = render_context.output_dir
-				/ (tile.toString() + "." + render_context.map_config.getImageFormatSuffix());
+/**
+ * Reads a tile from its file or the tile archive. JPEG tiles are decoded directly
+ * with 1/scale of their size, PNG tiles always have their full size.
+ */
+bool TileRenderWorker::readTile(const TilePath& tile, RGBAImage& image, int scale) {
+	bool png = render_context.map_config.getImageFormat() == config::ImageFormat::PNG;
+	if (render_context.tile_archive) {
+		std::string data;
+		if (render_context.tile_archive->readTile(tile, data)
+				&& (png ? image.readPNGBuffer(data) : image.readJPEGBuffer(data, scale)))
+			return true;
+	} else {
+		fs::path file = getTileFile(tile);
 		if ((png && image.readPNG(file.string()))
-				|| (!png && image.readJPEG(file.string()))) {
-			if (render_work.tiles_skip.count(tile))
-				progress->setValue(progress->getValue()
-						+ render_context.tile_set->getContainingRenderTiles(tile));
-			return;
-		}
-
-		LOG(WARNING) << "Unable to read tile '" << tile.toString()
-				<< "', I will just render it again.";
+				|| (!png && image.readJPEGScaled(file.string(), scale)))
+			return true;
 	}
 
+	LOG(WARNING) << "Unable to read tile '" << tile.toString()
+			<< "', I will just render it again.";
+	return false;
+}
+
+/**
+ * Loads a tile from its file if the tile is not required or if we should skip it.
+ * Returns false if the tile needs to get rendered.
+ */
+bool TileRenderWorker::loadTile(const TilePath& tile, RGBAImage& image, int scale) {
+	if (render_context.tile_set->isTileRequired(tile)
+			&& !render_work.tiles_skip.count(tile))
+		return false;
+
+	if (!readTile(tile, image, scale))
+		return false;
+	if (render_work.tiles_skip.count(tile))
+		progress->setValue(progress->getValue()
+				+ render_context.tile_set->getContainingRenderTiles(tile));
+	return true;
+}
+
+/**
+ * Renders a tile and returns whether its image changed since the last rendering.
+ *
+ * If prune is set, composite tiles are not composed again if none of their children
+ * changed. The image of such a tile is left empty, it needs to be read from the tile
+ * file if it is required.
+ */
+bool TileRenderWorker::renderRecursive(const TilePath& tile, RGBAImage& image, bool load,
+		bool prune) {
+	// if this is tile is not required or we should skip it, try to load it from file
+	if (load && loadTile(tile, image, 1))
+		return false;
+
 	if (tile.getDepth() == render_context.tile_set->getDepth()) {
 		// this tile is a render tile, render it
 		renderer.renderTile(tile.getTilePos(),
@@ -107,57 +217,226 @@ void TileRenderWorker::renderRecursive(const TilePath& tile, RGBAImage& image) {
 		*/
 
 		// save it
-		saveTile(tile, image);
+		bool changed = saveTile(tile, image);
 
 		// update progress
 		progress->setValue(progress->getValue() + 1);
-	} else {
-		// this tile is a composite tile, we need to compose it from its children
-		// just check, if children 1, 2, 3, 4 exists, render it, resize it to the half size
-		// and blit it to the properly position
-		int size = render_context.map_config.getTextureSize() * 32 * TILE_WIDTH;
-		image.setSize(size, size);
-
-		RGBAImage other;
-		RGBAImage resized;
-		if (render_context.tile_set->hasTile(tile + 1)) {
-			renderRecursive(tile + 1, other);
-			other.resizeHalf(resized);
-			image.simpleblit(resized, 0, 0);
-			other.clear();
+		return changed;
+	}
+
+	// this tile is a composite tile, we need to compose it from its children
+	// just check, if children 1, 2, 3, 4 exists, render it and resize it
+	// to the half size directly to the properly position
+	int size = render_context.map_config.getTextureSize() * 32 * TILE_WIDTH;
+	image.setSize(size, size);
+
+	size_t other_index = tile_image_pool.borrow(size, size);
+	RGBAImage& other = tile_image_pool.get(other_index);
+	other.clear();
+
+	// at first render the required children, the children rendered by other render
+	// works are loaded later
+	bool children_changed = false;
+	bool composed[5] = {false, false, false, false, false};
+	for (int i = 1; i <= 4; i++) {
+		if (!render_context.tile_set->hasTile(tile + i)) {
+			// the child was removed from the world, delete it
+			if (render_context.tile_hashes
+					&& render_context.tile_hashes->getHash(tile + i) != 0) {
+				removeTile(tile + i);
+				children_changed = true;
+			}
+			continue;
 		}
-		if (render_context.tile_set->hasTile(tile + 2)) {
-			renderRecursive(tile + 2, other);
-			other.resizeHalf(resized);
-			image.simpleblit(resized, size / 2, 0);
+		if (render_work.tiles_skip.count(tile + i)) {
+			if (render_work.tiles_skip_changed.count(tile + i))
+				children_changed = true;
+			continue;
+		}
+		if (!render_context.tile_set->isTileRequired(tile + i))
+			continue;
+		int x = (i == 2 || i == 4) ? size / 2 : 0;
+		int y = (i == 3 || i == 4) ? size / 2 : 0;
+		children_changed |= renderRecursive(tile + i, other, false, prune);
+		// pruned composite children are read from their files if necessary
+		if (other.getWidth() == size) {
+			other.resizeHalf(image, x, y);
+			composed[i] = true;
+		}
+		other.clear();
+	}
+
+	// the tile file is still up to date if none of the children changed
+	if (prune && !children_changed && render_context.tile_hashes
+			&& render_context.tile_hashes->getHash(tile) != 0
+			&& hasTileImage(tile)) {
+		tile_image_pool.release(other_index);
+		image.setSize(0, 0);
+		return false;
+	}
+
+	// then load the other children from their files
+	for (int i = 1; i <= 4; i++) {
+		if (!render_context.tile_set->hasTile(tile + i) || composed[i])
+			continue;
+		int x = (i == 2 || i == 4) ? size / 2 : 0;
+		int y = (i == 3 || i == 4) ? size / 2 : 0;
+		// children which are loaded from JPEG files are decoded directly at half size
+		bool loaded = render_context.tile_set->isTileRequired(tile + i)
+				&& !render_work.tiles_skip.count(tile + i)
+				? readTile(tile + i, other, 2) : loadTile(tile + i, other, 2);
+		if (loaded && other.getWidth() == size / 2) {
+			image.simpleblit(other, x, y);
 			other.clear();
+			continue;
 		}
-		if (render_context.tile_set->hasTile(tile + 3)) {
-			renderRecursive(tile + 3, other);
-			other.resizeHalf(resized);
-			image.simpleblit(resized, 0, size / 2);
+		if (!loaded) {
 			other.clear();
+			renderRecursive(tile + i, other, false, false);
 		}
-		if (render_context.tile_set->hasTile(tile + 4)) {
-			renderRecursive(tile + 4, other);
-			other.resizeHalf(resized);
-			image.simpleblit(resized, size / 2, size / 2);
+		other.resizeHalf(image, x, y);
+		other.clear();
+	}
+	tile_image_pool.release(other_index);
+
+	/*
+	// draws a border on the tile
+	for (int x = 0; x < size; x++)
+		for (int y = 0; y < size; y++) {
+			if (x < 5 || x > size-5)
+				tile.setPixel(x, y, rgba(255, 0, 0, 255));
+			if (y < 5 || y > size-5)
+				tile.setPixel(x, y, rgba(255, 0, 0, 255));
 		}
+	*/
 
-		/*
-		// draws a border on the tile
-		for (int x = 0; x < size; x++)
-			for (int y = 0; y < size; y++) {
-				if (x < 5 || x > size-5)
-					tile.setPixel(x, y, rgba(255, 0, 0, 255));
-				if (y < 5 || y > size-5)
-					tile.setPixel(x, y, rgba(255, 0, 0, 255));
-			}
-		*/
+	// then save the tile
+	return saveTile(tile, image);
+}
+
+fs::path TileRenderWorker::getTileFile(const TilePath& tile) const {
+	std::string suffix = std::string(".") + render_context.map_config.getImageFormatSuffix();
+	if (tile.getDepth() == 0)
+		return render_context.output_dir / (std::string("base") + suffix);
+	return render_context.output_dir / (tile.toString() + suffix);
+}
+
+void TileRenderWorker::createTileDirectory(const fs::path& dir) {
+	if (tile_directories.count(dir.string()))
+		return;
+	if (!fs::exists(dir))
+		fs::create_directories(dir);
+	tile_directories.insert(dir.string());
+}
+
+bool TileRenderWorker::encodeTileFile(const fs::path& file, const RGBAImage& image) const {
+	if (render_context.map_config.getImageFormat() == config::ImageFormat::PNG)
+		return image.writePNG(file.string());
+	config::Color bg = render_context.background_color;
+	return image.writeJPEG(file.string(), render_context.map_config.getJPEGQuality(),
+			rgba(bg.red, bg.green, bg.blue, 255));
+}
+
+/**
+ * Writes a tile file atomically: The image is written to a temporary file which replaces
+ * the tile file, so there are never partially written tile files if the renderer is
+ * interrupted. A tile file which is a hard link into the tile store is replaced too
+ * instead of overwriting the shared image.
+ */
+bool TileRenderWorker::writeTileFile(const TilePath& tile, const RGBAImage& image) {
+	fs::path file = getTileFile(tile);
+	fs::path tmp_file = file.string() + ".tmp";
+	if (!encodeTileFile(tmp_file, image))
+		return false;
+
+	// the temporary files are synced to the disk before they are renamed,
+	// the hashes of the tiles which can't be renamed then are removed from the result
+	if (render_context.sync_tiles) {
+		pending_tiles.push_back(tile);
+		if (pending_tiles.size() >= TILE_SYNC_BATCH_SIZE)
+			flushTileFiles();
+		return true;
+	}
+
+	boost::system::error_code error;
+	fs::rename(tmp_file, file, error);
+	return !error;
+}
+
+void TileRenderWorker::flushTileFiles() {
+	std::set<fs::path> directories;
+#ifdef HAVE_UNISTD_H
+	for (auto it = pending_tiles.begin(); it != pending_tiles.end(); ++it) {
+		int fd = open((getTileFile(*it).string() + ".tmp").c_str(), O_RDONLY);
+		if (fd != -1) {
+			fsync(fd);
+			close(fd);
+		}
+	}
+#endif
+
+	std::set<TilePath> failed;
+	for (auto it = pending_tiles.begin(); it != pending_tiles.end(); ++it) {
+		fs::path file = getTileFile(*it);
+		boost::system::error_code error;
+		fs::rename(file.string() + ".tmp", file, error);
+		if (error) {
+			LOG(WARNING) << "Unable to write '" << file.string() << "': " << error.message();
+			fs::remove(file.string() + ".tmp", error);
+			failed.insert(*it);
+		}
+		directories.insert(file.parent_path());
+	}
 
-		// then save the tile
-		saveTile(tile, image);
+	// the tiles were not written, so they keep their old hashes
+	if (!failed.empty()) {
+		auto& hashes = render_work_result.tile_hashes;
+		hashes.erase(std::remove_if(hashes.begin(), hashes.end(),
+				[&](const std::pair<TilePath, uint64_t>& hash) {
+					return failed.count(hash.first) != 0;
+				}), hashes.end());
 	}
+
+#ifdef HAVE_UNISTD_H
+	// the renamed directory entries need to be synced too
+	for (auto it = directories.begin(); it != directories.end(); ++it) {
+		int fd = open(it->string().c_str(), O_RDONLY);
+		if (fd != -1) {
+			fsync(fd);
+			close(fd);
+		}
+	}
+#endif
+	pending_tiles.clear();
+}
+
+bool TileRenderWorker::hasTileImage(const TilePath& tile) const {
+	if (render_context.tile_archive)
+		return render_context.tile_archive->hasTile(tile);
+	return fs::exists(getTileFile(tile));
+}
+
+/**
+ * Deletes a tile which is not part of the map anymore and its children. Only tiles with
+ * a hash are deleted, they were written by the renderer before.
+ */
+void TileRenderWorker::removeTile(const TilePath& tile) {
+	render_work_result.tile_hashes.push_back(std::make_pair(tile, 0));
+	if (render_context.tile_manifest)
+		render_context.tile_manifest->addTile(tile, TileChange::DELETED, 0);
+	for (int i = 1; i <= 4; i++)
+		if (render_context.tile_hashes->getHash(tile + i) != 0)
+			removeTile(tile + i);
+
+	if (render_context.tile_archive) {
+		if (!render_context.tile_archive->removeTile(tile))
+			LOG(WARNING) << "Unable to remove tile '" << tile.toString() << "'.";
+		return;
+	}
+	boost::system::error_code error;
+	fs::remove(getTileFile(tile), error);
+	fs::remove(render_context.output_dir / tile.toString(), error);
+	tile_directories.erase((render_context.output_dir / tile.toString()).string());
 }
 
 void TileRenderWorker::operator()() {
@@ -178,11 +457,20 @@ void TileRenderWorker::operator()() {
 	// iterate through the start composite tiles
 	for (auto it = render_work.tiles.begin(); it != render_work.tiles.end(); ++it) {
 		// render this composite tile
-		renderRecursive(*it, image);
+		if (renderRecursive(*it, image))
+			render_work_result.tiles_changed.insert(*it);
 
 		// clear image
 		image.clear();
 	}
+	flushTileFiles();
+
+#ifdef OPT_DEBUG
+	// the image buffers should be allocated only for the first tiles
+	LOG(DEBUG) << "Allocated image buffers: "
+			<< renderer.getBlockImagePool().getAllocations() << " block images, "
+			<< tile_image_pool.getAllocations() << " composite tiles.";
+#endif
 
 	*finished = true;
 }
@@ -21,8 +21,12 @@
 #define TILERENDERWORKER_H_
 
 #include "blockimages.h"
+#include "renderjournal.h"
+#include "tilearchive.h"
+#include "tilemanifest.h"
 #include "tilerenderer.h"
 #include "tileset.h"
+#include "tilestore.h"
 #include "../config/mapcrafterconfig.h"
 #include "../mc/world.h"
 #include "../mc/worldcache.h"
@@ -32,6 +36,8 @@
 
 #include <memory> // shared_ptr
 #include <set>
+#include <unordered_set>
+#include <vector>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
@@ -48,10 +54,25 @@ struct RenderContext {
 
 	mc::World world;
 	std::shared_ptr<renderer::TileSet> tile_set;
+	// hashes of the tile images of the last renderings, not changed while rendering
+	std::shared_ptr<renderer::TileHashIndex> tile_hashes;
+	// archive to store the tile images in instead of single files, if used
+	std::shared_ptr<renderer::TileArchive> tile_archive;
+	// store for deduplicated tile images, if used or if tile files may still be
+	// hard links into the store of a previous rendering
+	std::shared_ptr<renderer::TileStore> tile_store;
+	// manifest of the written, unchanged and deleted tiles, if used
+	std::shared_ptr<renderer::TileManifest> tile_manifest;
+	// journal of the finished render works to continue an interrupted rendering
+	std::shared_ptr<renderer::RenderJournal> render_journal;
+	// whether the written tile files are synced to the disk (in batches)
+	bool sync_tiles = false;
 };
 
 struct RenderWork {
 	std::set<renderer::TilePath> tiles, tiles_skip;
+	// skipped tiles whose images changed when they were rendered
+	std::set<renderer::TilePath> tiles_skip_changed;
 };
 
 struct RenderWorkResult {
@@ -60,8 +81,19 @@ struct RenderWorkResult {
 	RenderWork render_work;
 
 	int tiles_rendered;
+	// tiles of the render work whose images changed
+	std::set<renderer::TilePath> tiles_changed;
+	// new hashes of the written tile images
+	std::vector<std::pair<renderer::TilePath, uint64_t> > tile_hashes;
 };
 
+/**
+ * Appends a finished render work to the journal of the rendering, if there is one. The
+ * tile archive and manifest are flushed before, the render worker already wrote the
+ * tile files.
+ */
+void journalRenderWork(const RenderContext& context, const RenderWorkResult& result);
+
 class TileRenderWorker {
 public:
 	TileRenderWorker();
@@ -74,12 +106,23 @@ public:
 	void setProgressHandler(std::shared_ptr<util::IProgressHandler> progress,
 			std::shared_ptr<bool> finished = std::shared_ptr<bool>(new bool));
 
-	void saveTile(const TilePath& tile, const RGBAImage& image);
-	void renderRecursive(const TilePath& path, RGBAImage& image);
+	bool saveTile(const TilePath& tile, const RGBAImage& image);
+	bool readTile(const TilePath& tile, RGBAImage& image, int scale);
+	bool loadTile(const TilePath& tile, RGBAImage& image, int scale);
+	bool renderRecursive(const TilePath& path, RGBAImage& image, bool load = true,
+			bool prune = true);
 
 	void operator()();
 
 private:
+	fs::path getTileFile(const TilePath& tile) const;
+	bool hasTileImage(const TilePath& tile) const;
+	void removeTile(const TilePath& tile);
+	void createTileDirectory(const fs::path& dir);
+	bool encodeTileFile(const fs::path& file, const RGBAImage& image) const;
+	bool writeTileFile(const TilePath& tile, const RGBAImage& image);
+	void flushTileFiles();
+
 	RenderContext render_context;
 	RenderWork render_work;
 	RenderWorkResult render_work_result;
@@ -89,6 +132,13 @@ private:
 	std::shared_ptr<bool> finished;
 
 	TileRenderer renderer;
+	// buffers for the child tiles of composite tiles
+	RGBAImagePool tile_image_pool;
+
+	// directories of tile files which are known to exist
+	std::unordered_set<std::string> tile_directories;
+	// tiles whose temporary files are not synced and renamed yet
+	std::vector<TilePath> pending_tiles;
 };
 
 } /* namespace render */
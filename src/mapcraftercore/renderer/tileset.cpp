@@ -19,17 +19,29 @@
 
 #include "tileset.h"
 
+#include "../config.h"
+#include "../compat/thread.h"
 #include "../mc/pos.h"
 #include "../util.h"
 
 #include <algorithm>
-#include <cmath>
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
+#include <ctime>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <set>
-#include <sstream>
+#include <thread>
+
+#ifdef HAVE_FSTATAT
+#  include <dirent.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
 
 namespace mapcrafter {
 namespace renderer {
@@ -82,126 +94,127 @@ bool TilePos::operator<(const TilePos& other) const {
 	return x < other.x;
 }
 
-TilePath::TilePath() {
+// the zoom level is stored in the upper bits of the key, the quadkey in the lower bits
+#define DEPTH_SHIFT 58
+#define QUADKEY_MASK ((UINT64_C(1) << DEPTH_SHIFT) - 1)
+
+TilePath::TilePath()
+	: key(0) {
 }
 
 TilePath::TilePath(const std::vector<int>& path)
-	: path(path) {
+	: key(0) {
+	for (size_t i = 0; i < path.size(); i++)
+		*this += path[i];
 }
 
 TilePath::~TilePath() {
 }
 
 int TilePath::getDepth() const {
-	return path.size();
+	return key >> DEPTH_SHIFT;
 }
 
-const std::vector<int>& TilePath::getPath() const {
+std::vector<int> TilePath::getPath() const {
+	int depth = getDepth();
+	std::vector<int> path(depth);
+	for (int i = 0; i < depth; i++)
+		path[i] = ((key >> (2 * (depth - i - 1))) & 3) + 1;
 	return path;
 }
 
+uint64_t TilePath::getKey() const {
+	return key;
+}
+
+uint64_t TilePath::getQuadkey(int depth) const {
+	return (key & QUADKEY_MASK) >> (2 * (getDepth() - depth));
+}
+
 TilePath TilePath::parent() const {
-	TilePath copy(path);
-	copy.path.pop_back();
+	TilePath copy;
+	int depth = getDepth();
+	if (depth > 0)
+		copy.key = ((uint64_t) (depth - 1) << DEPTH_SHIFT) | getQuadkey(depth - 1);
 	return copy;
 }
 
 TilePos TilePath::getTilePos() const {
+	// the bits of the parts in the quadkey are the bits of the tile position
+	// relative to the top left tile: part - 1 = x bit | (y bit << 1)
+	int depth = getDepth();
+	int x = 0, y = 0;
+	for (int i = depth - 1; i >= 0; i--) {
+		int part = (key >> (2 * i)) & 3;
+		x = (x << 1) | (part & 1);
+		y = (y << 1) | (part >> 1);
+	}
 	// calculate the radius of all tiles on the top zoom level (2^zoomlevel / 2)
-	int radius = pow(2, path.size()) / 2;
 	// the startpoint is top left
-	int x = -radius;
-	int y = -radius;
-	for (size_t i = 0; i < path.size(); i++) {
-		// now for every zoom level:
-		// get the current tile
-		int tile = path[i];
-		// increase x by the radius if this tile is on the right side (2 or 4)
-		if (tile == 2 || tile == 4)
-			x += radius;
-		// increase y by the radius if this tile is on the bottom side (3 or 4)
-		if (tile == 3 || tile == 4)
-			y += radius;
-		// divide size by two, because the next zoom level has only the half radius
-		radius /= 2;
-	}
-	return TilePos(x, y);
+	int radius = (1 << depth) / 2;
+	return TilePos(x - radius, y - radius);
 }
 
 TilePath TilePath::byTilePos(const TilePos& tile, int depth) {
-	TilePath path;
-
+	// the key has only space for MAX_DEPTH parts
+	if (depth < 0 || depth > MAX_DEPTH)
+		throw std::runtime_error("Invalid tile depth " + util::str(depth));
 	// at first calculate the radius in tiles of this zoom level
-	int radius = pow(2, depth) / 2;
+	int radius = (1 << depth) / 2;
 	// check if the tile is in this bounds
 	if (tile.getX() > radius  || tile.getY() > radius
 			|| tile.getX() < -radius || tile.getY() < -radius)
 		throw std::runtime_error("Invalid tile position " + util::str(tile.getX())
 			+ ":" + util::str(tile.getY()) + " on depth " + util::str(depth));
-	// the tactic is here to calculate the bounds where the tile is inside
-	int bounds_left = -radius;
-	int bounds_right = radius;
-	int bounds_top = radius;
-	int bounds_bottom = -radius;
-
-	for (int level = 1; level <= depth; level++) {
-		// for each zoom level (but we already have the 1st zoom level):
-		// calculate the midpoint in the bounds
-		int middle_x = (bounds_right + bounds_left) / 2;
-		int middle_y = (bounds_top + bounds_bottom) / 2;
-		// with this midpoint we can decide what the next part in the path is
-		// when tile x < midpoint x:
-		//   and tile y < midpoint y -> top left tile
-		//   and tile y >= midpoint y -> bottom left tile
-		// when tile y >= midpoint y:
-		//   and tile y < midpoint y -> top right tile
-		//   and tile y >= midpoint y -> bottom right tile
-
-		// if we have a midpoint, we update the bounds with the midpoint
-		// the (smaller) bounds are now the part of the path, we found out
-		if (tile.getX() < middle_x) {
-			if (tile.getY() < middle_y) {
-				path += 1;
-				bounds_right = middle_x;
-				bounds_top = middle_y;
-			} else {
-				path += 3;
-				bounds_right = middle_x;
-				bounds_bottom = middle_y;
-			}
-		} else {
-			if (tile.getY() < middle_y) {
-				path += 2;
-				bounds_left = middle_x;
-				bounds_top = middle_y;
-			} else {
-				path += 4;
-				bounds_left = middle_x;
-				bounds_bottom = middle_y;
-			}
-		}
-	}
 
+	// position relative to the top left tile, tiles on the right/bottom bounds
+	// belong to the last tile column/row
+	int x = std::min(tile.getX() + radius, (1 << depth) - 1);
+	int y = std::min(tile.getY() + radius, (1 << depth) - 1);
+
+	// every bit of the position is a part of the path:
+	// 1 is top left, 2 top right, 3 bottom left and 4 bottom right
+	uint64_t quadkey = 0;
+	for (int i = depth - 1; i >= 0; i--)
+		quadkey = (quadkey << 2) | ((x >> i) & 1) | (((y >> i) & 1) << 1);
+
+	TilePath path;
+	path.key = ((uint64_t) depth << DEPTH_SHIFT) | quadkey;
+	return path;
+}
+
+TilePath TilePath::byKey(uint64_t key) {
+	TilePath path;
+	path.key = key;
 	return path;
 }
 
 TilePath& TilePath::operator+=(int node) {
-	path.push_back(node);
+	int depth = getDepth();
+	if (node < 1 || node > 4 || depth >= MAX_DEPTH)
+		throw std::runtime_error("Unable to add node " + util::str(node) + " to tile path "
+			+ toString());
+	key = ((uint64_t) (depth + 1) << DEPTH_SHIFT) | ((key & QUADKEY_MASK) << 2) | (node - 1);
 	return *this;
 }
 
 TilePath TilePath::operator+(int node) const {
-	TilePath copy(path);
-	copy.path.push_back(node);
-	return copy;
+	TilePath copy(*this);
+	return copy += node;
 }
 
 bool TilePath::operator==(const TilePath& other) const {
-	return path == other.path;
+	return key == other.key;
 }
 
 bool TilePath::operator<(const TilePath& other) const {
-	return path < other.path;
+	// paths are compared like the lists of their parts:
+	// compare the common parts first, the shorter path is smaller if they are the same
+	int depth = std::min(getDepth(), other.getDepth());
+	uint64_t quadkey = getQuadkey(depth), other_quadkey = other.getQuadkey(depth);
+	if (quadkey != other_quadkey)
+		return quadkey < other_quadkey;
+	return getDepth() < other.getDepth();
 }
 
 std::ostream& operator<<(std::ostream& stream, const TilePos& tile) {
@@ -215,13 +228,239 @@ std::ostream& operator<<(std::ostream& stream, const TilePath& path) {
 }
 
 std::string TilePath::toString() const {
-	std::stringstream ss;
-	for (size_t i = 0; i < path.size(); i++) {
-		ss << path[i];
-		if (i != path.size() - 1)
-			ss << "/";
+	std::string str;
+	int depth = getDepth();
+	for (int i = depth - 1; i >= 0; i--) {
+		str += (char) ('1' + ((key >> (2 * i)) & 3));
+		if (i != 0)
+			str += '/';
+	}
+	return str;
+}
+
+// version of the tile set index format, increase it when the format changes
+const uint32_t TILE_SET_INDEX_VERSION = 2;
+const char TILE_SET_INDEX_MAGIC[4] = {'M', 'C', 'T', 'I'};
+
+TileSetIndex::TileSetIndex()
+	: scanned_regions(0), indexed_regions(0) {
+}
+
+TileSetIndex::~TileSetIndex() {
+}
+
+bool TileSetIndex::read(const std::string& filename, const std::string& key) {
+	regions.clear();
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+
+	if (!util::readBinaryHeader(in, TILE_SET_INDEX_MAGIC, TILE_SET_INDEX_VERSION, key))
+		return false;
+
+	std::streampos header_size = in.tellg();
+	in.seekg(0, std::ios::end);
+	size_t size = in.tellg();
+	in.seekg(header_size);
+
+	std::vector<int32_t> buffer;
+	uint32_t count = util::readBinaryValue<uint32_t>(in);
+	for (uint32_t i = 0; i < count && in; i++) {
+		mc::RegionPos pos;
+		pos.x = util::readBinaryValue<int32_t>(in);
+		pos.z = util::readBinaryValue<int32_t>(in);
+		Region& region = regions[pos];
+		region.mtime = util::readBinaryValue<int64_t>(in);
+		region.size = util::readBinaryValue<uint64_t>(in);
+		// every tile is x, y and timestamp
+		uint32_t tiles = util::readBinaryValue<uint32_t>(in);
+		if (!in || tiles > size / 12) {
+			in.setstate(std::ios::failbit);
+			break;
+		}
+		buffer.resize(tiles * 3);
+		in.read((char*) buffer.data(), buffer.size() * sizeof(int32_t));
+		region.tiles.resize(tiles);
+		for (uint32_t j = 0; j < tiles; j++)
+			region.tiles[j] = std::make_pair(TilePos(buffer[3 * j], buffer[3 * j + 1]),
+					buffer[3 * j + 2]);
 	}
-	return ss.str();
+
+	if (!in) {
+		LOG(WARNING) << "Tile set index '" << filename << "' is corrupt.";
+		regions.clear();
+		return false;
+	}
+	return true;
+}
+
+bool TileSetIndex::write(const std::string& filename, const std::string& key) const {
+	return util::writeFileAtomically(filename, [&](std::ostream& out) {
+		util::writeBinaryHeader(out, TILE_SET_INDEX_MAGIC, TILE_SET_INDEX_VERSION, key);
+		util::writeBinaryValue<uint32_t>(out, regions.size());
+		for (auto region_it = regions.begin(); region_it != regions.end(); ++region_it) {
+			util::writeBinaryValue<int32_t>(out, region_it->first.x);
+			util::writeBinaryValue<int32_t>(out, region_it->first.z);
+			util::writeBinaryValue<int64_t>(out, region_it->second.mtime);
+			util::writeBinaryValue<uint64_t>(out, region_it->second.size);
+			const std::vector<std::pair<TilePos, int> >& tiles = region_it->second.tiles;
+			util::writeBinaryValue<uint32_t>(out, tiles.size());
+			for (auto tile_it = tiles.begin(); tile_it != tiles.end(); ++tile_it) {
+				util::writeBinaryValue<int32_t>(out, tile_it->first.getX());
+				util::writeBinaryValue<int32_t>(out, tile_it->first.getY());
+				util::writeBinaryValue<int32_t>(out, tile_it->second);
+			}
+		}
+	});
+}
+
+int TileSetIndex::getScannedRegionsCount() const {
+	return scanned_regions;
+}
+
+int TileSetIndex::getIndexedRegionsCount() const {
+	return indexed_regions;
+}
+
+// version of the chunk hash index format, increase it when the format or the hashes change
+const uint32_t CHUNK_HASH_INDEX_VERSION = 3;
+const char CHUNK_HASH_INDEX_MAGIC[4] = {'M', 'C', 'C', 'H'};
+
+ChunkHashIndex::ChunkHashIndex()
+	: read_chunks(0), changed_sections(0) {
+}
+
+ChunkHashIndex::~ChunkHashIndex() {
+}
+
+bool ChunkHashIndex::read(const std::string& filename, const std::string& key) {
+	chunks.clear();
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+
+	if (!util::readBinaryHeader(in, CHUNK_HASH_INDEX_MAGIC, CHUNK_HASH_INDEX_VERSION, key))
+		return false;
+
+	uint32_t count = util::readBinaryValue<uint32_t>(in);
+	for (uint32_t i = 0; i < count && in; i++) {
+		mc::ChunkPos pos;
+		pos.x = util::readBinaryValue<int32_t>(in);
+		pos.z = util::readBinaryValue<int32_t>(in);
+		SectionHashes& hashes = chunks[pos];
+		in.read((char*) hashes.data(), sizeof(SectionHashes));
+	}
+
+	if (!in) {
+		LOG(WARNING) << "Chunk hash index '" << filename << "' is corrupt.";
+		chunks.clear();
+		return false;
+	}
+	return true;
+}
+
+bool ChunkHashIndex::write(const std::string& filename, const std::string& key) const {
+	return util::writeFileAtomically(filename, [&](std::ostream& out) {
+		util::writeBinaryHeader(out, CHUNK_HASH_INDEX_MAGIC, CHUNK_HASH_INDEX_VERSION, key);
+		util::writeBinaryValue<uint32_t>(out, chunks.size());
+		for (auto chunk_it = chunks.begin(); chunk_it != chunks.end(); ++chunk_it) {
+			util::writeBinaryValue<int32_t>(out, chunk_it->first.x);
+			util::writeBinaryValue<int32_t>(out, chunk_it->first.z);
+			out.write((const char*) chunk_it->second.data(), sizeof(SectionHashes));
+		}
+	});
+}
+
+int ChunkHashIndex::getReadChunksCount() const {
+	return read_chunks;
+}
+
+int ChunkHashIndex::getChangedSectionsCount() const {
+	return changed_sections;
+}
+
+// version of the tile hash index format, increase it when the format or the hashes change
+const uint32_t TILE_HASH_INDEX_VERSION = 2;
+const char TILE_HASH_INDEX_MAGIC[4] = {'M', 'C', 'T', 'H'};
+
+TileHashIndex::TileHashIndex() {
+}
+
+TileHashIndex::~TileHashIndex() {
+}
+
+bool TileHashIndex::read(const std::string& filename, const std::string& key) {
+	hashes.clear();
+	std::ifstream in(filename, std::ios::binary);
+	if (!in)
+		return false;
+
+	if (!util::readBinaryHeader(in, TILE_HASH_INDEX_MAGIC, TILE_HASH_INDEX_VERSION, key))
+		return false;
+
+	uint32_t count = util::readBinaryValue<uint32_t>(in);
+	for (uint32_t i = 0; i < count && in; i++) {
+		uint64_t tile = util::readBinaryValue<uint64_t>(in);
+		hashes[tile] = util::readBinaryValue<uint64_t>(in);
+	}
+
+	if (!in) {
+		LOG(WARNING) << "Tile hash index '" << filename << "' is corrupt.";
+		hashes.clear();
+		return false;
+	}
+	return true;
+}
+
+bool TileHashIndex::write(const std::string& filename, const std::string& key) const {
+	return util::writeFileAtomically(filename, [&](std::ostream& out) {
+		util::writeBinaryHeader(out, TILE_HASH_INDEX_MAGIC, TILE_HASH_INDEX_VERSION, key);
+		util::writeBinaryValue<uint32_t>(out, hashes.size());
+		for (auto hash_it = hashes.begin(); hash_it != hashes.end(); ++hash_it) {
+			util::writeBinaryValue<uint64_t>(out, hash_it->first);
+			util::writeBinaryValue<uint64_t>(out, hash_it->second);
+		}
+	});
+}
+
+uint64_t TileHashIndex::getHash(const TilePath& tile) const {
+	auto it = hashes.find(tile.getKey());
+	if (it == hashes.end())
+		return 0;
+	return it->second;
+}
+
+void TileHashIndex::setHash(const TilePath& tile, uint64_t hash) {
+	if (hash == 0)
+		hashes.erase(tile.getKey());
+	else
+		hashes[tile.getKey()] = hash;
+}
+
+/**
+ * Returns whether a tile is one of some tiles or contained in one of them.
+ */
+bool isInSubtrees(TilePath tile, const std::set<TilePath>& tiles) {
+	while (true) {
+		if (tiles.count(tile))
+			return true;
+		if (tile.getDepth() == 0)
+			return false;
+		tile = tile.parent();
+	}
+}
+
+void TileHashIndex::retainSubtrees(const std::set<TilePath>& tiles) {
+	for (auto it = hashes.begin(); it != hashes.end(); ) {
+		if (isInSubtrees(TilePath::byKey(it->first), tiles))
+			++it;
+		else
+			it = hashes.erase(it);
+	}
+}
+
+size_t TileHashIndex::size() const {
+	return hashes.size();
 }
 
 TileSet::TileSet()
@@ -239,7 +478,7 @@ TileSet::~TileSet() {
 /**
  * Calculates the tiles a row and column covers.
  */
-void addRowColTiles(int row, int col, std::set<TilePos>& tiles) {
+void addRowColTiles(int row, int col, std::vector<TilePos>& tiles) {
 	// the tiles have are 2 * TILE_WIDTH columns wide
 	// and 4 * TILE_WIDTH row tall
 	// calculate the approximate position of the tile
@@ -247,24 +486,21 @@ void addRowColTiles(int row, int col, std::set<TilePos>& tiles) {
 	int y = row / (4 * TILE_WIDTH);
 
 	// add this tile
-	tiles.insert(TilePos(x, y));
+	tiles.push_back(TilePos(x, y));
 
 	// check if this row/col is on the border of two tiles
 	bool edge_col = col % (2 * TILE_WIDTH) == 0;
 	bool edge_row = row % (4 * TILE_WIDTH) == 0;
 	// if yes, we have to add the neighbor tiles
 	if (edge_col)
-		tiles.insert(TilePos(x-1, y));
+		tiles.push_back(TilePos(x-1, y));
 	if (edge_row)
-		tiles.insert(TilePos(x, y-1));
+		tiles.push_back(TilePos(x, y-1));
 	if (edge_col && edge_row)
-		tiles.insert(TilePos(x-1, y-1));
+		tiles.push_back(TilePos(x-1, y-1));
 }
 
-/**
- * This function calculates the tiles a chunk covers.
- */
-void getChunkTiles(const mc::ChunkPos& chunk, std::set<TilePos>& tiles) {
+void getChunkTiles(const mc::ChunkPos& chunk, std::vector<TilePos>& tiles) {
 	// at first get row and column of the top of the chunk
 	int row = chunk.getRow();
 	int col = chunk.getCol();
@@ -280,11 +516,38 @@ void getChunkTiles(const mc::ChunkPos& chunk, std::set<TilePos>& tiles) {
 		addRowColTiles(row + 2*i, col, tiles);
 }
 
+void getChunkSectionTiles(const mc::ChunkPos& chunk, int section, std::vector<TilePos>& tiles) {
+	// the top of the chunk is in the row of the chunk,
+	// every section further down is two rows lower
+	int row = chunk.getRow() + 2 * (mc::CHUNK_HEIGHT - 1 - section);
+	int col = chunk.getCol();
+	// the tiles of the top and of the bottom of the section
+	addRowColTiles(row, col, tiles);
+	addRowColTiles(row + 2, col, tiles);
+}
+
+/**
+ * Sorts a list of tiles with timestamps and merges the entries of the same tiles,
+ * the merged entry gets the highest timestamp.
+ */
+void mergeTileTimestamps(std::vector<std::pair<TilePos, int> >& tiles) {
+	std::sort(tiles.begin(), tiles.end());
+	// the entries of a tile are sorted by timestamp, keep the last one
+	size_t size = 0;
+	for (size_t i = 0; i < tiles.size(); i++) {
+		if (size > 0 && tiles[size - 1].first == tiles[i].first)
+			size--;
+		tiles[size++] = tiles[i];
+	}
+	tiles.resize(size);
+}
+
 void TileSet::findRenderTiles(const mc::World& world, bool auto_center,
-		TilePos& tile_offset) {
+		TilePos& tile_offset, TileSetIndex* index) {
 	// clear maybe already calculated tiles
 	render_tiles.clear();
 	required_render_tiles.clear();
+	tile_timestamps.clear();
 
 	// the min/max x/y coordinates of the tiles in the world
 	int tiles_x_min = std::numeric_limits<int>::max(),
@@ -292,9 +555,48 @@ void TileSet::findRenderTiles(const mc::World& world, bool auto_center,
 	    tiles_y_min = std::numeric_limits<int>::max(),
 	    tiles_y_max = std::numeric_limits<int>::min();
 
+	// the tiles of all chunks with the chunk timestamps,
+	// the tiles of every region are merged first to keep this list small
+	std::vector<std::pair<TilePos, int> > tiles;
+	std::vector<TilePos> chunk_tiles;
+
+	// the regions of the updated index
+	std::unordered_map<mc::RegionPos, TileSetIndex::Region, mc::hash_function> index_regions;
+	// region files modified after this time are not put into the index, because
+	// they could be modified again in the same second without changing the mtime
+	std::time_t index_time = std::time(nullptr) - 2;
+	if (index != nullptr) {
+		index->scanned_regions = 0;
+		index->indexed_regions = 0;
+	}
+
 	// go through all chunks in the world
 	auto regions = world.getAvailableRegions();
 	for (auto region_it = regions.begin(); region_it != regions.end(); ++region_it) {
+		TileSetIndex::Region region_index;
+		std::vector<std::pair<TilePos, int> >& region_tiles = region_index.tiles;
+
+		// take the tiles from the index if the region file wasn't changed
+		if (index != nullptr) {
+			fs::path region_path = world.getRegionPath(*region_it);
+			boost::system::error_code error_mtime, error_size;
+			region_index.mtime = fs::last_write_time(region_path, error_mtime);
+			region_index.size = fs::file_size(region_path, error_size);
+			if (error_mtime || error_size || region_index.mtime >= index_time)
+				region_index.mtime = -1;
+
+			auto indexed = index->regions.find(*region_it);
+			if (region_index.mtime != -1 && indexed != index->regions.end()
+					&& indexed->second.mtime == region_index.mtime
+					&& indexed->second.size == region_index.size) {
+				tiles.insert(tiles.end(), indexed->second.tiles.begin(),
+						indexed->second.tiles.end());
+				index_regions[*region_it] = std::move(indexed->second);
+				index->indexed_regions++;
+				continue;
+			}
+		}
+
 		mc::RegionFile region;
 		if (!world.getRegion(*region_it, region) || !region.readOnlyHeaders())
 			continue;
@@ -304,30 +606,39 @@ void TileSet::findRenderTiles(const mc::World& world, bool auto_center,
 			int timestamp = region.getChunkTimestamp(*chunk_it);
 
 			// now get all tiles of the chunk
-			std::set<TilePos> tiles;
-			getChunkTiles(*chunk_it, tiles);
-			for (std::set<TilePos>::const_iterator tile_it = tiles.begin();
-			        tile_it != tiles.end(); ++tile_it) {
-
-				// and update the bounds
-				tiles_x_min = std::min(tiles_x_min, tile_it->getX());
-				tiles_x_max = std::max(tiles_x_max, tile_it->getX());
-				tiles_y_min = std::min(tiles_y_min, tile_it->getY());
-				tiles_y_max = std::max(tiles_y_max, tile_it->getY());
-
-				// update tile timestamp
-				if (!render_tiles.count(*tile_it))
-					tile_timestamps[*tile_it] = timestamp;
-				else
-					tile_timestamps[*tile_it] = std::max(tile_timestamps[*tile_it], timestamp);
-
-				// insert the tile to the set of available render tiles
-				// and also make it required by default
-				render_tiles.insert(*tile_it);
-				required_render_tiles.insert(*tile_it);
-			}
+			chunk_tiles.clear();
+			getChunkTiles(*chunk_it, chunk_tiles);
+			for (auto tile_it = chunk_tiles.begin(); tile_it != chunk_tiles.end(); ++tile_it)
+				region_tiles.push_back(std::make_pair(*tile_it, timestamp));
+		}
+		mergeTileTimestamps(region_tiles);
+		tiles.insert(tiles.end(), region_tiles.begin(), region_tiles.end());
+
+		if (index != nullptr) {
+			index->scanned_regions++;
+			if (region_index.mtime != -1)
+				index_regions[*region_it] = std::move(region_index);
 		}
 	}
+	mergeTileTimestamps(tiles);
+	if (index != nullptr)
+		index->regions.swap(index_regions);
+
+	// insert the tiles to the list of available render tiles
+	// and also make them required by default
+	render_tiles.reserve(tiles.size());
+	tile_timestamps.reserve(tiles.size());
+	for (auto tile_it = tiles.begin(); tile_it != tiles.end(); ++tile_it) {
+		// and update the bounds
+		tiles_x_min = std::min(tiles_x_min, tile_it->first.getX());
+		tiles_x_max = std::max(tiles_x_max, tile_it->first.getX());
+		tiles_y_min = std::min(tiles_y_min, tile_it->first.getY());
+		tiles_y_max = std::max(tiles_y_max, tile_it->first.getY());
+
+		render_tiles.push_back(tile_it->first);
+		tile_timestamps.push_back(tile_it->second);
+	}
+	required_render_tiles = render_tiles;
 
 	// center tiles
 	if (auto_center || tile_offset != TilePos(0, 0)) {
@@ -335,27 +646,19 @@ void TileSet::findRenderTiles(const mc::World& world, bool auto_center,
 		if (auto_center)
 			tile_offset = TilePos((tiles_x_min + tiles_x_max) / 2, (tiles_y_min + tiles_y_max) / 2);
 
-		// update all tile positions
-		std::set<TilePos> render_tiles_tmp, required_render_tiles_tmp;
-		std::map<TilePos, int> tile_timestamps_tmp;
+		// update all tile positions, this doesn't change their order
 		for (auto it = render_tiles.begin(); it != render_tiles.end(); ++it)
-			render_tiles_tmp.insert(*it - tile_offset);
+			*it -= tile_offset;
 		for (auto it = required_render_tiles.begin(); it != required_render_tiles.end(); ++it)
-			required_render_tiles_tmp.insert(*it - tile_offset);
-		for (auto it = tile_timestamps.begin(); it != tile_timestamps.end(); ++it)
-			tile_timestamps_tmp[it->first - tile_offset] = it->second;
-
-		render_tiles = render_tiles_tmp;
-		required_render_tiles = required_render_tiles_tmp;
-		tile_timestamps = tile_timestamps_tmp;
+			*it -= tile_offset;
 		this->tile_offset = tile_offset;
 	}
 
 	// now get the necessary depth of the tile quadtree
-	for (min_depth = 0; min_depth < 32; min_depth++) {
+	for (min_depth = 0; min_depth < TilePath::MAX_DEPTH; min_depth++) {
 		// for each level calculate the radius and check if the tiles fit in this bounds
 		// also don't forget the tile offset
-		int radius = pow(2, min_depth) / 2;
+		int radius = (1 << min_depth) / 2;
 		if (tiles_x_min - tile_offset.getX() > -radius
 				&& tiles_x_max - tile_offset.getX() < radius
 				&& tiles_y_min - tile_offset.getY() > -radius
@@ -364,64 +667,85 @@ void TileSet::findRenderTiles(const mc::World& world, bool auto_center,
 	}
 }
 
-void TileSet::findRequiredCompositeTiles(const std::set<TilePos>& render_tiles,
-		std::set<TilePath>& tiles) {
+void TileSet::findRequiredCompositeTiles(const std::vector<TilePos>& render_tiles,
+		std::vector<TilePath>& tiles) {
+	if (depth == 0)
+		return;
 
 	// iterate through the render tiles on the max zoom level
 	// add their parent composite tiles
-	for (std::set<TilePos>::iterator it = render_tiles.begin(); it != render_tiles.end(); ++it) {
-		TilePath path = TilePath::byTilePos(*it, depth);
-		tiles.insert(path.parent());
-	}
+	std::vector<TilePath> level;
+	level.reserve(render_tiles.size());
+	for (auto it = render_tiles.begin(); it != render_tiles.end(); ++it)
+		level.push_back(TilePath::byTilePos(*it, depth).parent());
+	std::sort(level.begin(), level.end());
+	level.erase(std::unique(level.begin(), level.end()), level.end());
 
 	// now iterate through the composite tiles from bottom to top
-	// and also add their parent composite tiles
-	for (int d = depth - 1; d > 0; d--) {
-		std::set<TilePath> tmp;
-		for (std::set<TilePath>::iterator it = tiles.begin(); it != tiles.end(); ++it) {
-			if (it->getDepth() == d)
-				tmp.insert(it->parent());
-		}
-		for (std::set<TilePath>::iterator it = tmp.begin(); it != tmp.end(); ++it)
-			tiles.insert(*it);
+	// and also add their parent composite tiles,
+	// the parents of sorted tiles of one zoom level are sorted too
+	while (!level.empty()) {
+		tiles.insert(tiles.end(), level.begin(), level.end());
+		if (level[0].getDepth() == 0)
+			break;
+		for (size_t i = 0; i < level.size(); i++)
+			level[i] = level[i].parent();
+		level.erase(std::unique(level.begin(), level.end()), level.end());
 	}
+	std::sort(tiles.begin(), tiles.end());
 }
 
 void TileSet::updateContainingRenderTiles() {
-	containing_render_tiles.clear();
 	// initialize every composite tile with 0
-	for (auto it = composite_tiles.begin(); it != composite_tiles.end(); ++it)
-		containing_render_tiles[*it] = 0;
+	containing_render_tiles.assign(composite_tiles.size(), 0);
+
 	// go through all required render tiles
-	// set the containing render tiles for every parent composite tile +1
-	// to have the number of required render tiles in every composite tile
-	for (auto it = required_render_tiles.begin(); it != required_render_tiles.end(); ++it) {
-		TilePath tile = TilePath::byTilePos(*it, depth);
-		while (tile.getDepth() != 0) {
-			tile = tile.parent();
-			containing_render_tiles[tile]++;
+	// and count them for every parent composite tile, level by level from bottom to top
+	std::vector<std::pair<TilePath, int> > level;
+	level.reserve(required_render_tiles.size());
+	for (auto it = required_render_tiles.begin(); it != required_render_tiles.end(); ++it)
+		level.push_back(std::make_pair(TilePath::byTilePos(*it, depth), 1));
+	std::sort(level.begin(), level.end());
+
+	while (!level.empty() && level[0].first.getDepth() != 0) {
+		// sum up the counts of tiles with the same parent
+		size_t size = 0;
+		for (size_t i = 0; i < level.size(); i++) {
+			TilePath parent = level[i].first.parent();
+			if (size > 0 && level[size - 1].first == parent)
+				level[size - 1].second += level[i].second;
+			else
+				level[size++] = std::make_pair(parent, level[i].second);
+		}
+		level.resize(size);
+
+		for (auto it = level.begin(); it != level.end(); ++it) {
+			auto tile_it = std::lower_bound(composite_tiles.begin(), composite_tiles.end(),
+					it->first);
+			if (tile_it != composite_tiles.end() && *tile_it == it->first)
+				containing_render_tiles[tile_it - composite_tiles.begin()] = it->second;
 		}
 	}
 }
 
-void TileSet::scan(const mc::World& world) {
+void TileSet::scan(const mc::World& world, TileSetIndex* index) {
 	TilePos tile_offset(0, 0);
-	scan(world, false, tile_offset);
+	scan(world, false, tile_offset, index);
 	setDepth(min_depth);
 }
 
-void TileSet::scan(const mc::World& world, bool auto_center, TilePos& tile_offset) {
-	findRenderTiles(world, auto_center, tile_offset);
+void TileSet::scan(const mc::World& world, bool auto_center, TilePos& tile_offset,
+		TileSetIndex* index) {
+	findRenderTiles(world, auto_center, tile_offset, index);
 	setDepth(min_depth);
 }
 
 void TileSet::scanRequiredByTimestamp(int last_change) {
 	required_render_tiles.clear();
 
-	for (std::map<TilePos, int>::iterator it = tile_timestamps.begin();
-			it != tile_timestamps.end(); ++it) {
-		if (it->second >= last_change)
-			required_render_tiles.insert(it->first);
+	for (size_t i = 0; i < render_tiles.size(); i++) {
+		if (tile_timestamps[i] >= last_change)
+			required_render_tiles.push_back(render_tiles[i]);
 	}
 
 	required_composite_tiles.clear();
@@ -430,16 +754,146 @@ void TileSet::scanRequiredByTimestamp(int last_change) {
 	updateContainingRenderTiles();
 }
 
+/**
+ * Modification times of render tile files, found by walking the output directory.
+ */
+struct TileFileTimes {
+	TileFileTimes()
+		: stats(0), directories(0) {}
+
+	// (tile path key, modification time) of every render tile file
+	std::vector<std::pair<uint64_t, int64_t> > times;
+	long stats, directories;
+};
+
+#ifdef HAVE_FSTATAT
+
+/**
+ * Walks a directory of the output directory in the order of its entries. The directory
+ * file descriptor is closed afterwards. Only the files of render tiles are stat'ed, the
+ * subdirectories are entered without stat'ing them.
+ */
+void walkTileFiles(int fd, const TilePath& path, int depth, const std::string& suffix,
+		TileFileTimes& times) {
+	DIR* dir = fdopendir(fd);
+	if (dir == nullptr) {
+		close(fd);
+		return;
+	}
+	times.directories++;
+
+	bool render_tiles = path.getDepth() + 1 == depth;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr) {
+		const char* name = entry->d_name;
+		if (name[0] < '1' || name[0] > '4')
+			continue;
+		int node = name[0] - '0';
+		if (name[1] == '\0' && !render_tiles) {
+			int child = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY);
+			if (child != -1)
+				walkTileFiles(child, path + node, depth, suffix, times);
+		} else if (render_tiles && name[1] == '.' && suffix == name + 2) {
+			struct stat st;
+			times.stats++;
+			if (fstatat(dirfd(dir), name, &st, 0) == 0 && S_ISREG(st.st_mode))
+				times.times.push_back(std::make_pair((path + node).getKey(),
+						(int64_t) st.st_mtime));
+		}
+	}
+	closedir(dir);
+}
+
+void walkTileFiles(const fs::path& dir, const TilePath& path, int depth,
+		const std::string& suffix, TileFileTimes& times) {
+	int fd = open(dir.string().c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd != -1)
+		walkTileFiles(fd, path, depth, suffix, times);
+}
+
+#else
+
+void walkTileFiles(const fs::path& dir, const TilePath& path, int depth,
+		const std::string& suffix, TileFileTimes& times) {
+	boost::system::error_code error;
+	fs::directory_iterator it(dir, error), end;
+	if (error)
+		return;
+	times.directories++;
+
+	bool render_tiles = path.getDepth() + 1 == depth;
+	for (; it != end; it.increment(error)) {
+		if (error)
+			break;
+		std::string name = it->path().filename().string();
+		if (name.empty() || name[0] < '1' || name[0] > '4')
+			continue;
+		int node = name[0] - '0';
+		if (name.size() == 1 && !render_tiles) {
+			walkTileFiles(it->path(), path + node, depth, suffix, times);
+		} else if (render_tiles && name.substr(1) == "." + suffix) {
+			times.stats++;
+			std::time_t mtime = fs::last_write_time(it->path(), error);
+			if (!error)
+				times.times.push_back(std::make_pair((path + node).getKey(),
+						(int64_t) mtime));
+		}
+	}
+}
+
+#endif
+
 void TileSet::scanRequiredByFiletimes(const fs::path& output_dir,
-		std::string image_format) {
+		std::string image_format, int threads) {
 	required_render_tiles.clear();
 
-	for (std::map<TilePos, int>::iterator it = tile_timestamps.begin();
-			it != tile_timestamps.end(); ++it) {
-		TilePath path = TilePath::byTilePos(it->first, depth);
-		fs::path file = output_dir / (path.toString() + "." + image_format);
-		if (!fs::exists(file) || fs::last_write_time(file) <= it->second)
-			required_render_tiles.insert(it->first);
+	// the directories of the composite tiles of one zoom level are walked in parallel,
+	// there are only directories for composite tiles which were already rendered
+	int level = std::min(std::max(depth - 1, 0), 3);
+	std::vector<TilePath> directories;
+	for (auto it = composite_tiles.begin(); it != composite_tiles.end(); ++it)
+		if (it->getDepth() == level)
+			directories.push_back(*it);
+
+	threads = std::max(1, std::min(threads, (int) directories.size()));
+	std::vector<TileFileTimes> thread_times(threads);
+	std::atomic<size_t> next_directory(0);
+	auto walk = [&](TileFileTimes& times) {
+		size_t i;
+		while ((i = next_directory++) < directories.size())
+			walkTileFiles(output_dir / directories[i].toString(), directories[i], depth,
+					image_format, times);
+	};
+	std::vector<thread_ns::thread> walkers;
+	for (int i = 1; i < threads; i++)
+		walkers.push_back(thread_ns::thread(walk, std::ref(thread_times[i])));
+	walk(thread_times[0]);
+	for (size_t i = 0; i < walkers.size(); i++)
+		walkers[i].join();
+
+	TileFileTimes times;
+	for (auto it = thread_times.begin(); it != thread_times.end(); ++it) {
+		times.times.insert(times.times.end(), it->times.begin(), it->times.end());
+		times.stats += it->stats;
+		times.directories += it->directories;
+	}
+	std::sort(times.times.begin(), times.times.end());
+	LOG(INFO) << "Found " << times.times.size() << " tile images with "
+			<< times.stats << " stat calls in " << times.directories << " directories.";
+
+	scanRequiredByTileTimes(times.times);
+}
+
+void TileSet::scanRequiredByTileTimes(const std::vector<std::pair<uint64_t, int64_t> >& times) {
+	required_render_tiles.clear();
+
+	// a tile is required if its image does not exist or is older than its chunks
+	for (size_t i = 0; i < render_tiles.size(); i++) {
+		uint64_t key = TilePath::byTilePos(render_tiles[i], depth).getKey();
+		auto it = std::lower_bound(times.begin(), times.end(),
+				std::make_pair(key, std::numeric_limits<int64_t>::min()));
+		if (it == times.end() || it->first != key || it->second <= tile_timestamps[i])
+			required_render_tiles.push_back(render_tiles[i]);
 	}
 
 	required_composite_tiles.clear();
@@ -448,6 +902,83 @@ void TileSet::scanRequiredByFiletimes(const fs::path& output_dir,
 	updateContainingRenderTiles();
 }
 
+void TileSet::scanRequiredByHashes(const mc::World& world, int last_change,
+		ChunkHashIndex& hashes) {
+	required_render_tiles.clear();
+	hashes.read_chunks = 0;
+	hashes.changed_sections = 0;
+
+	// the (not centered) tiles covered by changed sections
+	std::vector<TilePos> tiles;
+
+	auto regions = world.getAvailableRegions();
+	for (auto region_it = regions.begin(); region_it != regions.end(); ++region_it) {
+		mc::RegionFile region;
+		if (!world.getRegion(*region_it, region) || !region.readOnlyHeaders())
+			continue;
+
+		// read the whole region file only if it has chunks with newer timestamps
+		const std::set<mc::ChunkPos>& region_chunks = region.getContainingChunks();
+		bool changed = false;
+		for (auto chunk_it = region_chunks.begin(); chunk_it != region_chunks.end();
+				++chunk_it)
+			if ((int) region.getChunkTimestamp(*chunk_it) >= last_change)
+				changed = true;
+		if (!changed || !region.read())
+			continue;
+
+		mc::Chunk chunk;
+		for (auto chunk_it = region_chunks.begin(); chunk_it != region_chunks.end();
+				++chunk_it) {
+			if ((int) region.getChunkTimestamp(*chunk_it) < last_change)
+				continue;
+			hashes.read_chunks++;
+			// chunks which can't be read are always required
+			if (region.loadChunk(*chunk_it, chunk) != mc::RegionFile::CHUNK_OK) {
+				getChunkTiles(*chunk_it, tiles);
+				hashes.chunks.erase(*chunk_it);
+				continue;
+			}
+
+			ChunkHashIndex::SectionHashes new_hashes;
+			for (int i = 0; i < mc::CHUNK_HEIGHT; i++) {
+				uint64_t hash = chunk.getSectionHash(i);
+				new_hashes[i] = hash != 0 ? (uint32_t) (hash ^ (hash >> 32)) | 1 : 0;
+			}
+
+			// all tiles of chunks without old hashes are required,
+			// otherwise only the tiles of the changed sections
+			auto old_hashes = hashes.chunks.find(*chunk_it);
+			if (old_hashes == hashes.chunks.end()) {
+				getChunkTiles(*chunk_it, tiles);
+				hashes.changed_sections += mc::CHUNK_HEIGHT;
+				hashes.chunks[*chunk_it] = new_hashes;
+				continue;
+			}
+			for (int i = 0; i < mc::CHUNK_HEIGHT; i++) {
+				if (old_hashes->second[i] != new_hashes[i]) {
+					getChunkSectionTiles(*chunk_it, i, tiles);
+					hashes.changed_sections++;
+				}
+			}
+			old_hashes->second = new_hashes;
+		}
+	}
+
+	// the required tiles are the available ones of the tiles with changed sections
+	for (auto it = tiles.begin(); it != tiles.end(); ++it)
+		*it -= tile_offset;
+	std::sort(tiles.begin(), tiles.end());
+	tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+	std::set_intersection(tiles.begin(), tiles.end(), render_tiles.begin(), render_tiles.end(),
+			std::back_inserter(required_render_tiles));
+
+	required_composite_tiles.clear();
+	findRequiredCompositeTiles(required_render_tiles, required_composite_tiles);
+
+	updateContainingRenderTiles();
+}
+
 int TileSet::getMinDepth() const {
 	return min_depth;
 }
@@ -479,21 +1010,24 @@ const TilePos& TileSet::getTileOffset() const {
 
 bool TileSet::hasTile(const TilePath& path) const {
 	if (path.getDepth() == depth)
-		return render_tiles.count(path.getTilePos()) != 0;
-	return composite_tiles.count(path) != 0;
+		return std::binary_search(render_tiles.begin(), render_tiles.end(),
+				path.getTilePos());
+	return std::binary_search(composite_tiles.begin(), composite_tiles.end(), path);
 }
 
 bool TileSet::isTileRequired(const TilePath& path) const {
 	if(path.getDepth() == depth)
-		return required_render_tiles.count(path.getTilePos()) != 0;
-	return required_composite_tiles.count(path) != 0;
+		return std::binary_search(required_render_tiles.begin(),
+				required_render_tiles.end(), path.getTilePos());
+	return std::binary_search(required_composite_tiles.begin(),
+			required_composite_tiles.end(), path);
 }
 
 int TileSet::getRequiredRenderTilesCount() const {
 	return required_render_tiles.size();
 }
 
-const std::set<TilePos>& TileSet::getRequiredRenderTiles() const {
+const std::vector<TilePos>& TileSet::getRequiredRenderTiles() const {
 	return required_render_tiles;
 }
 
@@ -501,12 +1035,64 @@ int TileSet::getRequiredCompositeTilesCount() const {
 	return required_composite_tiles.size();
 }
 
-const std::set<TilePath>& TileSet::getRequiredCompositeTiles() const {
+const std::vector<TilePath>& TileSet::getRequiredCompositeTiles() const {
 	return required_composite_tiles;
 }
 
+void TileSet::addRequiredRenderTiles(const std::vector<TilePath>& tiles) {
+	if (tiles.empty())
+		return;
+
+	for (auto it = tiles.begin(); it != tiles.end(); ++it)
+		if (it->getDepth() == depth && hasTile(*it))
+			required_render_tiles.push_back(it->getTilePos());
+	std::sort(required_render_tiles.begin(), required_render_tiles.end());
+	required_render_tiles.erase(std::unique(required_render_tiles.begin(),
+			required_render_tiles.end()), required_render_tiles.end());
+
+	required_composite_tiles.clear();
+	findRequiredCompositeTiles(required_render_tiles, required_composite_tiles);
+
+	updateContainingRenderTiles();
+}
+
+void TileSet::removeRequiredSubtrees(const std::set<TilePath>& tiles) {
+	if (tiles.empty())
+		return;
+
+	std::vector<TilePos> remaining_render_tiles;
+	for (auto it = required_render_tiles.begin(); it != required_render_tiles.end(); ++it)
+		if (!isInSubtrees(TilePath::byTilePos(*it, depth), tiles))
+			remaining_render_tiles.push_back(*it);
+	required_render_tiles.swap(remaining_render_tiles);
+
+	std::vector<TilePath> remaining_composite_tiles;
+	for (auto it = required_composite_tiles.begin();
+			it != required_composite_tiles.end(); ++it)
+		if (!isInSubtrees(*it, tiles))
+			remaining_composite_tiles.push_back(*it);
+	// the composite tiles containing the finished tiles need to get composed again,
+	// even if the scan did not require them because of the new tile images
+	for (auto it = tiles.begin(); it != tiles.end(); ++it)
+		for (TilePath tile = *it; tile.getDepth() > 0; ) {
+			tile = tile.parent();
+			if (!isInSubtrees(tile, tiles) && std::binary_search(composite_tiles.begin(),
+					composite_tiles.end(), tile))
+				remaining_composite_tiles.push_back(tile);
+		}
+	std::sort(remaining_composite_tiles.begin(), remaining_composite_tiles.end());
+	remaining_composite_tiles.erase(std::unique(remaining_composite_tiles.begin(),
+			remaining_composite_tiles.end()), remaining_composite_tiles.end());
+	required_composite_tiles.swap(remaining_composite_tiles);
+
+	updateContainingRenderTiles();
+}
+
 int TileSet::getContainingRenderTiles(const TilePath& tile) const {
-	return containing_render_tiles.at(tile);
+	auto it = std::lower_bound(composite_tiles.begin(), composite_tiles.end(), tile);
+	if (it == composite_tiles.end() || !(*it == tile))
+		throw std::out_of_range("Unknown composite tile " + tile.toString());
+	return containing_render_tiles[it - composite_tiles.begin()];
 }
 
 }
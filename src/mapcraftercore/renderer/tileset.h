@@ -22,7 +22,13 @@
 
 #include "../mc/world.h"
 
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <boost/filesystem.hpp>
 
@@ -95,6 +101,11 @@ private:
  * This class represents the path of a tile in the quadtree.
  * Every part in the path is a 1, 2, 3 or 4.
  * The length of the path is the zoom level of the tile.
+ *
+ * The path is packed into a single 64 bit value: The upper 6 bits are the zoom level,
+ * the lower bits are the quadkey with two bits (part - 1) for every part of the path,
+ * the first part in the most significant bits. So paths don't need any heap memory and
+ * are cheap to copy, compare and hash.
  */
 class TilePath {
 public:
@@ -102,6 +113,11 @@ public:
 	TilePath(const std::vector<int>& path);
 	~TilePath();
 
+	/**
+	 * The maximum zoom level a path can have.
+	 */
+	static const int MAX_DEPTH = 29;
+
 	/**
 	 * Returns the zoom level of the path.
 	 */
@@ -110,7 +126,12 @@ public:
 	/**
 	 * Returns the path.
 	 */
-	const std::vector<int>& getPath() const;
+	std::vector<int> getPath() const;
+
+	/**
+	 * Returns the packed (zoom level, quadkey) value of the path.
+	 */
+	uint64_t getKey() const;
 
 	/**
 	 * Returns the path of the parent tile.
@@ -125,12 +146,20 @@ public:
 
 	/**
 	 * Calculates the path (with a specified zoom level) of a tile position.
-	 * Opposite of getTilePos-method.
+	 * Opposite of getTilePos-method. Throws a std::runtime_error if the tile position
+	 * is not on the zoom level or if the zoom level is greater than MAX_DEPTH.
 	 */
 	static TilePath byTilePos(const TilePos& tile, int depth);
 
 	/**
-	 * Adds a node to the path.
+	 * Returns the path of a packed (zoom level, quadkey) value.
+	 * Opposite of getKey-method.
+	 */
+	static TilePath byKey(uint64_t key);
+
+	/**
+	 * Adds a node to the path. Throws a std::runtime_error if the node is invalid or if
+	 * the path would be longer than MAX_DEPTH.
 	 */
 	TilePath& operator+=(int node);
 	TilePath operator+(int node) const;
@@ -144,12 +173,167 @@ public:
 	 */
 	std::string toString() const;
 private:
-	std::vector<int> path;
+	uint64_t key;
+
+	/**
+	 * Returns the quadkey of the first parts (up to the zoom level depth) of the path.
+	 */
+	uint64_t getQuadkey(int depth) const;
 };
 
 std::ostream& operator<<(std::ostream& stream, const TilePath& path);
 std::ostream& operator<<(std::ostream& stream, const TilePos& tile);
 
+}
+}
+
+namespace std {
+
+template <>
+struct hash<mapcrafter::renderer::TilePath> {
+	size_t operator()(const mapcrafter::renderer::TilePath& path) const {
+		return std::hash<uint64_t>()(path.getKey());
+	}
+};
+
+}
+
+namespace mapcrafter {
+namespace renderer {
+
+/**
+ * Calculates the (not centered) render tiles a chunk covers.
+ * The tiles may contain duplicates.
+ */
+void getChunkTiles(const mc::ChunkPos& chunk, std::vector<TilePos>& tiles);
+
+/**
+ * Calculates the (not centered) render tiles a section (0 is the lowest one) of a chunk
+ * covers. The tiles may contain duplicates.
+ */
+void getChunkSectionTiles(const mc::ChunkPos& chunk, int section, std::vector<TilePos>& tiles);
+
+/**
+ * The render tiles every region of a world covers, saved in the output directory between
+ * the runs. When a world is scanned with an index, only the headers of the regions whose
+ * region files were changed since the last run need to be read again.
+ */
+class TileSetIndex {
+public:
+	TileSetIndex();
+	~TileSetIndex();
+
+	/**
+	 * Reads/writes the index from/to a file. The key describes everything else than the
+	 * region files which has an effect on the tiles (world directory, rotation, crop,
+	 * ...), an index with a different key is not used.
+	 */
+	bool read(const std::string& filename, const std::string& key);
+	bool write(const std::string& filename, const std::string& key) const;
+
+	/**
+	 * Returns the count of regions which were scanned / taken from the index by the
+	 * last scan.
+	 */
+	int getScannedRegionsCount() const;
+	int getIndexedRegionsCount() const;
+
+private:
+	struct Region {
+		// modification time and size of the region file when it was scanned
+		int64_t mtime;
+		uint64_t size;
+		// the (not centered) render tiles the chunks of the region cover, sorted,
+		// with the highest timestamp of the chunks of the region in each tile
+		std::vector<std::pair<TilePos, int> > tiles;
+	};
+
+	std::unordered_map<mc::RegionPos, Region, mc::hash_function> regions;
+	int scanned_regions, indexed_regions;
+
+	friend class TileSet;
+};
+
+/**
+ * Hashes of the data of all chunk sections of a world at the time of the last rendering.
+ * Minecraft updates the timestamps of chunks which were only loaded, so tiles whose chunks
+ * have a newer timestamp did not necessarily change. With the hashes only the tiles which
+ * are covered by actually changed chunk sections need to get rendered.
+ */
+class ChunkHashIndex {
+public:
+	ChunkHashIndex();
+	~ChunkHashIndex();
+
+	/**
+	 * Reads/writes the hashes from/to a file. The key describes the world configuration
+	 * like the key of the TileSetIndex, hashes with a different key are not used.
+	 */
+	bool read(const std::string& filename, const std::string& key);
+	bool write(const std::string& filename, const std::string& key) const;
+
+	/**
+	 * Returns the count of chunks which were read and the count of changed chunk
+	 * sections found by the last scan.
+	 */
+	int getReadChunksCount() const;
+	int getChangedSectionsCount() const;
+
+private:
+	struct ChunkPosHash {
+		size_t operator()(const mc::ChunkPos& chunk) const {
+			return std::hash<uint64_t>()(((uint64_t) (uint32_t) chunk.x << 32)
+					| (uint32_t) chunk.z);
+		}
+	};
+
+	// the 32 bit hashes of the sections of every chunk, 0 for not existing sections
+	typedef std::array<uint32_t, mc::CHUNK_HEIGHT> SectionHashes;
+	std::unordered_map<mc::ChunkPos, SectionHashes, ChunkPosHash> chunks;
+
+	int read_chunks, changed_sections;
+
+	friend class TileSet;
+};
+
+/**
+ * Hashes of the images of the tiles of a map rotation which were written by the last
+ * renderings. A rendered tile whose image has the same hash as before is not written
+ * again, and composite tiles whose children did not change are not composed again.
+ */
+class TileHashIndex {
+public:
+	TileHashIndex();
+	~TileHashIndex();
+
+	/**
+	 * Reads/writes the hashes from/to a file. The key describes everything which has an
+	 * effect on the tile files besides their images (image format, zoom level, tile
+	 * offset, ...), hashes with a different key are not used.
+	 */
+	bool read(const std::string& filename, const std::string& key);
+	bool write(const std::string& filename, const std::string& key) const;
+
+	/**
+	 * Returns/sets the hash of the image of a tile, 0 if there is no hash of the tile.
+	 * Setting the hash 0 removes the hash of the tile.
+	 */
+	uint64_t getHash(const TilePath& tile) const;
+	void setHash(const TilePath& tile, uint64_t hash);
+
+	/**
+	 * Removes the hashes of all tiles which are not one of the specified tiles or
+	 * contained in one of them.
+	 */
+	void retainSubtrees(const std::set<TilePath>& tiles);
+
+	size_t size() const;
+
+private:
+	// the image hashes by the keys of the tile paths
+	std::unordered_map<uint64_t, uint64_t> hashes;
+};
+
 /**
  * This class manages all tiles required to render a world.
  */
@@ -168,9 +352,13 @@ public:
 	 * found tiles. If set to false (default), it will use tile_offset as center. The
 	 * default value for tile_offset is (0, 0) when using scan without the
 	 * auto_center and tile_offset parameters.
+	 *
+	 * If an index is given, the tiles of regions which weren't changed since the index
+	 * was created are taken from it, and the index is updated with the scanned regions.
 	 */
-	void scan(const mc::World& world);
-	void scan(const mc::World& world, bool auto_center, TilePos& tile_offset);
+	void scan(const mc::World& world, TileSetIndex* index = nullptr);
+	void scan(const mc::World& world, bool auto_center, TilePos& tile_offset,
+			TileSetIndex* index = nullptr);
 
 	/**
 	 * Scans which tiles are required by testing which tiles were probably changed since
@@ -180,10 +368,39 @@ public:
 
 	/**
 	 * Scans which tiles are required by using the modification times of the already
-	 * rendered image files.
+	 * rendered image files. The output directory is walked once with the specified count
+	 * of threads instead of looking up the file of every render tile.
 	 */
 	void scanRequiredByFiletimes(const fs::path& output_dir,
-			std::string image_format = "png");
+			std::string image_format = "png", int threads = 1);
+
+	/**
+	 * Scans which tiles are required by using the sorted (tile path key, modification
+	 * time) pairs of the already rendered images, for example from a tile archive.
+	 */
+	void scanRequiredByTileTimes(const std::vector<std::pair<uint64_t, int64_t> >& times);
+
+	/**
+	 * Scans which tiles are required by comparing the hashes of the chunk sections with
+	 * the hashes of the last rendering. Only the chunks with a timestamp newer than
+	 * last_change are read and only the tiles covered by their changed sections are
+	 * required. The hashes are updated with the read chunks.
+	 */
+	void scanRequiredByHashes(const mc::World& world, int last_change,
+			ChunkHashIndex& hashes);
+
+	/**
+	 * Marks the specified render tiles and the composite tiles containing them as
+	 * required, for example the tiles an interrupted rendering required.
+	 */
+	void addRequiredRenderTiles(const std::vector<TilePath>& tiles);
+
+	/**
+	 * Marks the specified tiles and all tiles contained in them as not required,
+	 * for example the tiles an interrupted rendering already rendered. The composite
+	 * tiles containing them are required.
+	 */
+	void removeRequiredSubtrees(const std::set<TilePath>& tiles);
 
 	/**
 	 * Returns the minimum maximum zoom level required to render all render tiles.
@@ -222,9 +439,9 @@ public:
 	int getRequiredRenderTilesCount() const;
 
 	/**
-	 * Returns the required render tiles.
+	 * Returns the required render tiles (sorted).
 	 */
-	const std::set<TilePos>& getRequiredRenderTiles() const;
+	const std::vector<TilePos>& getRequiredRenderTiles() const;
 
 	/**
 	 * Returns the count of required composite tiles.
@@ -232,9 +449,9 @@ public:
 	int getRequiredCompositeTilesCount() const;
 
 	/**
-	 * Returns the required composite tiles.
+	 * Returns the required composite tiles (sorted).
 	 */
-	const std::set<TilePath>& getRequiredCompositeTiles() const;
+	const std::vector<TilePath>& getRequiredCompositeTiles() const;
 
 	/**
 	 * Returns the count of required render tiles a specific composite tiles contains.
@@ -252,21 +469,24 @@ private:
 	// but are actually rendered as pos+tile_offset
 	TilePos tile_offset;
 
+	// all tiles are stored in sorted vectors, lookups are binary searches
+
 	// all available render tiles
 	// (= tiles with the highest zoom level, tree leaves in the quadtree)
-	std::set<TilePos> render_tiles;
+	std::vector<TilePos> render_tiles;
 	// the render tiles which actually need to get rendered
-	std::set<TilePos> required_render_tiles;
+	std::vector<TilePos> required_render_tiles;
 	// timestamps of render tiles required to re-render a tile
-	// (= highest timestamp of all chunks in a tile)
-	std::map<TilePos, int> tile_timestamps;
+	// (= highest timestamp of all chunks in a tile), same indices as render_tiles
+	std::vector<int> tile_timestamps;
 
 	// same here for composite tiles
-	std::set<TilePath> composite_tiles;
-	std::set<TilePath> required_composite_tiles;
+	std::vector<TilePath> composite_tiles;
+	std::vector<TilePath> required_composite_tiles;
 
-	// count of required render tiles contained in a composite tile
-	std::map<TilePath, int> containing_render_tiles;
+	// count of required render tiles contained in a composite tile,
+	// same indices as composite_tiles
+	std::vector<int> containing_render_tiles;
 
 	/**
 	 * This method finds out which render level tiles a world has and which maximum
@@ -275,7 +495,8 @@ private:
 	 * The auto_center parameter describes whether it should automatically center the
 	 * found tiles. If set to false (default), it will use tile_offset as center.
 	 */
-	void findRenderTiles(const mc::World& world, bool auto_center, TilePos& tile_offset);
+	void findRenderTiles(const mc::World& world, bool auto_center, TilePos& tile_offset,
+			TileSetIndex* index);
 
 	/**
 	 * This method finds out which composite tiles are needed, depending on a
@@ -283,8 +504,8 @@ private:
 	 * So we can find out which composite tiles are available and which composite tiles
 	 * need to get rendered.
 	 */
-	void findRequiredCompositeTiles(const std::set<TilePos>& render_tiles,
-			std::set<TilePath>& tiles);
+	void findRequiredCompositeTiles(const std::vector<TilePos>& render_tiles,
+			std::vector<TilePath>& tiles);
 
 	/**
 	 * Updates the containing_render_tiles map.
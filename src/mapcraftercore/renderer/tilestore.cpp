@@ -0,0 +1,142 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tilestore.h"
+
+#include "../util.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace mapcrafter {
+namespace renderer {
+
+TileStore::TileStore(const fs::path& dir, const std::string& suffix,
+		const std::string& encoding, bool deduplicate)
+	: dir(dir), suffix(suffix), encoding(encoding), deduplicate(deduplicate),
+	  images_written(0), tiles_linked(0), write_time(0) {
+}
+
+TileStore::~TileStore() {
+}
+
+bool TileStore::isDeduplicating() const {
+	return deduplicate;
+}
+
+fs::path TileStore::getImageFile(uint64_t hash) const {
+	// the images are distributed over 256 directories by the first byte of the hash,
+	// images with other encoding parameters are never linked and removed by the cleanup
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx", (unsigned long long) hash);
+	return dir / encoding / std::string(name, 2) / (std::string(name) + "." + suffix);
+}
+
+fs::path TileStore::getTempFile(uint64_t hash) const {
+	fs::path file = getImageFile(hash);
+	if (!fs::exists(file.parent_path()))
+		fs::create_directories(file.parent_path());
+	return file.parent_path() / fs::unique_path("%%%%-%%%%-%%%%-%%%%.tmp");
+}
+
+bool TileStore::addImage(uint64_t hash, const fs::path& tmp_file, int64_t write_time) {
+	// a hard link is not created if there is already a file, so an image written by
+	// another thread at the same time is never replaced by this one
+	boost::system::error_code error;
+	fs::path file = getImageFile(hash);
+	fs::create_hard_link(tmp_file, file, error);
+	if (!error) {
+		images_written++;
+		this->write_time += write_time;
+	}
+	fs::remove(tmp_file, error);
+	return fs::exists(file);
+}
+
+bool TileStore::linkTile(const fs::path& file, uint64_t hash) {
+	// the link is created with a temporary name and replaces the tile file,
+	// so there is always a tile file
+	boost::system::error_code error;
+	fs::path tmp_file = file.string() + ".tmp";
+	fs::remove(tmp_file, error);
+	fs::create_hard_link(getImageFile(hash), tmp_file, error);
+	if (!error)
+		fs::rename(tmp_file, file, error);
+	// renaming does nothing if the tile file is already a link to the same image
+	boost::system::error_code remove_error;
+	fs::remove(tmp_file, remove_error);
+	if (error)
+		return false;
+	tiles_linked++;
+	return true;
+}
+
+void TileStore::cleanup() {
+	if (!fs::exists(dir))
+		return;
+
+	// every image has one link in the store and one link for every tile using it
+	int64_t images = 0, images_removed = 0, tiles = 0;
+	uint64_t size = 0, size_without_store = 0;
+	std::vector<fs::path> files, directories;
+	for (fs::recursive_directory_iterator it(dir), end; it != end; ++it) {
+		if (fs::is_directory(it->status()))
+			directories.push_back(it->path());
+		else
+			files.push_back(it->path());
+	}
+
+	for (auto it = files.begin(); it != files.end(); ++it) {
+		uint64_t links = fs::hard_link_count(*it);
+		if (links <= 1 || it->extension() == ".tmp") {
+			fs::remove(*it);
+			images_removed++;
+			continue;
+		}
+		uint64_t file_size = fs::file_size(*it);
+		images++;
+		tiles += links - 1;
+		size += file_size;
+		size_without_store += file_size * (links - 1);
+	}
+
+	// the subdirectories come after their parent directories
+	for (auto it = directories.rbegin(); it != directories.rend(); ++it)
+		if (fs::is_empty(*it))
+			fs::remove(*it);
+	if (fs::is_empty(dir))
+		fs::remove(dir);
+
+	if (!deduplicate)
+		return;
+	LOG(INFO) << tiles << " tile files use " << images << " unique images ("
+			<< size / 1024 << " KiB instead of " << size_without_store / 1024 << " KiB), "
+			<< images_removed << " unused images were removed.";
+	if (images_written > 0) {
+		int64_t linked = std::max((int64_t) 0, tiles_linked - images_written);
+		int64_t saved = write_time / images_written * linked / 1000;
+		LOG(INFO) << "Wrote " << images_written << " images and linked " << linked
+				<< " tiles to already written images, saved about "
+				<< saved << " ms of writing images.";
+	}
+}
+
+} /* namespace renderer */
+} /* namespace mapcrafter */
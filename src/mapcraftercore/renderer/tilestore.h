@@ -0,0 +1,102 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILESTORE_H_
+#define TILESTORE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace mapcrafter {
+namespace renderer {
+
+/**
+ * A content-addressed store for the tile images of a map rotation. Every unique tile
+ * image is written only once to the store (named by the hash of the image) and the tile
+ * files are hard links to the images in the store. The hash is the hash of the pixels,
+ * so the images are in a subdirectory for the encoding parameters (for example the JPEG
+ * quality) they were written with.
+ *
+ * Hard links share their modification time, so the modification times of deduplicated
+ * tile files can't tell whether a tile is up to date.
+ *
+ * All methods except cleanup can be used by multiple threads at once.
+ */
+class TileStore {
+public:
+	/**
+	 * Creates a store in a directory for images with a file suffix, written with the
+	 * encoding parameters described by a name (used as directory name). If deduplicate
+	 * is not set, the store is only used to remove the images of a previous rendering
+	 * with deduplicated tiles.
+	 */
+	TileStore(const fs::path& dir, const std::string& suffix, const std::string& encoding,
+			bool deduplicate);
+	~TileStore();
+
+	bool isDeduplicating() const;
+
+	/**
+	 * Returns the file of the image with a specific hash in the store.
+	 */
+	fs::path getImageFile(uint64_t hash) const;
+
+	/**
+	 * Returns a new temporary file in the store directory to write the image with a
+	 * specific hash to.
+	 */
+	fs::path getTempFile(uint64_t hash) const;
+
+	/**
+	 * Adds an image (written to a temporary file in the store directory) to the store,
+	 * the temporary file is removed. Does nothing if the store already has the image.
+	 * The microseconds spent to write the image are used for the statistics.
+	 */
+	bool addImage(uint64_t hash, const fs::path& tmp_file, int64_t write_time);
+
+	/**
+	 * Replaces a tile file with a hard link to an image in the store. The directory
+	 * of the tile file must exist.
+	 */
+	bool linkTile(const fs::path& file, uint64_t hash);
+
+	/**
+	 * Removes the images which are not used by tile files anymore and logs some
+	 * statistics about the store.
+	 */
+	void cleanup();
+
+private:
+	fs::path dir;
+	std::string suffix, encoding;
+	bool deduplicate;
+
+	// written images, tiles linked to already written images
+	std::atomic<int64_t> images_written, tiles_linked;
+	std::atomic<int64_t> write_time;
+};
+
+} /* namespace renderer */
+} /* namespace mapcrafter */
+
+#endif /* TILESTORE_H_ */
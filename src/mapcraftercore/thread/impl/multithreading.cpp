@@ -115,18 +115,28 @@ MultiThreadingDispatcher::~MultiThreadingDispatcher() {
 
 void MultiThreadingDispatcher::dispatch(const renderer::RenderContext& context,
 		std::shared_ptr<util::IProgressHandler> progress) {
-	auto tiles = context.tile_set->getRequiredCompositeTiles();
+	const auto& tiles = context.tile_set->getRequiredCompositeTiles();
 	if (tiles.size() == 0)
 		return;
 
 	int jobs = 0;
-	for (auto tile_it = tiles.begin(); tile_it != tiles.end(); ++tile_it)
-		if (tile_it->getDepth() == context.tile_set->getDepth() - 2) {
+	for (auto tile_it = tiles.begin(); tile_it != tiles.end(); ++tile_it) {
+		// composite tiles without required children (their subtrees were already
+		// rendered by an interrupted rendering) are composed right away, too
+		bool start = tile_it->getDepth() == context.tile_set->getDepth() - 2;
+		if (tile_it->getDepth() < context.tile_set->getDepth() - 2) {
+			start = true;
+			for (int i = 1; i <= 4; i++)
+				if (context.tile_set->isTileRequired(*tile_it + i))
+					start = false;
+		}
+		if (start) {
 			renderer::RenderWork work;
 			work.tiles.insert(*tile_it);
 			manager.addWork(work);
 			jobs++;
 		}
+	}
 
 	int render_tiles = context.tile_set->getRequiredRenderTilesCount();
 	LOG(INFO) << thread_count << " threads will render " << render_tiles << " render tiles.";
@@ -135,9 +145,17 @@ void MultiThreadingDispatcher::dispatch(const renderer::RenderContext& context,
 		threads.push_back(thread_ns::thread(ThreadWorker(manager, context)));
 
 	progress->setMax(context.tile_set->getRequiredRenderTilesCount());
+	// the new tile hashes are added when the workers are finished,
+	// they are still using the old ones
+	std::vector<std::pair<renderer::TilePath, uint64_t> > tile_hashes;
 	renderer::RenderWorkResult result;
 	while (manager.getResult(result)) {
 		progress->setValue(progress->getValue() + result.tiles_rendered);
+		renderer::journalRenderWork(context, result);
+		tile_hashes.insert(tile_hashes.end(), result.tile_hashes.begin(),
+				result.tile_hashes.end());
+
+		changed_tiles.insert(result.tiles_changed.begin(), result.tiles_changed.end());
 		for (auto tile_it = result.render_work.tiles.begin();
 				tile_it != result.render_work.tiles.end(); ++tile_it) {
 			rendered_tiles.insert(*tile_it);
@@ -158,8 +176,11 @@ void MultiThreadingDispatcher::dispatch(const renderer::RenderContext& context,
 				renderer::RenderWork work;
 				work.tiles.insert(parent);
 				for (int i = 1; i <= 4; i++)
-					if (context.tile_set->hasTile(parent + i))
+					if (context.tile_set->hasTile(parent + i)) {
 						work.tiles_skip.insert(parent + i);
+						if (changed_tiles.count(parent + i))
+							work.tiles_skip_changed.insert(parent + i);
+					}
 				manager.addExtraWork(work);
 			}
 		}
@@ -167,6 +188,10 @@ void MultiThreadingDispatcher::dispatch(const renderer::RenderContext& context,
 
 	for (int i = 0; i < thread_count; i++)
 		threads[i].join();
+
+	if (context.tile_hashes)
+		for (auto it = tile_hashes.begin(); it != tile_hashes.end(); ++it)
+			context.tile_hashes->setHash(it->first, it->second);
 }
 
 } /* namespace thread */
@@ -27,8 +27,8 @@
 #include "../../renderer/tilerenderworker.h"
 #include "../../util.h"
 
-#include <set>
 #include <thread>
+#include <unordered_set>
 #include <vector>
 
 namespace mapcrafter {
@@ -83,7 +83,7 @@ private:
 	ThreadManager manager;
 	std::vector<thread_ns::thread> threads;
 
-	std::set<renderer::TilePath> rendered_tiles;
+	std::unordered_set<renderer::TilePath> rendered_tiles, changed_tiles;
 };
 
 } /* namespace thread */
@@ -35,20 +35,55 @@ SingleThreadDispatcher::~SingleThreadDispatcher() {
 
 void SingleThreadDispatcher::dispatch(const renderer::RenderContext& context,
 		std::shared_ptr<util::IProgressHandler> progress) {
-	int render_tiles = context.tile_set->getRequiredRenderTilesCount();
-	if (render_tiles == 0)
+	const auto& tiles = context.tile_set->getRequiredCompositeTiles();
+	if (tiles.size() == 0)
 		return;
 
+	int render_tiles = context.tile_set->getRequiredRenderTilesCount();
 	LOG(INFO) << "Single thread will render " << render_tiles << " render tiles.";
 
-	renderer::RenderWork work;
-	work.tiles.insert(renderer::TilePath());
+	progress->setMax(render_tiles);
+	progress->setValue(0);
+
+	// the composite tiles two zoom levels above the render tiles are rendered as single
+	// render works like the multi threading dispatcher does it, so they can be journaled,
+	// the other composite tiles are composed at last
+	renderer::RenderWork last_work;
+	last_work.tiles.insert(renderer::TilePath());
 
 	renderer::TileRenderWorker worker;
 	worker.setRenderContext(context);
-	worker.setRenderWork(work);
-	worker.setProgressHandler(progress);
+	// the new tile hashes are added when all tiles are rendered
+	std::vector<std::pair<renderer::TilePath, uint64_t> > tile_hashes;
+	for (auto tile_it = tiles.begin(); tile_it != tiles.end(); ++tile_it) {
+		if (tile_it->getDepth() != context.tile_set->getDepth() - 2)
+			continue;
+		renderer::RenderWork work;
+		work.tiles.insert(*tile_it);
+		worker.setRenderWork(work);
+		worker();
+
+		const renderer::RenderWorkResult& result = worker.getRenderWorkResult();
+		progress->setValue(progress->getValue() + result.tiles_rendered);
+		renderer::journalRenderWork(context, result);
+		tile_hashes.insert(tile_hashes.end(), result.tile_hashes.begin(),
+				result.tile_hashes.end());
+		last_work.tiles_skip.insert(*tile_it);
+		if (result.tiles_changed.count(*tile_it))
+			last_work.tiles_skip_changed.insert(*tile_it);
+	}
+
+	worker.setRenderWork(last_work);
 	worker();
+	const renderer::RenderWorkResult& result = worker.getRenderWorkResult();
+	progress->setValue(progress->getValue() + result.tiles_rendered);
+	renderer::journalRenderWork(context, result);
+	tile_hashes.insert(tile_hashes.end(), result.tile_hashes.begin(),
+			result.tile_hashes.end());
+
+	if (context.tile_hashes)
+		for (auto it = tile_hashes.begin(); it != tile_hashes.end(); ++it)
+			context.tile_hashes->setHash(it->first, it->second);
 }
 
 } /* namespace thread */
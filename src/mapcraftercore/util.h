@@ -49,6 +49,7 @@ private:
 // include compat/*.h here if all files need it
 #include "compat/boost.h"
 
+#include "util/binaryfile.h"
 #include "util/filesystem.h"
 #include "util/logging.h"
 #include "util/progress.h"
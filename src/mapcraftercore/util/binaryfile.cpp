@@ -0,0 +1,102 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "binaryfile.h"
+
+#include "logging.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace mapcrafter {
+namespace util {
+
+bool readBinaryHeader(std::istream& in, const char* magic, uint32_t version) {
+	char file_magic[4];
+	in.read(file_magic, 4);
+	return in && std::memcmp(file_magic, magic, 4) == 0
+			&& readBinaryValue<uint32_t>(in) == version && in;
+}
+
+void writeBinaryHeader(std::ostream& out, const char* magic, uint32_t version) {
+	out.write(magic, 4);
+	writeBinaryValue<uint32_t>(out, version);
+}
+
+/**
+ * Returns the 64 bit FNV-1a hash of a key. Only the hash is stored in the files, the
+ * keys contain paths of the server (input directories of worlds, ...) which must not be
+ * published with the files in the output directory.
+ */
+uint64_t hashBinaryKey(const std::string& key) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < key.size(); i++) {
+		hash ^= (uint8_t) key[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+bool readBinaryHeader(std::istream& in, const char* magic, uint32_t version,
+		const std::string& key) {
+	if (!readBinaryHeader(in, magic, version))
+		return false;
+	return readBinaryValue<uint64_t>(in) == hashBinaryKey(key) && in;
+}
+
+void writeBinaryHeader(std::ostream& out, const char* magic, uint32_t version,
+		const std::string& key) {
+	writeBinaryHeader(out, magic, version);
+	writeBinaryValue<uint64_t>(out, hashBinaryKey(key));
+}
+
+bool writeFileAtomically(const fs::path& filename,
+		const std::function<void(std::ostream&)>& write) {
+	fs::path tmp_filename = filename.string() + ".tmp";
+	try {
+		if (filename.has_parent_path())
+			fs::create_directories(filename.parent_path());
+	} catch (fs::filesystem_error& e) {
+		LOG(WARNING) << e.what();
+		return false;
+	}
+
+	std::ofstream out(tmp_filename.string(), std::ios::binary);
+	if (!out)
+		return false;
+	write(out);
+	out.close();
+	boost::system::error_code error;
+	if (!out) {
+		fs::remove(tmp_filename, error);
+		return false;
+	}
+
+	fs::rename(tmp_filename, filename, error);
+	if (error) {
+		LOG(WARNING) << "Unable to replace '" << filename.string() << "': "
+				<< error.message();
+		fs::remove(tmp_filename, error);
+		return false;
+	}
+	return true;
+}
+
+} /* namespace util */
+} /* namespace mapcrafter */
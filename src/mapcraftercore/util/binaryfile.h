@@ -0,0 +1,78 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BINARYFILE_H_
+#define BINARYFILE_H_
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace mapcrafter {
+namespace util {
+
+/**
+ * Reads/writes a value in the binary files of the renderer (indexes, tile archives, ...)
+ * in the byte order of the machine.
+ */
+template <typename T>
+T readBinaryValue(std::istream& in) {
+	T value = T();
+	in.read((char*) &value, sizeof(T));
+	return value;
+}
+
+template <typename T>
+void writeBinaryValue(std::ostream& out, T value) {
+	out.write((const char*) &value, sizeof(T));
+}
+
+/**
+ * Reads/writes the header of a binary file: A four character magic and the version of
+ * the file format. Returns false if the file has a different magic or version.
+ */
+bool readBinaryHeader(std::istream& in, const char* magic, uint32_t version);
+void writeBinaryHeader(std::ostream& out, const char* magic, uint32_t version);
+
+/**
+ * Same as above, but the header also contains the hash of a key which describes
+ * everything the content of the file depends on, for example the configuration of a
+ * world. Returns false if the file has a different key.
+ */
+bool readBinaryHeader(std::istream& in, const char* magic, uint32_t version,
+		const std::string& key);
+void writeBinaryHeader(std::ostream& out, const char* magic, uint32_t version,
+		const std::string& key);
+
+/**
+ * Writes a file with a function writing the content to a stream. The content is written
+ * to a temporary file first which then replaces the file, so there is never a partially
+ * written file.
+ */
+bool writeFileAtomically(const fs::path& filename,
+		const std::function<void(std::ostream&)>& write);
+
+} /* namespace util */
+} /* namespace mapcrafter */
+
+#endif /* BINARYFILE_H_ */
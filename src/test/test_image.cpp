@@ -49,4 +49,65 @@ BOOST_AUTO_TEST_CASE(image_testIO) {
 				BOOST_ERROR("Images aren't equal!");
 		}
 	}
+
+	// the same with an image in memory
+	std::string buffer;
+	BOOST_CHECK(src.writePNGBuffer(buffer));
+	BOOST_CHECK(dest.readPNGBuffer(buffer));
+	BOOST_CHECK(dest.hash() == src.hash());
+
+	BOOST_CHECK(src.writeJPEGBuffer(buffer, 85));
+	BOOST_CHECK(dest.readJPEGBuffer(buffer, 2));
+	BOOST_CHECK_EQUAL(dest.getWidth(), src.getWidth() / 2);
+	BOOST_CHECK_EQUAL(dest.getHeight(), src.getHeight() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(image_testResizeHalf) {
+	renderer::RGBAImage src(38, 22);
+	for(int x = 0; x < src.getWidth(); x++)
+		for(int y = 0; y < src.getHeight(); y++)
+			src.setPixel(x, y, renderer::rgba(rand() % 256, rand() % 256,
+					rand() % 256, rand() % 256));
+
+	// resize the image to a position of a bigger image
+	renderer::RGBAImage dest(30, 20);
+	src.resizeHalf(dest, 7, 5);
+
+	for(int x = 0; x < dest.getWidth(); x++) {
+		for(int y = 0; y < dest.getHeight(); y++) {
+			int sx = 2 * (x - 7), sy = 2 * (y - 5);
+			renderer::RGBAPixel expected = 0;
+			if (sx >= 0 && sy >= 0 && sx + 1 < src.getWidth() && sy + 1 < src.getHeight()) {
+				for (int shift = 0; shift < 32; shift += 8) {
+					int sum = ((src.getPixel(sx, sy) >> shift) & 0xff)
+							+ ((src.getPixel(sx + 1, sy) >> shift) & 0xff)
+							+ ((src.getPixel(sx, sy + 1) >> shift) & 0xff)
+							+ ((src.getPixel(sx + 1, sy + 1) >> shift) & 0xff);
+					expected |= (renderer::RGBAPixel) ((sum + 2) / 4) << shift;
+				}
+			}
+			BOOST_CHECK_EQUAL(dest.getPixel(x, y), expected);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(image_testPool) {
+	renderer::RGBAImagePool pool;
+	size_t first = pool.borrow(16, 16);
+	renderer::RGBAImage& image = pool.get(first);
+	image.setPixel(3, 4, renderer::rgba(1, 2, 3, 4));
+	for (int i = 0; i < 100; i++)
+		pool.borrow(8, 8);
+	// references to borrowed images stay valid
+	BOOST_CHECK_EQUAL(image.getPixel(3, 4), renderer::rgba(1, 2, 3, 4));
+	BOOST_CHECK_EQUAL(&image, &pool.get(first));
+
+	// released images are borrowed again
+	pool.release(first + 1);
+	BOOST_CHECK_EQUAL(pool.borrow(8, 8), first + 1);
+	pool.release(0);
+	BOOST_CHECK_EQUAL(pool.borrow(32, 32), first);
+	BOOST_CHECK_EQUAL(&pool.get(first), &image);
+	BOOST_CHECK_EQUAL(image.getWidth(), 32);
+	BOOST_CHECK_EQUAL(image.getHeight(), 32);
 }
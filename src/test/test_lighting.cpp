@@ -0,0 +1,122 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../mapcraftercore/renderer/blockimages.h"
+#include "../mapcraftercore/renderer/image.h"
+#include "../mapcraftercore/renderer/rendermodes/lighting.h"
+
+#include <cstdlib>
+#include <boost/test/unit_test.hpp>
+
+namespace renderer = mapcrafter::renderer;
+
+/**
+ * Draws the shade of a face like the lighting rendermode did it before the face shader,
+ * with two triangles interpolated with doubles.
+ */
+void drawReferenceShade(renderer::RGBAImage& image, const renderer::CornerColors& corners) {
+	int size = image.getWidth();
+	double fyStep = (double) 1 / (size-1);
+	for (int triangle = 0; triangle < 2; triangle++) {
+		double c1 = corners[triangle == 0 ? 0 : 3];
+		double c2 = corners[triangle == 0 ? 2 : 1];
+		double c3 = corners[triangle == 0 ? 3 : 0];
+		double fy = 0;
+		for (int y = 0; y < size; y++, fy+=fyStep) {
+			double color1 = c1 + (c2 - c1)*fy;
+			double color2 = c1 + (c3 - c1)*fy;
+			double fx = y == 0 ? 1 : 0;
+			double fxStep = y == 0 ? 0 : (double) 1 / y;
+			for (int x = 0; x <= y; x++, fx+=fxStep) {
+				uint8_t color = (color1 + (color2 - color1)*fx) * 255;
+				if (triangle == 0)
+					image.pixel(x, y) = renderer::rgba(0, 0, 0, color);
+				else
+					image.pixel(size-1-x, size-1-y) = renderer::rgba(0, 0, 0, color);
+			}
+		}
+	}
+}
+
+void shadeReference(renderer::RGBAImage& image, int face,
+		const renderer::CornerColors& corners, int yoff, int ystart, int yend) {
+	int size = image.getWidth() / 2;
+	renderer::RGBAImage shade(size, size);
+	drawReferenceShade(shade, corners);
+
+	auto apply = [&](int src_x, int src_y, int x, int y) {
+		if (src_y < ystart || src_y > yend)
+			return;
+		uint8_t d = renderer::rgba_alpha(shade.pixel(src_x, src_y));
+		image.pixel(x, y) = renderer::rgba_multiply(image.pixel(x, y), d, d, d);
+	};
+
+	if (face == renderer::FaceShader::TOP) {
+		for (renderer::TopFaceIterator it(size); !it.end(); it.next())
+			apply(it.src_x, it.src_y, it.dest_x, it.dest_y + yoff);
+	} else {
+		int side = face == renderer::FaceShader::LEFT ? renderer::SideFaceIterator::LEFT
+				: renderer::SideFaceIterator::RIGHT;
+		int xoff = face == renderer::FaceShader::LEFT ? 0 : size;
+		for (renderer::SideFaceIterator it(size, side); !it.end(); it.next())
+			apply(it.src_x, it.src_y, it.dest_x + xoff, it.dest_y + size/2);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(lighting_testFaceShader) {
+	int sizes[] = {16, 12, 10, 32};
+	for (int size : sizes) {
+		renderer::FaceShader shader(size);
+		BOOST_CHECK_EQUAL(shader.getSize(), size);
+
+		for (int i = 0; i < 200; i++) {
+			renderer::RGBAImage image(size * 2, size * 2);
+			for (int x = 0; x < image.getWidth(); x++)
+				for (int y = 0; y < image.getHeight(); y++)
+					image.setPixel(x, y, renderer::rgba(rand() % 256, rand() % 256,
+							rand() % 256, rand() % 256));
+			renderer::RGBAImage expected = image;
+
+			renderer::CornerColors corners;
+			for (int j = 0; j < 4; j++)
+				corners[j] = (double) rand() / RAND_MAX;
+			int face = i % 3;
+			int yoff = face == renderer::FaceShader::TOP ? rand() % (size / 2) : 0;
+			int ystart = 0, yend = size - 1;
+			if (i % 2 == 1) {
+				ystart = rand() % size;
+				yend = ystart + rand() % size;
+			}
+
+			shader.shade(image, face, corners, yoff, ystart, yend);
+			shadeReference(expected, face, corners, yoff, ystart, yend);
+
+			int maxdiff = 0;
+			for (int x = 0; x < image.getWidth(); x++)
+				for (int y = 0; y < image.getHeight(); y++) {
+					renderer::RGBAPixel p1 = image.getPixel(x, y);
+					renderer::RGBAPixel p2 = expected.getPixel(x, y);
+					for (int shift = 0; shift < 32; shift += 8)
+						maxdiff = std::max(maxdiff,
+								std::abs((int) ((p1 >> shift) & 0xff) - (int) ((p2 >> shift) & 0xff)));
+				}
+			BOOST_CHECK_LE(maxdiff, 1);
+		}
+	}
+}
@@ -17,11 +17,27 @@
  * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "../mapcraftercore/mc/world.h"
+#include "../mapcraftercore/renderer/image.h"
+#include "../mapcraftercore/renderer/renderjournal.h"
+#include "../mapcraftercore/renderer/tilearchive.h"
+#include "../mapcraftercore/renderer/tilemanifest.h"
+#include "../mapcraftercore/renderer/tilerenderworker.h"
 #include "../mapcraftercore/renderer/tileset.h"
+#include "../mapcraftercore/renderer/tilestore.h"
 
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 
+namespace fs = boost::filesystem;
+
+namespace mc = mapcrafter::mc;
 namespace renderer = mapcrafter::renderer;
 
 #define PATH(a, b, c, d) ((((renderer::TilePath() + a) + b) + c) + d)
@@ -51,3 +67,528 @@ BOOST_AUTO_TEST_CASE(test_tilepos) {
 	}
 	BOOST_CHECK_EQUAL(paths.size(), 256);
 }
+
+BOOST_AUTO_TEST_CASE(test_tilepath) {
+	renderer::TilePath path = PATH(1, 2, 3, 4);
+	BOOST_CHECK_EQUAL(path.getDepth(), 4);
+	BOOST_CHECK_EQUAL(path.toString(), "1/2/3/4");
+	BOOST_CHECK_EQUAL(path.parent(), (renderer::TilePath() + 1) + 2 + 3);
+	BOOST_CHECK_EQUAL(path.parent().parent().parent().parent(), renderer::TilePath());
+	BOOST_CHECK(path.getPath() == std::vector<int>({1, 2, 3, 4}));
+	BOOST_CHECK_EQUAL(renderer::TilePath(path.getPath()), path);
+
+	// paths are ordered like the lists of their parts
+	BOOST_CHECK(renderer::TilePath() < path);
+	BOOST_CHECK(path.parent() < path);
+	BOOST_CHECK(path < renderer::TilePath() + 2);
+	BOOST_CHECK(PATH(1, 2, 3, 4) < PATH(1, 2, 4, 1));
+	BOOST_CHECK(!(path < path));
+
+	// the key has only space for paths up to the maximum depth
+	int max_depth = renderer::TilePath::MAX_DEPTH;
+	std::vector<int> parts(max_depth, 4);
+	renderer::TilePath longest(parts);
+	BOOST_CHECK_EQUAL(longest.getDepth(), max_depth);
+	BOOST_CHECK(longest.getPath() == parts);
+	BOOST_CHECK_THROW(longest + 1, std::runtime_error);
+	BOOST_CHECK_THROW(path + 5, std::runtime_error);
+	BOOST_CHECK_EQUAL(renderer::TilePath::byTilePos(longest.getTilePos(), max_depth),
+			longest);
+	BOOST_CHECK_THROW(renderer::TilePath::byTilePos(renderer::TilePos(0, 0), max_depth + 1),
+			std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_tilearchive) {
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	fs::path filename = dir / "tl.tiles";
+	renderer::TilePath tile1 = PATH(1, 2, 3, 4), tile2 = renderer::TilePath() + 3;
+
+	renderer::TileArchive archive;
+	BOOST_REQUIRE(archive.open(filename));
+	BOOST_CHECK(archive.writeTile(tile1, "first"));
+	BOOST_CHECK(archive.writeTile(tile2, "second"));
+	BOOST_CHECK(archive.writeTile(tile1, "third"));
+	BOOST_CHECK(archive.writeTile(renderer::TilePath(), "base"));
+	// written images can be read right away
+	std::string data;
+	BOOST_CHECK(archive.readTile(tile1, data));
+	BOOST_CHECK_EQUAL(data, "third");
+	BOOST_CHECK(archive.close());
+
+	// single tiles are looked up in the sorted index
+	BOOST_CHECK(renderer::TileArchive::readSingleTile(filename, tile2, data));
+	BOOST_CHECK_EQUAL(data, "second");
+	BOOST_CHECK(renderer::TileArchive::readSingleTile(filename, renderer::TilePath(), data));
+	BOOST_CHECK_EQUAL(data, "base");
+	BOOST_CHECK(!renderer::TileArchive::readSingleTile(filename, tile1 + 1, data));
+
+	// the replaced image is still in the archive until it is compacted
+	BOOST_REQUIRE(archive.open(filename));
+	BOOST_CHECK_EQUAL(archive.getTiles().size(), 3);
+	BOOST_CHECK(archive.readTile(tile1, data));
+	BOOST_CHECK_EQUAL(data, "third");
+	BOOST_CHECK(!archive.hasTile(tile1 + 1));
+	BOOST_CHECK(archive.getWastedSize() > 0);
+	uint64_t size = archive.getSize();
+	BOOST_CHECK(archive.compact());
+	BOOST_CHECK_EQUAL(archive.getWastedSize(), 0);
+	BOOST_CHECK(archive.getSize() < size);
+	BOOST_CHECK(archive.readTile(tile2, data));
+	BOOST_CHECK_EQUAL(data, "second");
+
+	// images written after the index are found again with an old index,
+	// a partially written image at the end is removed
+	std::string index = filename.string() + ".index";
+	BOOST_CHECK(archive.close());
+	fs::copy_file(index, index + ".old");
+	BOOST_REQUIRE(archive.open(filename));
+	BOOST_CHECK(archive.writeTile(tile2, "fourth"));
+	BOOST_CHECK(archive.close());
+	fs::remove(index);
+	fs::rename(index + ".old", index);
+	BOOST_CHECK(renderer::TileArchive::readSingleTile(filename, tile2, data));
+	BOOST_CHECK_EQUAL(data, "fourth");
+	BOOST_REQUIRE(archive.open(filename, true));
+	BOOST_CHECK(archive.readTile(tile2, data));
+	BOOST_CHECK_EQUAL(data, "fourth");
+	BOOST_CHECK(!archive.writeTile(tile2, "fifth"));
+	BOOST_CHECK(archive.close());
+	fs::resize_file(filename, fs::file_size(filename) - 1);
+	BOOST_REQUIRE(archive.open(filename));
+	BOOST_CHECK(archive.readTile(tile2, data));
+	BOOST_CHECK_EQUAL(data, "second");
+	BOOST_CHECK(archive.writeTile(tile2, "fifth"));
+
+	// the tiles of the old first zoom level are moved into the opposite corners
+	BOOST_CHECK(archive.close());
+	BOOST_REQUIRE(archive.open(filename));
+	BOOST_CHECK(archive.increaseDepth());
+	BOOST_CHECK(!archive.hasTile(renderer::TilePath()));
+	BOOST_CHECK(archive.readTile((renderer::TilePath() + 3) + 2, data));
+	BOOST_CHECK_EQUAL(data, "fifth");
+	BOOST_CHECK(archive.readTile(renderer::TilePath() + 1 + 4 + 2 + 3 + 4, data));
+	BOOST_CHECK_EQUAL(data, "third");
+
+	// only one process can change an archive at once
+	renderer::TileArchive archive2;
+	BOOST_CHECK(!archive2.open(filename));
+	BOOST_CHECK(archive2.open(filename, true));
+	BOOST_CHECK(archive2.close());
+
+	// removed tiles stay removed after opening the archive again and compacting it
+	renderer::TilePath removed = (renderer::TilePath() + 3) + 2;
+	BOOST_CHECK(archive.removeTile(removed));
+	BOOST_CHECK(!archive.hasTile(removed));
+	BOOST_CHECK(archive.close());
+	fs::remove(index);
+	BOOST_CHECK(!renderer::TileArchive::readSingleTile(filename, removed, data));
+	BOOST_REQUIRE(archive.open(filename));
+	BOOST_CHECK(!archive.hasTile(removed));
+	BOOST_CHECK(archive.getWastedSize() > 0);
+	BOOST_CHECK(archive.compact());
+	BOOST_CHECK(!archive.hasTile(removed));
+	BOOST_CHECK_EQUAL(archive.getTiles().size(), 1);
+	BOOST_CHECK(archive.close());
+	BOOST_CHECK(!renderer::TileArchive::readSingleTile(filename, removed, data));
+
+	fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(test_tilestore) {
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	renderer::TileStore store(dir / "tl.store", "png", "png", true);
+
+	// both tiles are links to the same image
+	fs::path tmp_file = store.getTempFile(42);
+	std::ofstream(tmp_file.string()) << "image";
+	BOOST_CHECK(store.addImage(42, tmp_file, 0));
+	BOOST_CHECK(!fs::exists(tmp_file));
+	fs::create_directories(dir / "tl/1");
+	BOOST_CHECK(store.linkTile(dir / "tl/1/2.png", 42));
+	BOOST_CHECK(store.linkTile(dir / "tl/1/2.png", 42));
+	BOOST_CHECK(store.linkTile(dir / "tl/3.png", 42));
+	BOOST_CHECK_EQUAL(fs::hard_link_count(store.getImageFile(42)), 3);
+
+	// images without tiles are removed
+	tmp_file = store.getTempFile(43);
+	std::ofstream(tmp_file.string()) << "unused";
+	BOOST_CHECK(store.addImage(43, tmp_file, 0));
+	store.cleanup();
+	BOOST_CHECK(fs::exists(store.getImageFile(42)));
+	BOOST_CHECK(!fs::exists(store.getImageFile(43)));
+
+	// images written with other encoding parameters are not used
+	renderer::TileStore store2(dir / "tl.store", "png", "png-2", true);
+	BOOST_CHECK(store2.getImageFile(42) != store.getImageFile(42));
+	BOOST_CHECK(!fs::exists(store2.getImageFile(42)));
+
+	fs::remove(dir / "tl/1/2.png");
+	fs::remove(dir / "tl/3.png");
+	store.cleanup();
+	BOOST_CHECK(!fs::exists(dir / "tl.store"));
+
+	fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(test_tilemanifest) {
+	fs::path filename = fs::temp_directory_path() / fs::unique_path();
+	for (int i = 0; i < 2; i++) {
+		renderer::TileManifest manifest("tl", "png");
+		BOOST_REQUIRE(manifest.open(filename));
+		manifest.addTile(PATH(1, 2, 3, 4), renderer::TileChange::WRITTEN, 0x1234);
+		manifest.addTile(renderer::TilePath(), renderer::TileChange::UNCHANGED, 42);
+		manifest.addTile(renderer::TilePath() + 2, renderer::TileChange::DELETED, 0);
+		BOOST_CHECK(manifest.close());
+	}
+
+	// the tiles of every rendering are appended
+	std::ifstream in(filename.string());
+	std::vector<std::string> lines;
+	for (std::string line; std::getline(in, line); )
+		lines.push_back(line);
+	BOOST_REQUIRE_EQUAL(lines.size(), 10);
+	BOOST_CHECK_EQUAL(lines[0].substr(0, 8), "# begin ");
+	BOOST_CHECK_EQUAL(lines[1], "W 0000000000001234 tl/1/2/3/4.png");
+	BOOST_CHECK_EQUAL(lines[2], "U 000000000000002a tl/base.png");
+	BOOST_CHECK_EQUAL(lines[3], "D 0000000000000000 tl/2.png");
+	BOOST_CHECK_EQUAL(lines[4].substr(0, 6), "# end ");
+	BOOST_CHECK_EQUAL(lines[6], lines[1]);
+
+	fs::remove(filename);
+}
+
+BOOST_AUTO_TEST_CASE(test_renderjournal) {
+	fs::path filename = fs::temp_directory_path() / fs::unique_path();
+	{
+		renderer::RenderJournal journal;
+		journal.setStartTime(1234);
+		journal.setForceRender(true);
+		journal.setRequiredTiles({PATH(1, 2, 3, 4) + 1, PATH(3, 1, 1, 1)});
+		BOOST_REQUIRE(journal.open(filename, "key", false));
+		std::vector<std::pair<renderer::TilePath, uint64_t> > hashes;
+		hashes.push_back(std::make_pair(PATH(1, 2, 3, 4) + 1, 42));
+		hashes.push_back(std::make_pair(PATH(3, 1, 1, 1), 43));
+		BOOST_CHECK(journal.addWork({PATH(1, 2, 3, 4)}, hashes));
+		BOOST_CHECK(journal.addWork({PATH(3, 1, 1, 1)}, {}));
+	}
+	// an incomplete record of an interrupted rendering is ignored
+	std::ofstream(filename.string(), std::ios::binary | std::ios::app) << "F12";
+
+	renderer::RenderJournal journal;
+	BOOST_CHECK(!journal.read(filename, "other key"));
+	BOOST_REQUIRE(journal.read(filename, "key"));
+	BOOST_CHECK_EQUAL(journal.getStartTime(), 1234);
+	BOOST_CHECK(journal.isForceRender());
+	BOOST_CHECK(journal.getRequiredTiles()
+			== std::vector<renderer::TilePath>({PATH(1, 2, 3, 4) + 1, PATH(3, 1, 1, 1)}));
+	BOOST_CHECK_EQUAL(journal.getFinishedTiles().size(), 2);
+	BOOST_CHECK(journal.getFinishedTiles().count(PATH(1, 2, 3, 4)));
+
+	// only the hashes in the finished subtrees are kept
+	renderer::TileHashIndex tile_hashes;
+	tile_hashes.setHash(PATH(1, 2, 3, 4) + 2, 1);
+	tile_hashes.setHash(PATH(1, 2, 3, 1), 2);
+	tile_hashes.setHash(PATH(1, 2, 3, 4).parent(), 3);
+	journal.updateTileHashes(tile_hashes);
+	BOOST_CHECK_EQUAL(tile_hashes.size(), 3);
+	BOOST_CHECK_EQUAL(tile_hashes.getHash(PATH(1, 2, 3, 4) + 1), 42);
+	BOOST_CHECK_EQUAL(tile_hashes.getHash(PATH(1, 2, 3, 4) + 2), 1);
+	BOOST_CHECK_EQUAL(tile_hashes.getHash(PATH(3, 1, 1, 1)), 43);
+
+	// a new journal keeps the finished tiles
+	BOOST_REQUIRE(journal.open(filename, "key", false));
+	renderer::RenderJournal journal2;
+	BOOST_REQUIRE(journal2.read(filename, "key"));
+	BOOST_CHECK_EQUAL(journal2.getFinishedTiles().size(), 2);
+	journal.remove();
+	BOOST_CHECK(!fs::exists(filename));
+}
+
+BOOST_AUTO_TEST_CASE(test_tileset_resume) {
+	mc::World world("data");
+	BOOST_REQUIRE(world.load());
+	renderer::TileSet tile_set(world);
+	int depth = tile_set.getDepth();
+	BOOST_REQUIRE(depth >= 3);
+
+	// an interrupted rendering of all tiles finished the render work of one composite
+	// tile two zoom levels above the render tiles and crashed during the next one
+	tile_set.scanRequiredByTimestamp(0);
+	std::vector<renderer::TilePath> required_tiles;
+	const std::vector<renderer::TilePos>& render_tiles = tile_set.getRequiredRenderTiles();
+	for (auto it = render_tiles.begin(); it != render_tiles.end(); ++it)
+		required_tiles.push_back(renderer::TilePath::byTilePos(*it, depth));
+	std::vector<renderer::TilePath> works;
+	const std::vector<renderer::TilePath>& composite_tiles
+		= tile_set.getRequiredCompositeTiles();
+	for (auto it = composite_tiles.begin(); it != composite_tiles.end(); ++it)
+		if (it->getDepth() == depth - 2)
+			works.push_back(*it);
+	BOOST_REQUIRE(works.size() >= 2);
+	renderer::TilePath finished = works[0], interrupted = works[1];
+
+	// the tile images written by it are newer than their chunks now
+	std::vector<std::pair<uint64_t, int64_t> > times, fresh_times;
+	for (auto it = required_tiles.begin(); it != required_tiles.end(); ++it) {
+		bool written = it->parent().parent() == finished
+				|| it->parent().parent() == interrupted;
+		times.push_back(std::make_pair(it->getKey(),
+				written ? std::numeric_limits<int64_t>::max() : 0));
+		fresh_times.push_back(std::make_pair(it->getKey(),
+				std::numeric_limits<int64_t>::max()));
+	}
+	std::sort(times.begin(), times.end());
+	std::sort(fresh_times.begin(), fresh_times.end());
+	tile_set.scanRequiredByTileTimes(times);
+	BOOST_CHECK(!tile_set.isTileRequired(interrupted));
+
+	// the required tiles of the journal are required again without the finished ones
+	tile_set.addRequiredRenderTiles(required_tiles);
+	tile_set.removeRequiredSubtrees({finished});
+	int finished_tiles = 0;
+	for (auto it = required_tiles.begin(); it != required_tiles.end(); ++it) {
+		bool in_finished = it->parent().parent() == finished;
+		finished_tiles += in_finished;
+		BOOST_CHECK_EQUAL(tile_set.isTileRequired(*it), !in_finished);
+	}
+	BOOST_CHECK_EQUAL(tile_set.getRequiredRenderTilesCount(),
+			required_tiles.size() - finished_tiles);
+	BOOST_CHECK(tile_set.isTileRequired(interrupted));
+	BOOST_CHECK(!tile_set.isTileRequired(finished));
+
+	// the composite tiles containing a finished tile are required in any case
+	tile_set.scanRequiredByTileTimes(fresh_times);
+	BOOST_CHECK_EQUAL(tile_set.getRequiredCompositeTilesCount(), 0);
+	tile_set.removeRequiredSubtrees({finished});
+	BOOST_CHECK_EQUAL(tile_set.getRequiredCompositeTilesCount(), depth - 2);
+	for (renderer::TilePath tile = finished.parent(); ; tile = tile.parent()) {
+		BOOST_CHECK(tile_set.isTileRequired(tile));
+		if (tile.getDepth() == 0)
+			break;
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_tilesetindex) {
+	// region files modified in the last seconds are not indexed,
+	// the test uses a copy of the world with an old region file
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	fs::path filename = dir / "tileset.index";
+	fs::create_directories(dir / "region");
+	fs::copy_file("data/region/r.-1.0.mca", dir / "region" / "r.-1.0.mca");
+	fs::last_write_time(dir / "region" / "r.-1.0.mca", std::time(nullptr) - 3600);
+	mc::World world(dir.string());
+	BOOST_REQUIRE(world.load());
+
+	renderer::TileSetIndex index;
+	renderer::TileSet tile_set;
+	tile_set.scan(world, &index);
+	BOOST_CHECK_EQUAL(index.getScannedRegionsCount(), 1);
+	BOOST_REQUIRE(index.write(filename.string(), "key"));
+
+	// the tiles of the unchanged region are taken from the index
+	renderer::TileSetIndex index2;
+	BOOST_CHECK(!index2.read(filename.string(), "other key"));
+	BOOST_REQUIRE(index2.read(filename.string(), "key"));
+	renderer::TileSet tile_set2;
+	tile_set2.scan(world, &index2);
+	BOOST_CHECK_EQUAL(index2.getScannedRegionsCount(), 0);
+	BOOST_CHECK_EQUAL(index2.getIndexedRegionsCount(), 1);
+	BOOST_CHECK_EQUAL(tile_set2.getDepth(), tile_set.getDepth());
+	tile_set.scanRequiredByTimestamp(0);
+	tile_set2.scanRequiredByTimestamp(0);
+	BOOST_CHECK(tile_set2.getRequiredRenderTiles() == tile_set.getRequiredRenderTiles());
+	BOOST_CHECK(tile_set2.getRequiredCompositeTiles() == tile_set.getRequiredCompositeTiles());
+
+	fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(test_chunkhashindex) {
+	// the sections of a chunk cover the same tiles as the whole chunk
+	for (int x = -2; x <= 2; x++)
+		for (int z = -2; z <= 2; z++) {
+			mc::ChunkPos chunk(x, z);
+			std::vector<renderer::TilePos> chunk_tiles, section_tiles;
+			renderer::getChunkTiles(chunk, chunk_tiles);
+			for (int i = 0; i < mc::CHUNK_HEIGHT; i++)
+				renderer::getChunkSectionTiles(chunk, i, section_tiles);
+			std::sort(chunk_tiles.begin(), chunk_tiles.end());
+			chunk_tiles.erase(std::unique(chunk_tiles.begin(), chunk_tiles.end()),
+					chunk_tiles.end());
+			std::sort(section_tiles.begin(), section_tiles.end());
+			section_tiles.erase(std::unique(section_tiles.begin(), section_tiles.end()),
+					section_tiles.end());
+			BOOST_CHECK(section_tiles == chunk_tiles);
+		}
+
+	fs::path filename = fs::temp_directory_path() / fs::unique_path();
+	mc::World world("data");
+	BOOST_REQUIRE(world.load());
+	renderer::TileSet tile_set(world);
+
+	// without hashes of a last rendering all sections changed
+	renderer::ChunkHashIndex hashes;
+	tile_set.scanRequiredByHashes(world, 0, hashes);
+	BOOST_CHECK(hashes.getReadChunksCount() > 0);
+	BOOST_CHECK(hashes.getChangedSectionsCount() > 0);
+	BOOST_CHECK(tile_set.getRequiredRenderTilesCount() > 0);
+	BOOST_REQUIRE(hashes.write(filename.string(), "key"));
+
+	// chunks with newer timestamps, but unchanged sections don't require tiles
+	renderer::ChunkHashIndex hashes2;
+	BOOST_CHECK(!hashes2.read(filename.string(), "other key"));
+	BOOST_REQUIRE(hashes2.read(filename.string(), "key"));
+	tile_set.scanRequiredByHashes(world, 0, hashes2);
+	BOOST_CHECK_EQUAL(hashes2.getReadChunksCount(), hashes.getReadChunksCount());
+	BOOST_CHECK_EQUAL(hashes2.getChangedSectionsCount(), 0);
+	BOOST_CHECK_EQUAL(tile_set.getRequiredRenderTilesCount(), 0);
+
+	fs::remove(filename);
+}
+
+BOOST_AUTO_TEST_CASE(test_tilehashindex) {
+	fs::path filename = fs::temp_directory_path() / fs::unique_path();
+	renderer::TileHashIndex hashes;
+	hashes.setHash(PATH(1, 2, 3, 4), 42);
+	hashes.setHash(renderer::TilePath(), 43);
+	hashes.setHash(PATH(4, 3, 2, 1), 44);
+	hashes.setHash(PATH(4, 3, 2, 1), 0);
+	BOOST_REQUIRE(hashes.write(filename.string(), "key"));
+
+	renderer::TileHashIndex hashes2;
+	BOOST_CHECK(!hashes2.read(filename.string(), "other key"));
+	BOOST_REQUIRE(hashes2.read(filename.string(), "key"));
+	BOOST_CHECK_EQUAL(hashes2.size(), 2);
+	BOOST_CHECK_EQUAL(hashes2.getHash(PATH(1, 2, 3, 4)), 42);
+	BOOST_CHECK_EQUAL(hashes2.getHash(renderer::TilePath()), 43);
+	BOOST_CHECK_EQUAL(hashes2.getHash(PATH(4, 3, 2, 1)), 0);
+
+	fs::remove(filename);
+}
+
+BOOST_AUTO_TEST_CASE(test_tileset_filetimes) {
+	fs::path dir = fs::temp_directory_path() / fs::unique_path();
+	mc::World world("data");
+	BOOST_REQUIRE(world.load());
+	renderer::TileSet tile_set(world);
+	int depth = tile_set.getDepth();
+
+	// the tile files are newer than the chunks, only a missing and an old file are required
+	tile_set.scanRequiredByTimestamp(0);
+	std::vector<renderer::TilePath> tiles;
+	const std::vector<renderer::TilePos>& render_tiles = tile_set.getRequiredRenderTiles();
+	for (auto it = render_tiles.begin(); it != render_tiles.end(); ++it) {
+		tiles.push_back(renderer::TilePath::byTilePos(*it, depth));
+		fs::path file = dir / (tiles.back().toString() + ".png");
+		fs::create_directories(file.parent_path());
+		std::ofstream(file.string()) << "png";
+	}
+	BOOST_REQUIRE(tiles.size() >= 2);
+	fs::remove(dir / (tiles[0].toString() + ".png"));
+	fs::last_write_time(dir / (tiles[1].toString() + ".png"), 0);
+
+	tile_set.scanRequiredByFiletimes(dir, "png", 2);
+	BOOST_CHECK_EQUAL(tile_set.getRequiredRenderTilesCount(), 2);
+	BOOST_CHECK(tile_set.isTileRequired(tiles[0]));
+	BOOST_CHECK(tile_set.isTileRequired(tiles[1]));
+	BOOST_CHECK(tile_set.isTileRequired(tiles[0].parent()));
+
+	fs::remove_all(dir);
+}
+
+/**
+ * Returns the color of the center of the quadrant of a child tile in a composite tile.
+ */
+renderer::RGBAPixel getQuadrantColor(const renderer::RGBAImage& image,
+		const renderer::TilePath& child) {
+	int i = child.getPath().back();
+	int x = (i == 2 || i == 4) ? image.getWidth() / 2 : 0;
+	int y = (i == 3 || i == 4) ? image.getHeight() / 2 : 0;
+	return image.getPixel(x + image.getWidth() / 4, y + image.getHeight() / 4);
+}
+
+BOOST_AUTO_TEST_CASE(test_tilerenderworker_prune) {
+	mc::World world("data");
+	BOOST_REQUIRE(world.load());
+	std::shared_ptr<renderer::TileSet> tile_set(new renderer::TileSet(world));
+	int depth = tile_set->getDepth();
+	BOOST_REQUIRE(depth >= 3);
+
+	renderer::RenderContext context;
+	context.output_dir = fs::temp_directory_path() / fs::unique_path();
+	context.tile_set = tile_set;
+	context.tile_hashes.reset(new renderer::TileHashIndex);
+	renderer::TileRenderWorker worker;
+	worker.setRenderContext(context);
+
+	// a last rendering wrote red render tiles and blue composite tiles
+	int size = context.map_config.getTextureSize() * 32 * renderer::TILE_WIDTH;
+	renderer::RGBAImage red(size, size), green(size, size), blue(size, size);
+	red.fill(renderer::rgba(255, 0, 0), 0, 0, size, size);
+	green.fill(renderer::rgba(0, 255, 0), 0, 0, size, size);
+	blue.fill(renderer::rgba(0, 0, 255), 0, 0, size, size);
+	tile_set->scanRequiredByTimestamp(0);
+	worker.setRenderWork(renderer::RenderWork());
+	std::vector<std::pair<uint64_t, int64_t> > times;
+	const std::vector<renderer::TilePos>& render_tiles = tile_set->getRequiredRenderTiles();
+	for (auto it = render_tiles.begin(); it != render_tiles.end(); ++it) {
+		renderer::TilePath tile = renderer::TilePath::byTilePos(*it, depth);
+		worker.saveTile(tile, red);
+		times.push_back(std::make_pair(tile.getKey(), std::numeric_limits<int64_t>::max()));
+	}
+	const std::vector<renderer::TilePath>& composite_tiles
+		= tile_set->getRequiredCompositeTiles();
+	renderer::TilePath finished;
+	for (auto it = composite_tiles.begin(); it != composite_tiles.end(); ++it) {
+		worker.saveTile(*it, blue);
+		if (it->getDepth() == depth - 2 && finished.getDepth() == 0)
+			finished = *it;
+	}
+	const auto& written = worker.getRenderWorkResult().tile_hashes;
+	for (auto it = written.begin(); it != written.end(); ++it)
+		context.tile_hashes->setHash(it->first, it->second);
+
+	// only the composite tiles containing the tile of a finished render work are required
+	std::sort(times.begin(), times.end());
+	tile_set->scanRequiredByTileTimes(times);
+	tile_set->removeRequiredSubtrees({finished});
+	renderer::TilePath parent = finished.parent();
+	BOOST_REQUIRE(tile_set->isTileRequired(parent));
+
+	// none of their children changed, they are not composed again
+	worker.setRenderWork(renderer::RenderWork());
+	renderer::RGBAImage image;
+	BOOST_CHECK(!worker.renderRecursive(renderer::TilePath(), image));
+	BOOST_CHECK_EQUAL(image.getWidth(), 0);
+	BOOST_CHECK(worker.getRenderWorkResult().tile_hashes.empty());
+
+	// the changed skipped tile of the finished render work is composed into its parent
+	BOOST_CHECK(worker.saveTile(finished, green));
+	renderer::RenderWork work;
+	work.tiles_skip.insert(finished);
+	work.tiles_skip_changed.insert(finished);
+	worker.setRenderWork(work);
+	BOOST_CHECK(worker.renderRecursive(parent, image));
+	BOOST_CHECK_EQUAL(getQuadrantColor(image, finished), renderer::rgba(0, 255, 0));
+
+	// a child removed from the world changes the base tile, the pruned required child
+	// is read from its file then
+	renderer::TilePath removed;
+	for (int i = 1; i <= 4 && removed.getDepth() == 0; i++)
+		if (!tile_set->hasTile(renderer::TilePath() + i))
+			removed = renderer::TilePath() + i;
+	BOOST_REQUIRE(removed.getDepth() == 1);
+	context.tile_hashes->setHash(removed, 1);
+	renderer::TilePath child = parent;
+	while (child.getDepth() > 1)
+		child = child.parent();
+	worker.setRenderWork(renderer::RenderWork());
+	image.clear();
+	BOOST_CHECK(worker.renderRecursive(renderer::TilePath(), image));
+	BOOST_REQUIRE_EQUAL(image.getWidth(), size);
+	BOOST_CHECK_EQUAL(getQuadrantColor(image, child), renderer::rgba(0, 0, 255));
+	const auto& hashes = worker.getRenderWorkResult().tile_hashes;
+	BOOST_CHECK(std::find(hashes.begin(), hashes.end(), std::make_pair(removed, (uint64_t) 0))
+			!= hashes.end());
+
+	fs::remove_all(context.output_dir);
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2012-2015 Moritz Hilscher
+ *
+ * This file is part of Mapcrafter.
+ *
+ * Mapcrafter is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Mapcrafter is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Mapcrafter.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../mapcraftercore/renderer/tilearchive.h"
+#include "../mapcraftercore/util.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+namespace renderer = mapcrafter::renderer;
+
+/**
+ * Parses a tile filename like 1/2/3.png or base.png, returns false if it is invalid.
+ */
+bool parseTileFilename(const std::string& filename, renderer::TilePath& tile,
+		std::string& format) {
+	size_t dot = filename.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+	format = filename.substr(dot + 1);
+	if (format != "png" && format != "jpg")
+		return false;
+
+	std::string path = filename.substr(0, dot);
+	tile = renderer::TilePath();
+	if (path == "base")
+		return true;
+	for (size_t i = 0; i < path.size(); i++) {
+		if (i % 2 == 1 && path[i] == '/')
+			continue;
+		if (i % 2 == 1 || path[i] < '1' || path[i] > '4'
+				|| tile.getDepth() >= renderer::TilePath::MAX_DEPTH)
+			return false;
+		tile += path[i] - '0';
+	}
+	return !path.empty() && path[path.size() - 1] != '/';
+}
+
+std::string getTileFilename(const renderer::TilePath& tile, const std::string& format) {
+	if (tile.getDepth() == 0)
+		return "base." + format;
+	return tile.toString() + "." + format;
+}
+
+/**
+ * Guesses the image format of a tile by the first bytes of the image.
+ */
+std::string getTileFormat(const std::string& data) {
+	if (data.size() >= 4 && data.compare(1, 3, "PNG") == 0)
+		return "png";
+	return "jpg";
+}
+
+void cgiError(const std::string& status) {
+	std::cout << "Status: " << status << "\r\n";
+	std::cout << "Content-Type: text/plain\r\n\r\n";
+	std::cout << status << std::endl;
+}
+
+/**
+ * Serves a tile of an archive as CGI program. The tile is specified with the path info
+ * of the request, for example /world/tl/1/2/3.png, the archives are searched in the
+ * directory of the CGI program, which is the output directory of the rendered maps.
+ */
+int serveCGI() {
+	const char* path_info = std::getenv("PATH_INFO");
+	const char* script_filename = std::getenv("SCRIPT_FILENAME");
+	std::string path = path_info != nullptr ? path_info : "";
+
+	// the path info is /<map>/<rotation>/<tile>
+	std::vector<std::string> parts;
+	size_t start = 1;
+	for (int i = 0; i < 2 && start < path.size(); i++) {
+		size_t end = path.find('/', start);
+		if (end == std::string::npos)
+			break;
+		parts.push_back(path.substr(start, end - start));
+		start = end + 1;
+	}
+
+	renderer::TilePath tile;
+	std::string format;
+	if (path.empty() || path[0] != '/' || parts.size() != 2 || parts[0].empty()
+			|| parts[0] == "." || parts[0] == ".."
+			|| (parts[1] != "tl" && parts[1] != "tr" && parts[1] != "br" && parts[1] != "bl")
+			|| !parseTileFilename(path.substr(start), tile, format)) {
+		cgiError("400 Bad Request");
+		return 0;
+	}
+
+	fs::path output_dir = script_filename != nullptr
+			? fs::path(script_filename).parent_path() : fs::current_path();
+	fs::path filename = output_dir / parts[0] / (parts[1] + ".tiles");
+
+	// only the entry of the tile is read from the index, not the whole archive index
+	std::string data;
+	if (!renderer::TileArchive::readSingleTile(filename, tile, data)
+			|| getTileFormat(data) != format) {
+		cgiError("404 Not Found");
+		return 0;
+	}
+
+	std::cout << "Content-Type: " << (format == "png" ? "image/png" : "image/jpeg") << "\r\n";
+	std::cout << "Content-Length: " << data.size() << "\r\n";
+	std::cout << "Cache-Control: max-age=60\r\n\r\n";
+	std::cout.write(data.data(), data.size());
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	// the program is called as CGI program by the web server
+	if (std::getenv("GATEWAY_INTERFACE") != nullptr)
+		return serveCGI();
+
+	std::string command = argc > 1 ? argv[1] : "";
+	if ((command != "list" && command != "extract" && command != "compact")
+			|| (command == "extract" && argc != 4) || (command != "extract" && argc != 3)) {
+		std::cerr << "Usage: ./mapcrafter_tilearchive list <archive>" << std::endl;
+		std::cerr << "       ./mapcrafter_tilearchive extract <archive> <directory>" << std::endl;
+		std::cerr << "       ./mapcrafter_tilearchive compact <archive>" << std::endl;
+		std::cerr << std::endl;
+		std::cerr << "Copy or link the program as tiles.cgi to the output directory "
+				<< "to serve the tiles of archives to the web interface." << std::endl;
+		return 1;
+	}
+
+	renderer::TileArchive archive;
+	if (!archive.open(argv[2], command != "compact"))
+		return 1;
+
+	if (command == "compact") {
+		uint64_t size = archive.getSize();
+		if (!archive.compact() || !archive.close())
+			return 1;
+		std::cout << "Compacted tile archive from " << size << " to "
+				<< archive.getSize() << " bytes." << std::endl;
+		return 0;
+	}
+
+	std::vector<renderer::TilePath> tiles = archive.getTiles();
+	std::string data;
+	for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+		if (!archive.readTile(*it, data)) {
+			std::cerr << "Unable to read tile " << *it << "." << std::endl;
+			return 1;
+		}
+
+		std::string filename = getTileFilename(*it, getTileFormat(data));
+		if (command == "list") {
+			std::cout << filename << " " << data.size() << std::endl;
+			continue;
+		}
+
+		fs::path file = fs::path(argv[3]) / filename;
+		if (!fs::exists(file.parent_path()))
+			fs::create_directories(file.parent_path());
+		std::ofstream out(file.string(), std::ios::binary);
+		out.write(data.data(), data.size());
+		if (!out) {
+			std::cerr << "Unable to write '" << file.string() << "'." << std::endl;
+			return 1;
+		}
+	}
+
+	if (command == "extract")
+		std::cout << "Extracted " << tiles.size() << " tiles." << std::endl;
+	return 0;
+}